@@ -29,6 +29,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_timing.h"
 #include "common/film.h"
 #include "common/file_location.h"
 #include "common/history.h"
@@ -59,6 +60,25 @@
 // Make sure it's OK to limit output extension length
 #define DT_MAX_OUTPUT_EXT_LENGTH 5
 
+// state shared by the export workers of --jobs
+typedef struct dt_cli_export_t
+{
+  dt_imgid_t *ids;
+  int total;
+  dt_atomic_int next;
+  dt_atomic_int res;
+  int omp_threads;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *fdata;
+  gboolean custom_presets, high_quality, upscale, export_masks;
+  dt_colorspaces_color_profile_type_t icc_type;
+  const gchar *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+  dt_export_timing_t **timings; // per image, NULL unless --timing-output
+} dt_cli_export_t;
+
 static void usage(const char *progname)
 {
 fprintf(stderr, "darktable %s\n"
@@ -102,6 +122,11 @@ fprintf(stderr, "darktable %s\n"
                 "   --icc-file <file> specify icc filename, default to NONE\n"
                 "   --icc-intent <intent> specify icc intent, default to LAST\n"
                 "                     use --help icc-intent for list of supported intents\n"
+                "   --jobs <n> export n images in parallel, sharing the memory\n"
+                "              available for processing, default: 1\n"
+                "   --timing-output <file> write the times taken by each export step\n"
+                "                          and module, as CSV if file ends in .csv,\n"
+                "                          JSON otherwise\n"
                 "   --verbose\n"
                 "   -h, --help [option]\n"
                 "   -v, --version\n",
@@ -212,6 +237,77 @@ static gboolean _inputs_have_xmp_sidecar(const GList* inputs)
   return inputs != NULL;
 }
 
+static void _export_metadata(const gboolean custom_presets,
+                             dt_export_metadata_t *metadata)
+{
+  // TODO: have a parameter in command line to get the export presets
+  if(custom_presets)
+  {
+    metadata->flags = dt_lib_export_metadata_get_conf_flags();
+    metadata->list = dt_util_str_to_glist("\1", dt_lib_export_metadata_get_conf());
+    if(metadata->list)
+      metadata->list = g_list_remove(metadata->list, metadata->list->data);
+  }
+  else
+  {
+    metadata->flags = dt_lib_export_metadata_default_flags();
+    metadata->list = NULL;
+  }
+}
+
+/* exports images from the shared list until none is left. called once
+   in the main thread, or from each thread for --jobs. the storage
+   params are shared (the disk storage serializes its filename
+   handling), the format params get written per image so every
+   parallel worker uses its own copy.
+*/
+static void *_export_worker(void *data)
+{
+  dt_cli_export_t *ex = data;
+
+  dt_imageio_module_data_t *fdata = ex->fdata;
+  if(ex->omp_threads > 0)
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(ex->omp_threads);
+#endif
+    fdata = ex->format->get_params(ex->format);
+    if(fdata == NULL)
+    {
+      dt_atomic_set_int(&ex->res, 1);
+      return NULL;
+    }
+    fdata->max_width = ex->fdata->max_width;
+    fdata->max_height = ex->fdata->max_height;
+    g_strlcpy(fdata->style, ex->fdata->style, sizeof(fdata->style));
+    fdata->style_append = ex->fdata->style_append;
+  }
+
+  int k;
+  while((k = dt_atomic_add_int(&ex->next, 1)) < ex->total)
+  {
+    dt_export_metadata_t metadata;
+    _export_metadata(ex->custom_presets, &metadata);
+    if(ex->timings) dt_export_timing_begin(ex->ids[k]);
+    const double start = dt_get_wtime();
+    const gboolean failed =
+      ex->storage->store(ex->storage, ex->sdata, ex->ids[k], ex->format, fdata,
+                         k + 1, ex->total, ex->high_quality,
+                         ex->upscale, FALSE, 1.0, ex->export_masks,
+                         ex->icc_type, ex->icc_filename, ex->icc_intent, &metadata) != 0;
+    if(failed)
+      dt_atomic_set_int(&ex->res, 1);
+    if(ex->timings)
+    {
+      ex->timings[k] = dt_export_timing_end(!failed);
+      if(ex->timings[k]) ex->timings[k]->total = dt_get_wtime() - start;
+    }
+  }
+
+  if(fdata != ex->fdata) ex->format->free_params(ex->format, fdata);
+  return NULL;
+}
+
 int main(int argc, char *arg[])
 {
 #ifdef __APPLE__
@@ -233,8 +329,10 @@ int main(int argc, char *arg[])
   gchar *output_ext = NULL;
   char *style = NULL;
   char *library = NULL;
+  char *timing_output = NULL;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
+  int jobs = 1;
   gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE,
            style_overwrite = FALSE, custom_presets = TRUE, export_masks = FALSE,
            output_to_dir = FALSE;
@@ -432,6 +530,16 @@ int main(int argc, char *arg[])
           exit(1);
         }
       }
+      else if(!strcmp(arg[k], "--timing-output") && argc > k + 1)
+      {
+        k++;
+        timing_output = arg[k];
+      }
+      else if(!strcmp(arg[k], "--jobs") && argc > k + 1)
+      {
+        k++;
+        jobs = MAX(atoi(arg[k]), 1);
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -852,30 +960,81 @@ int main(int argc, char *arg[])
 
   // TODO: add a callback to set the bpp without going through the config
 
-  int num = 1, res = 0;
-  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
+  dt_cli_export_t ex = { 0 };
+  ex.total = g_list_length(id_list);
+  ex.ids = g_new(dt_imgid_t, ex.total);
+  int n = 0;
+  for(GList *iter = id_list; iter; iter = g_list_next(iter))
+    ex.ids[n++] = GPOINTER_TO_INT(iter->data);
+  ex.storage = storage;
+  ex.sdata = sdata;
+  ex.format = format;
+  ex.fdata = fdata;
+  ex.custom_presets = custom_presets;
+  ex.high_quality = high_quality;
+  ex.upscale = upscale;
+  ex.export_masks = export_masks;
+  ex.icc_type = icc_type;
+  ex.icc_filename = icc_filename;
+  ex.icc_intent = icc_intent;
+  if(timing_output) ex.timings = g_new0(dt_export_timing_t *, ex.total);
+
+  // storages preparing a set of images can't be fed in parallel
+  jobs = storage->initialize_store ? 1 : MIN(jobs, ex.total);
+
+  // the pipes share the memory and cpu cores darktable has been granted.
+  // dt_get_available_mem() now reports the budget per pipe, so tiling and
+  // the pixelpipe caches are sized accordingly.
+  darktable.dtresources.pipe_share = jobs;
+  ex.omp_threads = MAX(1, darktable.num_openmp_threads / jobs);
+
+  const double start = dt_get_wtime();
+  if(jobs == 1)
   {
-    const int id = GPOINTER_TO_INT(iter->data);
-    dt_export_metadata_t metadata;
-    // TODO: have a parameter in command line to get the export presets
-    if(custom_presets)
-    {
-      metadata.flags = dt_lib_export_metadata_get_conf_flags();
-      metadata.list = dt_util_str_to_glist("\1", dt_lib_export_metadata_get_conf());
-      if(metadata.list)
-        metadata.list = g_list_remove(metadata.list, metadata.list->data);
-    }
-    else
+    ex.omp_threads = 0;
+    _export_worker(&ex);
+  }
+  else
+  {
+    if(verbose)
+      printf("exporting %d images with %d jobs, %zuMB and %d threads per job\n",
+             ex.total, jobs, dt_get_available_mem() / DT_MEGA, ex.omp_threads);
+
+    pthread_t *workers = g_new(pthread_t, jobs);
+    int started = 0;
+    for(; started < jobs; started++)
+      if(dt_pthread_create(&workers[started], _export_worker, &ex))
+        break;
+    // in case no thread could be spawned at all we still do the work
+    if(started == 0) _export_worker(&ex);
+    for(int j = 0; j < started; j++)
+      pthread_join(workers[j], NULL);
+    g_free(workers);
+  }
+  const double elapsed = dt_get_wtime() - start;
+  int res = dt_atomic_get_int(&ex.res);
+
+  if(verbose || jobs > 1)
+    printf("exported %d images in %.2f secs, %.2f images/sec\n",
+           ex.total, elapsed, elapsed > 0.0 ? ex.total / elapsed : 0.0);
+
+  if(ex.timings)
+  {
+    GList *timings = NULL;
+    for(int i = ex.total - 1; i >= 0; i--)
+      if(ex.timings[i]) timings = g_list_prepend(timings, ex.timings[i]);
+    if(dt_export_timing_write(timings, timing_output,
+                              dt_export_timing_format_from_filename(timing_output)))
     {
-      metadata.flags = dt_lib_export_metadata_default_flags();
-      metadata.list = NULL;
-    }
-    if(storage->store(storage, sdata, id, format, fdata, num, total, high_quality,
-                      upscale, FALSE, 1.0, export_masks,
-                      icc_type, icc_filename, icc_intent, &metadata) != 0)
+      fprintf(stderr, _("error: can't write timing output %s\n"), timing_output);
       res = 1;
+    }
+    g_list_free_full(timings, (GDestroyNotify)dt_export_timing_free);
+    g_free(ex.timings);
   }
 
+  g_free(ex.ids);
+
   // cleanup time
   if(storage->finalize_store) storage->finalize_store(storage, sdata);
   storage->free_params(storage, sdata);
@@ -28,15 +28,44 @@
 #include "win/main_wrapper.h"
 #endif
 
+// print what the binary cache of each device held and what had to be built
+static void _print_programs(void)
+{
+  const dt_opencl_t *cl = darktable.opencl;
+  if(!cl || !cl->inited)
+  {
+    printf("no usable OpenCL device\n");
+    return;
+  }
+  for(int dev = 0; dev < cl->num_devs; dev++)
+  {
+    const dt_opencl_device_t *d = &cl->dev[dev];
+    printf("%s: %d programs loaded from cache, %d built, %.2f s\n",
+           d->fullname, d->programs_cached, d->programs_built, d->programs_time);
+  }
+}
+
 int main(int argc, char *arg[])
 {
 #ifdef __APPLE__
   dt_osx_prepare_environment();
 #endif
   int result = 1;
+  // --warm only fills the kernel cache, e.g. after a driver update, and
+  // tells how it went instead of the full OpenCL debug output
+  gboolean warm = FALSE;
+  for(int i = 1; i < argc; i++)
+    if(!strcmp(arg[i], "--warm"))
+    {
+      warm = TRUE;
+      for(int k = i; k < argc - 1; k++) arg[k] = arg[k + 1];
+      argc--;
+      break;
+    }
+
   // only used to force-init opencl, so we want these options:
-  char *m_arg[] = { "-d", "opencl", "--library", ":memory:"};
-  const int m_argc = sizeof(m_arg) / sizeof(m_arg[0]);
+  char *m_arg[] = { "--library", ":memory:", "-d", "opencl" };
+  const int m_argc = sizeof(m_arg) / sizeof(m_arg[0]) - (warm ? 2 : 0);
   char **argv = malloc(sizeof(arg[0]) * argc + sizeof(m_arg));
   if(!argv) goto end;
   for(int i = 0; i < argc; i++)
@@ -45,16 +74,20 @@ int main(int argc, char *arg[])
     argv[argc + i] = m_arg[i];
   argc += m_argc;
   if(dt_init(argc, argv, FALSE, FALSE, NULL)) goto end;
+  if(warm) _print_programs();
+  result = warm && !darktable.opencl->inited;
   dt_cleanup();
   free(argv);
 
-  result = 0;
 end:
 
 #ifdef _WIN32
-  printf("\npress any key to exit\n");
-  FlushConsoleInputBuffer(GetStdHandle(STD_INPUT_HANDLE));
-  getch();
+  if(!warm)
+  {
+    printf("\npress any key to exit\n");
+    FlushConsoleInputBuffer(GetStdHandle(STD_INPUT_HANDLE));
+    getch();
+  }
 #endif
 
   exit(result);
@@ -0,0 +1,297 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/bufferpool.h"
+#include "control/conf.h"
+
+#include <inttypes.h>
+
+#define DT_BUFFERPOOL_MIN_LOG 20      // blocks below 1MB are not pooled
+#define DT_BUFFERPOOL_STEPS 4         // size classes per power of two
+#define DT_BUFFERPOOL_CLASSES ((64 - DT_BUFFERPOOL_MIN_LOG) * DT_BUFFERPOOL_STEPS + 1)
+// pool blocks are page aligned, which lets dt_free_align() skip the
+// lookup for almost all other blocks
+#define DT_BUFFERPOOL_ALIGN 4096
+#define DT_BUFFERPOOL_TRIM_INTERVAL 5.0
+
+typedef struct _pool_class_t
+{
+  GSList *free; // blocks ready to be handed out
+  int cached;   // number of blocks in free
+  int used;     // blocks handed out
+  int high;     // most blocks used at once since the last trim
+} _pool_class_t;
+
+static struct
+{
+  gboolean enabled;
+  dt_pthread_mutex_t lock;
+  void *(*alloc)(size_t size, size_t alignment);
+  void (*release)(void *mem);
+  GHashTable *blocks;    // block handed out -> requested size
+  _pool_class_t classes[DT_BUFFERPOOL_CLASSES];
+  size_t limit;          // most bytes kept in the free lists
+  size_t cached;         // bytes in the free lists
+  size_t used;           // bytes handed out
+  size_t requested;      // bytes asked for of the ones handed out
+  size_t peak_used;
+  size_t peak_cached;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t trimmed;
+  double last_trim;
+  guint trim_timeout;    // trims an idle pool from the main loop
+} _pool = { 0 };
+
+static inline int _class_index(const size_t size)
+{
+  const int lg = 63 - __builtin_clzll((unsigned long long)size);
+  const size_t base = (size_t)1 << lg;
+  const size_t step = base / DT_BUFFERPOOL_STEPS;
+  // a size just above a power of two ends up in the first class of the next one
+  return (lg - DT_BUFFERPOOL_MIN_LOG) * DT_BUFFERPOOL_STEPS + (int)((size - base + step - 1) / step);
+}
+
+static inline size_t _class_size(const int index)
+{
+  const size_t base = (size_t)1 << (DT_BUFFERPOOL_MIN_LOG + index / DT_BUFFERPOOL_STEPS);
+  return base + (index % DT_BUFFERPOOL_STEPS) * (base / DT_BUFFERPOOL_STEPS);
+}
+
+// take the blocks that are not needed to cover the high-water mark of
+// their class off the free lists, returns them to be released without
+// holding the lock
+static GSList *_pool_trim(const gboolean all)
+{
+  GSList *drop = NULL;
+  for(int k = 0; k < DT_BUFFERPOOL_CLASSES; k++)
+  {
+    _pool_class_t *c = &_pool.classes[k];
+    const int keep = all ? 0 : MAX(0, c->high - c->used);
+    while(c->cached > keep)
+    {
+      GSList *l = c->free;
+      c->free = g_slist_remove_link(c->free, l);
+      drop = g_slist_concat(l, drop);
+      c->cached--;
+      _pool.cached -= _class_size(k);
+      _pool.trimmed++;
+    }
+    c->high = c->used;
+  }
+  return drop;
+}
+
+static GSList *_pool_maybe_trim(void)
+{
+  const double now = dt_get_wtime();
+  if(now - _pool.last_trim < DT_BUFFERPOOL_TRIM_INTERVAL) return NULL;
+  _pool.last_trim = now;
+  return _pool_trim(FALSE);
+}
+
+static void _pool_release_list(GSList *blocks)
+{
+  for(GSList *l = blocks; l; l = g_slist_next(l))
+    _pool.release(l->data);
+  g_slist_free(blocks);
+}
+
+// without allocations the pool would never be trimmed, so once the pipes
+// are idle two trims give all cached blocks back
+static gboolean _pool_trim_timeout(gpointer user_data)
+{
+  dt_pthread_mutex_lock(&_pool.lock);
+  GSList *drop = _pool_maybe_trim();
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  _pool_release_list(drop);
+  return G_SOURCE_CONTINUE;
+}
+
+void dt_bufferpool_init(void *(*alloc)(size_t size, size_t alignment),
+                        void (*release)(void *mem))
+{
+  _pool.alloc = alloc;
+  _pool.release = release;
+
+  const int64_t mb = dt_conf_get_int64("memory_pool_size");
+  _pool.limit = MIN((size_t)MAX(0, mb) * 1024lu * 1024lu, dt_get_available_mem() / 4);
+  if(_pool.limit == 0) return;
+
+  dt_pthread_mutex_init(&_pool.lock, NULL);
+  _pool.blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+  _pool.last_trim = dt_get_wtime();
+  _pool.enabled = TRUE;
+  // only fires where a main loop runs, the command line tools are busy
+  // until they exit anyway
+  _pool.trim_timeout = g_timeout_add_seconds((guint)DT_BUFFERPOOL_TRIM_INTERVAL,
+                                             _pool_trim_timeout, NULL);
+
+  dt_print(DT_DEBUG_MEMORY, "[bufferpool] caching up to %zuMB of image buffers",
+           _pool.limit / (1024lu * 1024lu));
+}
+
+void dt_bufferpool_cleanup(void)
+{
+  if(!_pool.enabled) return;
+
+  dt_bufferpool_print();
+
+  if(_pool.trim_timeout) g_source_remove(_pool.trim_timeout);
+  _pool.trim_timeout = 0;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  _pool.enabled = FALSE;
+  GSList *drop = _pool_trim(TRUE);
+  // the blocks still handed out are plain aligned blocks, freed as such
+  g_hash_table_destroy(_pool.blocks);
+  _pool.blocks = NULL;
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  _pool_release_list(drop);
+}
+
+void *dt_bufferpool_alloc(const size_t size)
+{
+  if(!_pool.enabled || size < ((size_t)1 << DT_BUFFERPOOL_MIN_LOG)) return NULL;
+
+  const int index = _class_index(size);
+  const size_t csize = _class_size(index);
+  _pool_class_t *c = &_pool.classes[index];
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  void *mem = NULL;
+  if(c->free)
+  {
+    mem = c->free->data;
+    c->free = g_slist_delete_link(c->free, c->free);
+    c->cached--;
+    _pool.cached -= csize;
+    _pool.hits++;
+  }
+  else
+    _pool.misses++;
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  if(!mem)
+  {
+    mem = _pool.alloc(csize, DT_BUFFERPOOL_ALIGN);
+    if(!mem)
+    {
+      // give back everything cached before failing
+      dt_pthread_mutex_lock(&_pool.lock);
+      GSList *drop = _pool_trim(TRUE);
+      dt_pthread_mutex_unlock(&_pool.lock);
+      _pool_release_list(drop);
+      mem = _pool.alloc(csize, DT_BUFFERPOOL_ALIGN);
+      if(!mem) return NULL;
+    }
+  }
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  g_hash_table_insert(_pool.blocks, mem, GSIZE_TO_POINTER(size));
+  c->used++;
+  c->high = MAX(c->high, c->used);
+  _pool.used += csize;
+  _pool.requested += size;
+  _pool.peak_used = MAX(_pool.peak_used, _pool.used);
+  GSList *drop = _pool_maybe_trim();
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  _pool_release_list(drop);
+  return mem;
+}
+
+gboolean dt_bufferpool_release(void *mem)
+{
+  if(!_pool.enabled || ((uintptr_t)mem & (DT_BUFFERPOOL_ALIGN - 1))) return FALSE;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  gpointer value = NULL;
+  if(!g_hash_table_lookup_extended(_pool.blocks, mem, NULL, &value))
+  {
+    dt_pthread_mutex_unlock(&_pool.lock);
+    return FALSE;
+  }
+  g_hash_table_remove(_pool.blocks, mem);
+
+  const size_t size = GPOINTER_TO_SIZE(value);
+  const int index = _class_index(size);
+  const size_t csize = _class_size(index);
+  _pool_class_t *c = &_pool.classes[index];
+  c->used--;
+  _pool.used -= csize;
+  _pool.requested -= size;
+
+  if(_pool.cached + csize <= _pool.limit)
+  {
+    c->free = g_slist_prepend(c->free, mem);
+    c->cached++;
+    _pool.cached += csize;
+    _pool.peak_cached = MAX(_pool.peak_cached, _pool.cached);
+    mem = NULL;
+  }
+  GSList *drop = _pool_maybe_trim();
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  if(mem) _pool.release(mem);
+  _pool_release_list(drop);
+  return TRUE;
+}
+
+size_t dt_bufferpool_cached(void)
+{
+  if(!_pool.enabled) return 0;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  const size_t cached = _pool.cached;
+  dt_pthread_mutex_unlock(&_pool.lock);
+  return cached;
+}
+
+void dt_bufferpool_print(void)
+{
+  if(!_pool.enabled || !(darktable.unmuted & DT_DEBUG_MEMORY)) return;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  const uint64_t hits = _pool.hits;
+  const uint64_t misses = _pool.misses;
+  const uint64_t trimmed = _pool.trimmed;
+  const size_t used = _pool.used;
+  const size_t requested = _pool.requested;
+  const size_t cached = _pool.cached;
+  const size_t peak_used = _pool.peak_used;
+  const size_t peak_cached = _pool.peak_cached;
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  const double MB = 1024.0 * 1024.0;
+  dt_print(DT_DEBUG_MEMORY,
+           "[bufferpool] %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hits), %" PRIu64 " blocks trimmed\n"
+           "             in use %.1fMB, %.1f%% size class overhead, peak %.1fMB\n"
+           "             cached %.1fMB, peak %.1fMB, limit %.1fMB",
+           hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, trimmed,
+           used / MB, used ? 100.0 * (used - requested) / used : 0.0, peak_used / MB,
+           cached / MB, peak_cached / MB, _pool.limit / MB);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,65 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/* Pool of large image buffers.
+
+   Every pixelpipe run allocates and frees the same few buffer sizes
+   over and over, for each module and for every pipe. Blocks of at least
+   1MB handed out by dt_alloc_aligned() are rounded up to a size class
+   (four classes per power of two) and kept on a free list of their
+   class when released, to be handed out again to any pipe asking for a
+   buffer of that class.
+
+   Every few seconds each class gives back the blocks that were not
+   needed at its high-water mark since the last trim, so the pool
+   shrinks again once the pipes are done. While idle this is done from
+   the main loop, the command line tools keep their pool until exit.
+   The cached blocks never take more than `memory_pool_size' MB (0
+   disables the pool) and are not counted as available to the pipes
+   by dt_get_available_mem().
+
+   With `-d memory' hits, misses, the size class overhead and the peak
+   usage are reported along with the memory usage of the pixelpipe.
+*/
+
+// set up the pool on top of the given raw aligned allocator
+void dt_bufferpool_init(void *(*alloc)(size_t size, size_t alignment),
+                        void (*release)(void *mem));
+// drop the cached blocks, blocks still in use stay valid
+void dt_bufferpool_cleanup(void);
+
+// a block of at least size bytes, NULL if size is too small for the pool
+void *dt_bufferpool_alloc(const size_t size);
+// returns TRUE if mem was taken back by the pool
+gboolean dt_bufferpool_release(void *mem);
+
+// bytes currently kept in the free lists
+size_t dt_bufferpool_cached(void);
+
+// print the statistics for -d memory
+void dt_bufferpool_print(void);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
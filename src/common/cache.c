@@ -24,56 +24,260 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// this implements a concurrent LRU cache. the key space is split into
+// independently locked shards, each with its own hashtable and lru lists.
+// the total cost is kept as an atomic sum so the quota can be enforced
+// approximately without taking all shard locks.
+//
+// the lru lists are intrusive, so a hit never allocates. with the slru
+// policy an entry starts in the probation segment and is only moved to the
+// protected segment when it is hit again after its first hit, since most
+// entries are read once right after being inserted and filled. a single pass
+// over many keys (like scrolling through a film roll) thus only churns the
+// probation segment and leaves the working set alone.
+
+// share of a shard's quota the protected segment may occupy
+#define DT_CACHE_PROTECTED_RATIO 0.6f
+
+static inline dt_cache_shard_t *_cache_shard(dt_cache_t *cache,
+                                             const uint32_t key)
+{
+  // keys are mostly consecutive image ids, possibly with the mip size in
+  // the upper bits. scramble them so all bits contribute to the shard index.
+  const uint32_t hash = (key ^ (key >> 16)) * 0x45d9f3bu;
+  return cache->shards + ((hash ^ (hash >> 16)) & cache->shard_mask);
+}
+
+static inline void _lru_unlink(dt_cache_shard_t *shard,
+                               dt_cache_entry_t *entry)
+{
+  dt_cache_lru_t *lru = shard->lru + entry->segment;
+  if(entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    lru->head = entry->lru_next;
+  if(entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    lru->tail = entry->lru_prev;
+  entry->lru_prev = entry->lru_next = NULL;
+  lru->cost -= entry->cost;
+}
+
+static inline void _lru_append(dt_cache_shard_t *shard,
+                               dt_cache_entry_t *entry,
+                               const dt_cache_segment_t segment)
+{
+  dt_cache_lru_t *lru = shard->lru + segment;
+  entry->segment = segment;
+  entry->lru_prev = lru->tail;
+  entry->lru_next = NULL;
+  if(lru->tail)
+    lru->tail->lru_next = entry;
+  else
+    lru->head = entry;
+  lru->tail = entry;
+  lru->cost += entry->cost;
+}
+
+// bubble up in lru list, shard lock must be held
+static void _cache_touch(dt_cache_t *cache,
+                         dt_cache_shard_t *shard,
+                         dt_cache_entry_t *entry)
+{
+  _lru_unlink(shard, entry);
+  if(cache->policy == DT_CACHE_POLICY_SLRU
+     && entry->segment == DT_CACHE_SEGMENT_PROBATION
+     && !entry->referenced)
+  {
+    // the first hit after the insert, wait for another one
+    entry->referenced = TRUE;
+    _lru_append(shard, entry, DT_CACHE_SEGMENT_PROBATION);
+  }
+  else if(cache->policy == DT_CACHE_POLICY_SLRU
+          && entry->segment == DT_CACHE_SEGMENT_PROBATION)
+  {
+    __sync_fetch_and_add(&cache->stats_promotions, 1);
+    _lru_append(shard, entry, DT_CACHE_SEGMENT_PROTECTED);
+
+    // keep the protected segment bounded, its oldest entries get a
+    // second chance in probation and go back with their next hit
+    dt_cache_lru_t *protected_lru = shard->lru + DT_CACHE_SEGMENT_PROTECTED;
+    const float limit = DT_CACHE_PROTECTED_RATIO * cache->cost_quota / cache->num_shards;
+    while(protected_lru->cost > limit && protected_lru->head != entry)
+    {
+      dt_cache_entry_t *oldest = protected_lru->head;
+      _lru_unlink(shard, oldest);
+      _lru_append(shard, oldest, DT_CACHE_SEGMENT_PROBATION);
+    }
+  }
+  else
+    _lru_append(shard, entry, entry->segment);
+}
+
+static inline void _cache_add_cost(dt_cache_t *cache,
+                                   dt_cache_shard_t *shard,
+                                   const gssize cost)
+{
+  shard->cost += cost;
+  g_atomic_pointer_add(&cache->cost, cost);
+}
+
+static void _cache_free_entry(dt_cache_t *cache,
+                              dt_cache_entry_t *entry)
+{
+  if(cache->cleanup)
+  {
+    assert(entry->data_size);
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+    cache->cleanup(cache->cleanup_data, entry);
+  }
+  else
+    dt_free_align(entry->data);
+}
 
-// this implements a concurrent LRU cache
+uint32_t dt_cache_auto_shards(const size_t cost_quota,
+                              const size_t max_cost)
+{
+  // eviction works per shard against its share of the quota, an entry
+  // larger than that would be dropped by the next insert into its shard
+  const size_t by_cost = cost_quota / MAX(1, DT_CACHE_MIN_ENTRIES_PER_SHARD * max_cost);
+  const size_t limit = MIN(by_cost, 2 * (size_t)dt_get_num_procs());
+  // a power of two, so dt_cache_init() doesn't round it up again
+  uint32_t shards = 1;
+  while(2 * shards <= limit && shards < DT_CACHE_MAX_SHARDS)
+    shards <<= 1;
+  return shards;
+}
 
 void dt_cache_init(dt_cache_t *cache,
                    const size_t entry_size,
-                   const size_t cost_quota)
+                   const size_t cost_quota,
+                   const uint32_t num_shards)
 {
+  const uint32_t requested = num_shards == DT_CACHE_SHARDS_AUTO
+    ? dt_cache_auto_shards(cost_quota, MAX(entry_size, 1))
+    : num_shards;
+
+  uint32_t shards = 1;
+  while(shards < requested && shards < DT_CACHE_MAX_SHARDS)
+    shards <<= 1;
+
   cache->cost = 0;
-  cache->lru = 0;
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
+  cache->num_shards = shards;
+  cache->shard_mask = shards - 1;
+  cache->shards = dt_calloc_align_type(dt_cache_shard_t, shards);
+  for(uint32_t k = 0; k < shards; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_init(&shard->lock, 0);
+    shard->hashtable = g_hash_table_new(0, 0);
+    memset(shard->lru, 0, sizeof(shard->lru));
+    shard->cost = 0;
+  }
+  cache->policy = DT_CACHE_POLICY_LRU;
+  cache->stats_hits = 0;
+  cache->stats_misses = 0;
+  cache->stats_promotions = 0;
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
 }
 
 void dt_cache_cleanup(dt_cache_t *cache)
 {
-  g_hash_table_destroy(cache->hashtable);
-  for(GList *l = cache->lru; l; l = g_list_next(l))
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = l->data;
-
-    if(cache->cleanup)
+    dt_cache_shard_t *shard = cache->shards + k;
+    g_hash_table_destroy(shard->hashtable);
+    for(int seg = 0; seg < DT_CACHE_SEGMENT_LAST; seg++)
     {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+      dt_cache_entry_t *entry = shard->lru[seg].head;
+      while(entry)
+      {
+        dt_cache_entry_t *next = entry->lru_next;
+        _cache_free_entry(cache, entry);
+        dt_pthread_rwlock_destroy(&entry->lock);
+        g_slice_free1(sizeof(*entry), entry);
+        entry = next;
+      }
+    }
+    dt_pthread_mutex_destroy(&shard->lock);
+  }
+  dt_free_align(cache->shards);
+  cache->shards = NULL;
+}
+
+gboolean dt_cache_contains(dt_cache_t *cache,
+                          const uint32_t key)
+{
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
+  const gboolean result = g_hash_table_contains(shard->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&shard->lock);
+  return result;
+}
+
+// best-effort garbage collection of one segment of a shard. frees from the
+// head of the lru list until either the whole cache or this shard's share
+// of it are below the fill ratio. returns TRUE once that is reached.
+static gboolean _cache_gc_segment(dt_cache_t *cache,
+                                  dt_cache_shard_t *shard,
+                                  const dt_cache_segment_t segment,
+                                  const float fill_ratio)
+{
+  const float shard_quota = (float)cache->cost_quota / cache->num_shards;
+  dt_cache_entry_t *next = shard->lru[segment].head;
+  while(next)
+  {
+    dt_cache_entry_t *entry = next;
+    next = entry->lru_next; // we might remove this element, so walk to
+                            // the next one while we still have the
+                            // pointer..
+    if(dt_cache_get_cost(cache) < cache->cost_quota * fill_ratio
+       || shard->cost < shard_quota * fill_ratio)
+      return TRUE;
 
-      cache->cleanup(cache->cleanup_data, entry);
+    // if still locked by anyone else give up:
+    if(dt_pthread_rwlock_trywrlock(&entry->lock))
+      continue;
+
+    if(entry->_lock_demoting)
+    {
+      // oops, we are currently demoting (rw -> r) lock to this entry
+      // in some thread. do not touch!
+      dt_pthread_rwlock_unlock(&entry->lock);
+      continue;
     }
-    else
-      dt_free_align(entry->data);
 
+    // delete!
+    g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(entry->key));
+    _lru_unlink(shard, entry);
+    _cache_add_cost(cache, shard, -(gssize)entry->cost);
+
+    _cache_free_entry(cache, entry);
+
+    dt_pthread_rwlock_unlock(&entry->lock);
     dt_pthread_rwlock_destroy(&entry->lock);
     g_slice_free1(sizeof(*entry), entry);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  return FALSE;
 }
 
-gboolean dt_cache_contains(dt_cache_t *cache,
-                          const uint32_t key)
+// garbage collection of one shard, shard lock must be held.
+// the probation segment is always emptied first.
+static void _cache_gc_shard(dt_cache_t *cache,
+                            dt_cache_shard_t *shard,
+                            const float fill_ratio)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  const gboolean result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
-  return result;
+  if(!_cache_gc_segment(cache, shard, DT_CACHE_SEGMENT_PROBATION, fill_ratio))
+    _cache_gc_segment(cache, shard, DT_CACHE_SEGMENT_PROTECTED, fill_ratio);
 }
 
 // return read locked bucket, or NULL if it's not already there.
@@ -83,9 +287,10 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache,
                                    const char mode)
 {
   gpointer orig_key, value;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
   const double start = dt_get_debug_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
-  const gboolean res = g_hash_table_lookup_extended(cache->hashtable,
+  dt_pthread_mutex_lock(&shard->lock);
+  const gboolean res = g_hash_table_lookup_extended(shard->hashtable,
                                                     GINT_TO_POINTER(key),
                                                     &orig_key,
                                                     &value);
@@ -99,13 +304,13 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache,
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       return NULL;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _cache_touch(cache, shard, entry);
+    __sync_fetch_and_add(&cache->stats_hits, 1);
+    dt_pthread_mutex_unlock(&shard->lock);
     const double end = dt_get_debug_wtime();
     if(end - start > 0.1)
       dt_print(DT_DEBUG_ALWAYS, "try+ wait time %.06fs mode %c", end - start, mode);
@@ -120,7 +325,8 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache,
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
+  __sync_fetch_and_add(&cache->stats_misses, 1);
   const double end = dt_get_debug_wtime();
   if(end - start > 0.1)
     dt_print(DT_DEBUG_ALWAYS, "try- wait time %.06fs", end - start);
@@ -137,10 +343,11 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache,
                                            const int line)
 {
   gpointer orig_key, value;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
   const double start = dt_get_debug_wtime();
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
-  const gboolean res = g_hash_table_lookup_extended(cache->hashtable,
+  dt_pthread_mutex_lock(&shard->lock);
+  const gboolean res = g_hash_table_lookup_extended(shard->hashtable,
                                                     GINT_TO_POINTER(key),
                                                     &orig_key,
                                                     &value);
@@ -153,14 +360,14 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       g_usleep(5);
       goto restart;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    _cache_touch(cache, shard, entry);
+    __sync_fetch_and_add(&cache->stats_hits, 1);
+    dt_pthread_mutex_unlock(&shard->lock);
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -186,13 +393,25 @@ restart:
   }
 
   // else, not found, need to allocate.
+  __sync_fetch_and_add(&cache->stats_misses, 1);
 
   // first try to clean up.
   // also wait if we can't free more than the requested fill ratio.
-  if(cache->cost > 0.8f * cache->cost_quota)
+  if(dt_cache_get_cost(cache) > 0.8f * cache->cost_quota)
   {
     // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    _cache_gc_shard(cache, shard, 0.8f);
+
+    // this shard may be below its share with the cache still over quota,
+    // if other shards hold entries larger than their share. trim those,
+    // only trying their locks as we hold this one.
+    for(uint32_t k = 0; k < cache->num_shards && dt_cache_get_cost(cache) > cache->cost_quota; k++)
+    {
+      dt_cache_shard_t *other = cache->shards + k;
+      if(other == shard || dt_pthread_mutex_trylock(&other->lock)) continue;
+      _cache_gc_shard(cache, other, 0.8f);
+      dt_pthread_mutex_unlock(&other->lock);
+    }
   }
 
   // here dies your 32-bit system:
@@ -202,11 +421,13 @@ restart:
   entry->data = 0;
   entry->data_size = cache->entry_size;
   entry->cost = 1;
-  entry->link = g_list_append(0, entry);
+  entry->lru_prev = entry->lru_next = NULL;
+  entry->segment = DT_CACHE_SEGMENT_PROBATION;
+  entry->referenced = FALSE;
   entry->key = key;
   entry->_lock_demoting = FALSE;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(shard->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
@@ -226,12 +447,12 @@ restart:
   else
     dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  _cache_add_cost(cache, shard, entry->cost);
 
-  // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  // put at end of probation lru list (most recently used):
+  _lru_append(shard, entry, DT_CACHE_SEGMENT_PROBATION);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   const double end = dt_get_debug_wtime();
   if(end - start > 0.1)
     dt_print(DT_DEBUG_ALWAYS, "wait time %.06fs", end - start);
@@ -246,23 +467,24 @@ gboolean dt_cache_remove(dt_cache_t *cache,
 {
   dt_cache_entry_t *entry;
   gpointer orig_key, value;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
 
-  const gboolean res = g_hash_table_lookup_extended(cache->hashtable,
+  const gboolean res = g_hash_table_lookup_extended(shard->hashtable,
                                                     GINT_TO_POINTER(key),
                                                     &orig_key,
                                                     &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     return TRUE;
   }
   // need write lock to be able to delete:
   if(dt_pthread_rwlock_trywrlock(&entry->lock))
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
@@ -272,81 +494,38 @@ restart:
     // oops, we are currently demoting (rw -> r) lock to this entry in
     // some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
 
-  const gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
+  const gboolean removed = g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(key));
   (void)removed; // make non-assert compile happy
   assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
+  _lru_unlink(shard, entry);
 
-  if(cache->cleanup)
-  {
-    assert(entry->data_size);
-    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-    cache->cleanup(cache->cleanup_data, entry);
-  }
-  else
-    dt_free_align(entry->data);
+  _cache_free_entry(cache, entry);
 
   dt_pthread_rwlock_unlock(&entry->lock);
   dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
+  _cache_add_cost(cache, shard, -(gssize)entry->cost);
   g_slice_free1(sizeof(*entry), entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   return FALSE;
 }
 
-// best-effort garbage collection. never blocks, never fails. well,
-// sometimes it just doesn't free anything.
+// best-effort garbage collection. never blocks on entries, never fails.
+// well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache,
                  const float fill_ratio)
 {
-  GList *l = cache->lru;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to
-                        // the next one while we still have the
-                        // pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio)
-      break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock))
-      continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry
-      // in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    _cache_gc_shard(cache, shard, fill_ratio);
+    dt_pthread_mutex_unlock(&shard->lock);
   }
 }
 
@@ -23,30 +23,84 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+typedef enum dt_cache_policy_t
+{
+  DT_CACHE_POLICY_LRU = 0,  // plain least recently used
+  DT_CACHE_POLICY_SLRU = 1, // segmented lru, entries hit twice after insertion are protected from a single scan
+} dt_cache_policy_t;
+
+typedef enum dt_cache_segment_t
+{
+  DT_CACHE_SEGMENT_PROBATION = 0, // new entries, evicted first
+  DT_CACHE_SEGMENT_PROTECTED = 1, // entries hit again after their first hit in probation (slru only)
+  DT_CACHE_SEGMENT_LAST
+} dt_cache_segment_t;
+
 typedef struct dt_cache_entry_t
 {
   void *data;
   size_t data_size;
   size_t cost;
-  GList *link;
+  // intrusive lru list links, owned by the shard lock
+  struct dt_cache_entry_t *lru_prev;
+  struct dt_cache_entry_t *lru_next;
+  dt_cache_segment_t segment;
+  gboolean referenced; // hit since it was inserted, the next hit in probation promotes it (slru only)
   dt_pthread_rwlock_t lock;
   gboolean _lock_demoting;
   uint32_t key;
 } dt_cache_entry_t;
 
+// doubly linked list of entries, head is about to be kicked from cache, tail is most recently used.
+typedef struct dt_cache_lru_t
+{
+  dt_cache_entry_t *head;
+  dt_cache_entry_t *tail;
+  size_t cost;
+} dt_cache_lru_t;
+
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
-typedef struct dt_cache_t
+// the maximum number of shards a cache can be split into
+#define DT_CACHE_MAX_SHARDS 64
+
+// passed as num_shards to dt_cache_init() to derive the number of shards from the cpu count
+#define DT_CACHE_SHARDS_AUTO 0
+
+// the share of the quota of every shard holds at least this many of the largest entries
+#define DT_CACHE_MIN_ENTRIES_PER_SHARD 4
+
+// one independently locked part of the cache. keys are distributed over
+// the shards by hash, so threads working on different keys rarely meet
+// on the same lock.
+typedef struct dt_cache_shard_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_pthread_mutex_t lock; // protects hashtable, lru and cost of this shard
+
+  GHashTable *hashtable;                    // stores (key, entry) pairs
+  dt_cache_lru_t lru[DT_CACHE_SEGMENT_LAST]; // recency lists, probation is always evicted first
+  size_t cost;                              // sum of the entry costs in this shard
+} dt_cache_shard_t;
 
+typedef struct dt_cache_t
+{
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
+  gsize cost;        // user supplied cost per cache line (bytes?), approximate sum over all shards
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
+  // 1 shard is the classic big fat lock, more shards are used for caches
+  // hammered by many cpu threads concurrently. always a power of two.
+  uint32_t num_shards;
+  uint32_t shard_mask;
+  dt_cache_shard_t *shards;
+
+  dt_cache_policy_t policy;
+
+  // lookup statistics, updated without locking
+  uint64_t stats_hits;
+  uint64_t stats_misses;
+  uint64_t stats_promotions; // probation -> protected (slru only)
 
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
@@ -55,12 +109,36 @@ typedef struct dt_cache_t
   void *cleanup_data;
 } dt_cache_t;
 
-// entry size is only used if alloc callback is 0
+// entry size is only used if alloc callback is 0.
+// num_shards is rounded up to a power of two, 1 gives a single global lock,
+// DT_CACHE_SHARDS_AUTO picks a shard count matching the number of cpus,
+// capped by dt_cache_auto_shards() for entries costing entry_size.
 void dt_cache_init(dt_cache_t *cache,
                    const size_t entry_size,
-                   const size_t cost_quota);
+                   const size_t cost_quota,
+                   const uint32_t num_shards);
 void dt_cache_cleanup(dt_cache_t *cache);
 
+// the shard count matching the number of cpus, reduced until each shard's
+// share of cost_quota holds DT_CACHE_MIN_ENTRIES_PER_SHARD entries of max_cost.
+// for caches whose entries have very different costs.
+uint32_t dt_cache_auto_shards(const size_t cost_quota,
+                              const size_t max_cost);
+
+// current fill of the cache. with more than one shard this is only a
+// snapshot as other threads may be adding or removing entries.
+static inline size_t dt_cache_get_cost(dt_cache_t *cache)
+{
+  return (size_t)g_atomic_pointer_get(&cache->cost);
+}
+
+// choose the replacement policy, must be called before the cache is used.
+static inline void dt_cache_set_policy(dt_cache_t *cache,
+                                       const dt_cache_policy_t policy)
+{
+  cache->policy = policy;
+}
+
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache,
                                                   dt_cache_allocate_t allocate_cb,
                                                   void *allocate_data)
@@ -97,10 +175,10 @@ void dt_cache_release_with_caller(dt_cache_t *cache,
 gboolean dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns FALSE on success, TRUE if the key was not found.
 gboolean dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
+// removes from the tip of the lru lists, until the fill ratio of the hashtable
 // goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
-// is locked)
+// will never block on entry locks and never fail, but sometimes not free
+// memory (in case all is locked)
 void dt_cache_gc(dt_cache_t *cache,
                  const float fill_ratio);
 
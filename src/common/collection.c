@@ -77,6 +77,8 @@ static int dt_collection_image_offset_with_collection(const dt_collection_t *col
                                                       const dt_imgid_t imgid);
 /* update aspect ratio for the selected images */
 static void _collection_update_aspect_ratio(const dt_collection_t *collection);
+/* drop the in-memory copy of memory.collected_images */
+static void _collected_invalidate(void);
 
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
@@ -114,6 +116,8 @@ void dt_collection_free(const dt_collection_t *collection)
 {
   DT_CONTROL_SIGNAL_DISCONNECT_ALL(collection, "collection");
 
+  if(!collection->clone) _collected_invalidate();
+
   g_free(collection->query);
   g_free(collection->query_no_group);
   g_strfreev(collection->where_ext);
@@ -147,6 +151,32 @@ static char * and_operator(int *term)
   assert(0); // Not reached.
 }
 
+/* in-memory copy of memory.collected_images, so that the thumbtable
+   can go from rowid to imgid and back without sql while scrolling.
+   it's rebuilt on the first lookup after the table changed. */
+static struct
+{
+  gboolean valid;
+  dt_imgid_t *imgids;   // indexed by rowid
+  int max_rowid;
+  uint32_t count;
+  GHashTable *rowids;   // imgid -> rowid
+} _collected = { 0 };
+static GMutex _collected_lock;
+
+static void _collected_invalidate(void)
+{
+  g_mutex_lock(&_collected_lock);
+  g_free(_collected.imgids);
+  if(_collected.rowids) g_hash_table_destroy(_collected.rowids);
+  _collected.imgids = NULL;
+  _collected.rowids = NULL;
+  _collected.max_rowid = 0;
+  _collected.count = 0;
+  _collected.valid = FALSE;
+  g_mutex_unlock(&_collected_lock);
+}
+
 void dt_collection_memory_update()
 {
   if(!darktable.collection || !darktable.db) return;
@@ -184,6 +214,67 @@ void dt_collection_memory_update()
 
   g_free(query);
   g_free(ins_query);
+
+  _collected_invalidate();
+}
+
+static void _collected_build(void)
+{
+  sqlite3_stmt *stmt;
+  GArray *rows = g_array_new(FALSE, FALSE, sizeof(int32_t) * 2);
+  int max_rowid = 0;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT rowid, imgid FROM memory.collected_images ORDER BY rowid",
+                              -1, &stmt, NULL);
+  // clang-format on
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t row[2] = { sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1) };
+    g_array_append_val(rows, row);
+    max_rowid = MAX(max_rowid, row[0]);
+  }
+  sqlite3_finalize(stmt);
+
+  // rowids are 1..count right after dt_collection_memory_update(),
+  // holes are kept as NO_IMGID should that ever change
+  _collected.imgids = g_malloc_n(max_rowid + 1, sizeof(dt_imgid_t));
+  for(int k = 0; k <= max_rowid; k++) _collected.imgids[k] = NO_IMGID;
+  _collected.rowids = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for(guint k = 0; k < rows->len; k++)
+  {
+    const int32_t *row = &g_array_index(rows, int32_t, 2 * k);
+    _collected.imgids[row[0]] = row[1];
+    // the first occurrence wins, as with "WHERE imgid=" in sql
+    if(!g_hash_table_contains(_collected.rowids, GINT_TO_POINTER(row[1])))
+      g_hash_table_insert(_collected.rowids, GINT_TO_POINTER(row[1]), GINT_TO_POINTER(row[0]));
+  }
+  _collected.max_rowid = max_rowid;
+  _collected.count = rows->len;
+  _collected.valid = TRUE;
+  g_array_free(rows, TRUE);
+}
+
+dt_imgid_t dt_collection_get_imgid_at_rowid(const int rowid)
+{
+  g_mutex_lock(&_collected_lock);
+  if(!_collected.valid) _collected_build();
+  const dt_imgid_t imgid = rowid > 0 && rowid <= _collected.max_rowid
+    ? _collected.imgids[rowid]
+    : NO_IMGID;
+  g_mutex_unlock(&_collected_lock);
+  return imgid;
+}
+
+int dt_collection_get_rowid(const dt_imgid_t imgid)
+{
+  g_mutex_lock(&_collected_lock);
+  if(!_collected.valid) _collected_build();
+  gpointer rowid = NULL;
+  const gboolean found = g_hash_table_lookup_extended(_collected.rowids, GINT_TO_POINTER(imgid),
+                                                      NULL, &rowid);
+  g_mutex_unlock(&_collected_lock);
+  return found ? GPOINTER_TO_INT(rowid) : -1;
 }
 
 static void _dt_collection_set_selq_pre_sort(const dt_collection_t *collection,
@@ -921,14 +1012,10 @@ uint32_t dt_collection_get_selected_count(void)
 
 uint32_t dt_collection_get_collected_count(void)
 {
-  sqlite3_stmt *stmt = NULL;
-  uint32_t count = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(*) FROM memory.collected_images",
-                              -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-    count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  g_mutex_lock(&_collected_lock);
+  if(!_collected.valid) _collected_build();
+  const uint32_t count = _collected.count;
+  g_mutex_unlock(&_collected_lock);
   return count;
 }
 
@@ -238,6 +238,10 @@ GList *dt_collection_get_selected(const dt_collection_t *collection, const int l
 uint32_t dt_collection_get_selected_count(void);
 /** get the count of collected images */
 uint32_t dt_collection_get_collected_count(void);
+/** get the image at rowid of memory.collected_images, NO_IMGID if there is none */
+dt_imgid_t dt_collection_get_imgid_at_rowid(const int rowid);
+/** get the rowid of an image in memory.collected_images, -1 if it isn't collected */
+int dt_collection_get_rowid(const dt_imgid_t imgid);
 
 /** update query by conf vars */
 void dt_collection_update_query(const dt_collection_t *collection,
@@ -38,6 +38,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/action.h"
+#include "common/bufferpool.h"
 #include "common/file_location.h"
 #include "common/film.h"
 #include "common/grealpath.h"
@@ -53,6 +54,7 @@
 #include "common/undo.h"
 #include "common/gimp.h"
 #include "common/pfm.h"
+#include "common/trace.h"
 #ifdef HAVE_AI
 #include "common/ai_models.h"
 #endif
@@ -268,6 +270,11 @@ static int usage(const char *argv0)
          "\n"
          "--dumpdir DIR\n"
          "\n"
+         "--trace FILE\n"
+         "    Record the processing of the pixelpipes and the background jobs\n"
+         "    in FILE, to be viewed as a timeline in chrome://tracing or\n"
+         "    https://ui.perfetto.dev\n"
+         "\n"
          "-d CHANNEL\n"
          "    Enable debug output to the terminal (or to the log file if on Windows).\n"
          "    Valid channels are:\n\n"
@@ -969,6 +976,9 @@ char *version = g_strdup_printf(
   return version;
 }
 
+static void *_alloc_aligned(const size_t size, const size_t alignment);
+static void _free_aligned(void *mem);
+
 int dt_init(int argc,
             char *argv[],
             const gboolean init_gui,
@@ -1092,6 +1102,12 @@ int dt_init(int argc,
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k + 1)
+      {
+        dt_trace_init(argv[++k]);
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--dump-pipe") && argc > k + 1)
       {
         darktable.dump_pfm_pipe = argv[++k];
@@ -1895,6 +1911,7 @@ int dt_init(int argc,
   }
 
   dt_get_sysresource_level();
+  dt_bufferpool_init(_alloc_aligned, _free_aligned);
   res->mipmap_memory = _get_mipmap_size();
   dt_print(DT_DEBUG_MEMORY | DT_DEBUG_DEV,
     "  mipmap cache:    %luMB", res->mipmap_memory / DT_MEGA);
@@ -2291,6 +2308,8 @@ void dt_cleanup()
   else
     dt_control_cleanup(FALSE);
 
+  // all jobs are done
+  dt_trace_cleanup();
 
   dt_image_cache_cleanup();
   dt_mipmap_cache_cleanup();
@@ -2391,6 +2410,7 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.metadata_threadsafe));
 
   dt_exif_cleanup();
+  dt_bufferpool_cleanup();
 }
 
 /* The dt_print variations can be used with a combination of DT_DEBUG_ flags.
@@ -2420,9 +2440,11 @@ void dt_print_nts_ext(const char *msg, ...)
   fflush(stdout);
 }
 
-void *dt_alloc_aligned(const size_t size)
+// the raw allocator behind dt_alloc_aligned(), also used by the buffer
+// pool to allocate its blocks with a larger alignment
+static void *_alloc_aligned(const size_t size,
+                            const size_t alignment)
 {
-  const size_t alignment = DT_CACHELINE_BYTES;
   const size_t aligned_size = dt_round_size(size, alignment);
 #if defined(__FreeBSD_version) && __FreeBSD_version < 700013
   return malloc(aligned_size);
@@ -2444,20 +2466,11 @@ void *dt_alloc_aligned(const size_t size)
 #endif
 }
 
-size_t dt_round_size(const size_t size, const size_t alignment)
+static void _free_aligned(void *mem)
 {
-  // Round the size of a buffer to the closest higher multiple
-  return ((size % alignment) == 0) ? size : ((size - 1) / alignment + 1) * alignment;
-}
-
 #ifdef _WIN32
-void dt_free_align(void *mem)
-{
   _aligned_free(mem);
-}
 #elif defined(_DEBUG)
-void dt_free_align(void *mem)
-{
   // on a debug build, we deliberately offset the returned pointer
   // from dt_alloc_align, so eliminate the offset
   if(mem)
@@ -2465,8 +2478,28 @@ void dt_free_align(void *mem)
     short offset = ((short*)mem)[-1];
     free(((char*)mem)-offset);
   }
-}
+#else
+  free(mem);
 #endif
+}
+
+void *dt_alloc_aligned(const size_t size)
+{
+  void *ptr = dt_bufferpool_alloc(size);
+  return ptr ? ptr : _alloc_aligned(size, DT_CACHELINE_BYTES);
+}
+
+void dt_free_align(void *mem)
+{
+  if(mem && !dt_bufferpool_release(mem))
+    _free_aligned(mem);
+}
+
+size_t dt_round_size(const size_t size, const size_t alignment)
+{
+  // Round the size of a buffer to the closest higher multiple
+  return ((size % alignment) == 0) ? size : ((size - 1) / alignment + 1) * alignment;
+}
 
 void dt_show_times(const dt_times_t *start, const char *prefix)
 {
@@ -2523,11 +2556,18 @@ size_t dt_get_available_mem()
 {
   dt_sys_resources_t *res = &darktable.dtresources;
   const int level = res->level;
+  const size_t share = MAX(1, res->pipe_share);
+  // the blocks kept by the buffer pool are memory darktable holds already
+  const size_t pooled = dt_bufferpool_cached();
   if(level < 0)
-    return res->refresource[4*(-level-1)] * DT_MEGA;
+  {
+    const size_t budget = res->refresource[4*(-level-1)] * DT_MEGA;
+    return (budget - MIN(budget, pooled)) / share;
+  }
 
   const int fraction = res->fractions[4*level];
-  return MAX(512lu * DT_MEGA, (res->total_memory - res->cl_uni_memory) / 1024lu * fraction);
+  const size_t budget = (res->total_memory - res->cl_uni_memory) / 1024lu * fraction;
+  return MAX(512lu * DT_MEGA, (budget - MIN(budget, pooled)) / share);
 }
 
 size_t dt_get_singlebuffer_mem()
@@ -2825,6 +2865,8 @@ void dt_print_mem_usage(char *info)
 #else
   dt_print(DT_DEBUG_ALWAYS, "dt_print_mem_usage() currently unsupported on this platform");
 #endif
+
+  dt_bufferpool_print();
 }
 
 // clang-format off
@@ -409,6 +409,7 @@ typedef struct dt_sys_resources_t
   int *fractions;   // fractions are calculated as res=input / 1024  * fraction
   int *refresource; // for the debug resource modes we use fixed settings
   int level;
+  int pipe_share;   // number of pipes processing concurrently and sharing the available memory
 } dt_sys_resources_t;
 
 typedef struct dt_backthumb_t
@@ -470,6 +471,7 @@ typedef struct darktable_t
   struct dt_undo_t *undo;
   struct dt_colorspaces_t *color_profiles;
   struct dt_l10n_t *l10n;
+  struct dt_trace_t *trace;
   dt_pthread_mutex_t db_image[DT_IMAGE_DBLOCKS];
   dt_pthread_mutex_t dev_threadsafe;
   dt_pthread_mutex_t plugin_threadsafe;
@@ -645,17 +647,10 @@ static inline gboolean dt_check_aligned(void *addr)
 
 size_t dt_round_size(const size_t size, const size_t alignment);
 
-#ifdef _WIN32
-void dt_free_align(void *mem);
-#define dt_free_align_ptr dt_free_align
-#elif _DEBUG // debug build makes sure that we get a crash on using
-             // plain free() on an aligned allocation
+// large blocks may be kept for reuse by the buffer pool, so anything from
+// dt_alloc_aligned() has to be released here and never with plain free()
 void dt_free_align(void *mem);
 #define dt_free_align_ptr dt_free_align
-#else
-#define dt_free_align(A) free(A)
-#define dt_free_align_ptr free
-#endif
 
 static inline void dt_lock_image(const dt_imgid_t imgid)
   ACQUIRE(darktable.db_image[imgid & (DT_IMAGE_DBLOCKS-1)])
@@ -2634,8 +2634,10 @@ gboolean dt_exif_get_thumbnail(const char *path,
 /* Read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data.
  */
-gboolean dt_exif_read(dt_image_t *img,
-                      const char *path)
+// image is the file already read by dt_exif_prefetch(), NULL to read it here
+static gboolean _exif_read(dt_image_t *img,
+                           const char *path,
+                           Exiv2::Image *prefetched)
 {
   if(!img)
   {
@@ -2653,9 +2655,15 @@ gboolean dt_exif_read(dt_image_t *img,
 
   try
   {
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> own;
+    Exiv2::Image *image = prefetched;
+    if(!image)
+    {
+      own = std::unique_ptr<Exiv2::Image>(Exiv2::ImageFactory::open(WIDEN(path)));
+      assert(own.get() != 0);
+      read_metadata_threadsafe(own);
+      image = own.get();
+    }
     bool res = true;
 
     // EXIF metadata
@@ -2714,6 +2722,12 @@ gboolean dt_exif_read(dt_image_t *img,
   }
 }
 
+gboolean dt_exif_read(dt_image_t *img,
+                      const char *path)
+{
+  return _exif_read(img, path, NULL);
+}
+
 int dt_exif_write_blob(uint8_t *blob,
                        uint32_t size,
                        const char *path,
@@ -4167,9 +4181,11 @@ static gboolean _image_altered_deprecated(const dt_imgid_t imgid)
 }
 
 // Need a write lock on *img (non-const) to write stars (and soon color labels).
-gboolean dt_exif_xmp_read(dt_image_t *img,
-                          const char *filename,
-                          const gboolean history_only)
+// prefetched is the sidecar already read by dt_exif_prefetch(), NULL to read it here
+static gboolean _exif_xmp_read(dt_image_t *img,
+                               const char *filename,
+                               const gboolean history_only,
+                               Exiv2::Image *prefetched)
 {
   if(!img)
   {
@@ -4182,9 +4198,15 @@ gboolean dt_exif_xmp_read(dt_image_t *img,
   try
   {
     // Read XMP sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
+    std::unique_ptr<Exiv2::Image> own;
+    Exiv2::Image *image = prefetched;
+    if(!image)
+    {
+      own = std::unique_ptr<Exiv2::Image>(Exiv2::ImageFactory::open(WIDEN(filename)));
+      assert(own.get() != 0);
+      read_metadata_threadsafe(own);
+      image = own.get();
+    }
     Exiv2::XmpData &xmpData = image->xmpData();
 
     sqlite3_stmt *stmt;
@@ -4799,6 +4821,73 @@ gboolean dt_exif_xmp_read(dt_image_t *img,
   return FALSE;
 }
 
+gboolean dt_exif_xmp_read(dt_image_t *img,
+                          const char *filename,
+                          const gboolean history_only)
+{
+  return _exif_xmp_read(img, filename, history_only, NULL);
+}
+
+struct dt_exif_prefetch_t
+{
+  std::string path;                      // the image file
+  std::unique_ptr<Exiv2::Image> image;   // its metadata, empty if it couldn't be read
+  std::string sidecar_path;              // path + ".xmp"
+  std::unique_ptr<Exiv2::Image> sidecar; // the sidecar, empty if there is none
+};
+
+static std::unique_ptr<Exiv2::Image> _exif_prefetch_file(const char *path)
+{
+  try
+  {
+    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
+    // each image is read by one thread only and the XMP toolkit has its own
+    // lock since dt_exif_init(), so the prefetch threads parse in parallel
+    // instead of queuing on the global lock
+    image->readMetadata();
+    return image;
+  }
+  catch(const Exiv2::AnyError &e)
+  {
+    return std::unique_ptr<Exiv2::Image>();
+  }
+}
+
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path)
+{
+  dt_exif_prefetch_t *pf = new dt_exif_prefetch_t;
+  pf->path = path;
+  pf->image = _exif_prefetch_file(path);
+  pf->sidecar_path = pf->path + ".xmp";
+  if(g_file_test(pf->sidecar_path.c_str(), G_FILE_TEST_IS_REGULAR))
+    pf->sidecar = _exif_prefetch_file(pf->sidecar_path.c_str());
+  return pf;
+}
+
+void dt_exif_prefetch_free(dt_exif_prefetch_t *pf)
+{
+  delete pf;
+}
+
+gboolean dt_exif_read_prefetched(dt_image_t *img,
+                                 const char *path,
+                                 const dt_exif_prefetch_t *pf)
+{
+  const gboolean valid = pf && pf->image && pf->path == path;
+  return _exif_read(img, path, valid ? pf->image.get() : NULL);
+}
+
+gboolean dt_exif_xmp_read_prefetched(dt_image_t *img,
+                                     const char *filename,
+                                     const gboolean history_only,
+                                     const dt_exif_prefetch_t *pf)
+{
+  const gboolean valid = pf && pf->sidecar_path == filename;
+  // no sidecar found when prefetching, same as failing to open it
+  if(valid && !pf->sidecar) return TRUE;
+  return _exif_xmp_read(img, filename, history_only, valid ? pf->sidecar.get() : NULL);
+}
+
 // append a brand-new (never-before-present) key/value pair straight onto
 // xmpData, without Exiv2::XmpData::operator[]'s implicit findKey() lookup.
 // operator[] always linear-scans the whole (vector-backed) xmpData first to
@@ -6175,52 +6264,40 @@ gboolean dt_exif_xmp_attach_export(const dt_imgid_t imgid,
   }
 }
 
-// Write XMP sidecar file: returns TRUE in case of errors.
-gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
-                           const char *filename,
-                           const gboolean force_write)
+static const char *_xmp_xml_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+
+void dt_exif_xmp_sidecar_load(dt_exif_xmp_sidecar_t *sidecar)
 {
-  // Refuse to write sidecar for non-existent image:
-  char imgfname[PATH_MAX] = { 0 };
-  gboolean from_cache = TRUE;
+  if(!g_file_test(sidecar->filename, G_FILE_TEST_EXISTS)) return;
 
-  dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
-  if(!g_file_test(imgfname, G_FILE_TEST_IS_REGULAR)) return TRUE;
+  // we want to avoid writing the sidecar file if it didn't change
+  // to avoid issues when using the same images from different
+  // computers. Sample use case: images on NAS, several computers
+  // using them NOT AT THE SAME TIME and the XMP crawler is used
+  // to find changed sidecars.
+  errno = 0;
+  sidecar->old = (uint8_t *)dt_read_file(sidecar->filename, &sidecar->old_len);
+  if(!sidecar->old)
+  {
+    dt_print(DT_DEBUG_ALWAYS,
+             "cannot read XMP file '%s': '%s'", sidecar->filename, strerror(errno));
+    dt_control_log(_("cannot read XMP file '%s': '%s'"), sidecar->filename, strerror(errno));
+    sidecar->error = TRUE;
+  }
+}
+
+gboolean dt_exif_xmp_sidecar_encode(dt_exif_xmp_sidecar_t *sidecar)
+{
+  if(sidecar->error) return TRUE;
 
   try
   {
     Lock lock;
     Exiv2::XmpData xmpData;
     std::string xmpPacket;
-    char *checksum_old = NULL;
-    if(!force_write && g_file_test(filename, G_FILE_TEST_EXISTS))
-    {
-      // we want to avoid writing the sidecar file if it didn't change
-      // to avoid issues when using the same images from different
-      // computers. Sample use case: images on NAS, several computers
-      // using them NOT AT THE SAME TIME and the XMP crawler is used
-      // to find changed sidecars.
-      errno = 0;
-      size_t end;
-      unsigned char *content = (unsigned char*)dt_read_file(filename, &end);
-      if(content)
-      {
-        checksum_old = g_compute_checksum_for_data(G_CHECKSUM_MD5, content, end);
-        free(content);
-      }
-      else
-      {
-        dt_print(DT_DEBUG_ALWAYS,
-                 "cannot read XMP file '%s': '%s'", filename, strerror(errno));
-        dt_control_log(_("cannot read XMP file '%s': '%s'"), filename, strerror(errno));
-      }
-
-      Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(filename));
-#if EXIV2_TEST_VERSION(0,28,0)
-      xmpPacket.assign(buf.c_str(), buf.size());
-#else
-      xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
-#endif
+    if(sidecar->old)
+    {
+      xmpPacket.assign((const char *)sidecar->old, sidecar->old_len);
       Exiv2::XmpParser::decode(xmpData, xmpPacket);
 
       // Because XmpSeq or XmpBag are added to the list, we first have to
@@ -6229,7 +6306,7 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
     }
 
     // Initialize xmp data:
-    _exif_xmp_read_data(xmpData, imgid, "dt_exif_xmp_write");
+    _exif_xmp_read_data(xmpData, sidecar->imgid, "dt_exif_xmp_write");
 
     // Serialize the xmp data and output the xmp packet.
     if(Exiv2::XmpParser::encode(xmpPacket, xmpData,
@@ -6238,57 +6315,93 @@ gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
       throw Exiv2::Error(Exiv2::ErrorCode::kerErrorMessage, "[xmp_write] failed to serialize xmp data");
     }
 
-    // Hash the new data and compare it to the old hash (if applicable).
-    const char *xml_header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-    gboolean write_sidecar = TRUE;
-    if(checksum_old)
-    {
-      GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
-      if(checksum)
-      {
-        g_checksum_update(checksum, (unsigned char*)xml_header, -1);
-        g_checksum_update(checksum, (unsigned char*)xmpPacket.c_str(), -1);
-        const char *checksum_new = g_checksum_get_string(checksum);
-        write_sidecar = g_strcmp0(checksum_old, checksum_new) != 0;
-        g_checksum_free(checksum);
-      }
-      g_free(checksum_old);
-    }
+    gchar *packet = g_strconcat(_xmp_xml_header, xmpPacket.c_str(), NULL);
 
-    if(write_sidecar)
+    // Hash the new data and compare it to the old hash (if applicable).
+    if(sidecar->old)
     {
-      // Using std::ofstream isn't possible here -- on Windows it
-      // doesn't support Unicode filenames with mingw.
-      errno = 0;
-      FILE *fout = g_fopen(filename, "wb");
-      if(fout)
+      gchar *checksum_old =
+        g_compute_checksum_for_data(G_CHECKSUM_MD5, sidecar->old, sidecar->old_len);
+      gchar *checksum_new =
+        g_compute_checksum_for_string(G_CHECKSUM_MD5, packet, -1);
+      if(!g_strcmp0(checksum_old, checksum_new))
       {
-        fprintf(fout, "%s", xml_header);
-        fprintf(fout, "%s", xmpPacket.c_str());
-        fclose(fout);
-      }
-      else
-      {
-        dt_print(DT_DEBUG_ALWAYS,
-                 "cannot write XMP file '%s': '%s'", filename, strerror(errno));
-        dt_control_log(_("cannot write XMP file '%s': '%s'"), filename, strerror(errno));
-        return TRUE;
+        g_free(packet);
+        packet = NULL;
       }
+      g_free(checksum_old);
+      g_free(checksum_new);
     }
 
+    sidecar->packet = packet;
     return FALSE;
   }
   catch(const Exiv2::AnyError &e)
   {
     dt_print(DT_DEBUG_ALWAYS,
              "[dt_exif_xmp_write] %s: caught exiv2 exception '%s'",
-             filename,
+             sidecar->filename,
              e.what());
-    dt_control_log(_("cannot write XMP file '%s': '%s'"), filename, e.what());
+    dt_control_log(_("cannot write XMP file '%s': '%s'"), sidecar->filename, e.what());
+    sidecar->error = TRUE;
     return TRUE;
   }
 }
 
+gboolean dt_exif_xmp_sidecar_save(dt_exif_xmp_sidecar_t *sidecar)
+{
+  if(sidecar->error) return TRUE;
+  if(!sidecar->packet) return FALSE; // unchanged
+
+  // Using std::ofstream isn't possible here -- on Windows it
+  // doesn't support Unicode filenames with mingw.
+  errno = 0;
+  FILE *fout = g_fopen(sidecar->filename, "wb");
+  if(fout)
+  {
+    fprintf(fout, "%s", sidecar->packet);
+    fclose(fout);
+    return FALSE;
+  }
+
+  dt_print(DT_DEBUG_ALWAYS,
+           "cannot write XMP file '%s': '%s'", sidecar->filename, strerror(errno));
+  dt_control_log(_("cannot write XMP file '%s': '%s'"), sidecar->filename, strerror(errno));
+  sidecar->error = TRUE;
+  return TRUE;
+}
+
+void dt_exif_xmp_sidecar_cleanup(dt_exif_xmp_sidecar_t *sidecar)
+{
+  free(sidecar->old);
+  g_free(sidecar->packet);
+  sidecar->old = NULL;
+  sidecar->packet = NULL;
+}
+
+// Write XMP sidecar file: returns TRUE in case of errors.
+gboolean dt_exif_xmp_write(const dt_imgid_t imgid,
+                           const char *filename,
+                           const gboolean force_write)
+{
+  // Refuse to write sidecar for non-existent image:
+  char imgfname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+
+  dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
+  if(!g_file_test(imgfname, G_FILE_TEST_IS_REGULAR)) return TRUE;
+
+  dt_exif_xmp_sidecar_t sidecar = { 0 };
+  sidecar.imgid = imgid;
+  g_strlcpy(sidecar.filename, filename, sizeof(sidecar.filename));
+
+  if(!force_write) dt_exif_xmp_sidecar_load(&sidecar);
+  const gboolean error = dt_exif_xmp_sidecar_encode(&sidecar)
+                         || dt_exif_xmp_sidecar_save(&sidecar);
+  dt_exif_xmp_sidecar_cleanup(&sidecar);
+  return error;
+}
+
 dt_colorspaces_color_profile_type_t dt_exif_get_color_space(const uint8_t *data,
                                                             const size_t size)
 {
@@ -6371,6 +6484,19 @@ static void _exif_log_handler(const int log_level,
   }
 }
 
+// the XMP toolkit isn't thread safe, Exiv2 serializes the calls into it
+// through this lock
+static dt_pthread_mutex_t _exif_xmp_lock;
+
+static void _exif_xmp_lock_fct(void *data, bool lock)
+{
+  dt_pthread_mutex_t *mutex = (dt_pthread_mutex_t *)data;
+  if(lock)
+    dt_pthread_mutex_lock(mutex);
+  else
+    dt_pthread_mutex_unlock(mutex);
+}
+
 void dt_exif_init()
 {
   // Preface the Exiv2 messages with "[exiv2] "
@@ -6380,7 +6506,8 @@ void dt_exif_init()
   Exiv2::enableBMFF();
   #endif
 
-  Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&_exif_xmp_lock, NULL);
+  Exiv2::XmpParser::initialize(_exif_xmp_lock_fct, &_exif_xmp_lock);
 
   // This has to stay with the old url (namespace already propagated outside dt).
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
@@ -6409,6 +6536,7 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+  dt_pthread_mutex_destroy(&_exif_xmp_lock);
 }
 
 // clang-format off
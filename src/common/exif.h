@@ -102,6 +102,24 @@ int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path, const int
     find new edits. */
 gboolean dt_exif_xmp_write(const dt_imgid_t imgid, const char *filename, const gboolean force_write);
 
+/** dt_exif_xmp_write() in steps, to write many sidecars at once: the file access of _load() and
+    _save() may run on any thread, _encode() reads the database. _load() is skipped to force the
+    write. all steps return TRUE in case of errors. */
+typedef struct dt_exif_xmp_sidecar_t
+{
+  dt_imgid_t imgid;
+  char filename[PATH_MAX];
+  uint8_t *old;      // the current sidecar, NULL if there is none
+  size_t old_len;
+  char *packet;      // the new sidecar, NULL if it is unchanged
+  gboolean error;
+} dt_exif_xmp_sidecar_t;
+
+void dt_exif_xmp_sidecar_load(dt_exif_xmp_sidecar_t *sidecar);
+gboolean dt_exif_xmp_sidecar_encode(dt_exif_xmp_sidecar_t *sidecar);
+gboolean dt_exif_xmp_sidecar_save(dt_exif_xmp_sidecar_t *sidecar);
+void dt_exif_xmp_sidecar_cleanup(dt_exif_xmp_sidecar_t *sidecar);
+
 /** write xmp packet inside an image. */
 gboolean dt_exif_xmp_attach_export(const dt_imgid_t imgid, const char *filename, void *metadata,
     dt_develop_t *dev, dt_dev_pixelpipe_t *pipe);
@@ -112,6 +130,20 @@ char *dt_exif_xmp_read_string(const dt_imgid_t imgid);
 /** read xmp sidecar file. Returns TRUE in case of any error*/
 gboolean dt_exif_xmp_read(dt_image_t *img, const char *filename, const gboolean history_only);
 
+/** metadata of an image file and its sidecar read ahead of decoding it into an image, so that
+    the file access and parsing can be done by several threads while importing. */
+typedef struct dt_exif_prefetch_t dt_exif_prefetch_t;
+
+/** read the metadata of path and of path.xmp, safe to call from any thread. */
+dt_exif_prefetch_t *dt_exif_prefetch(const char *path);
+void dt_exif_prefetch_free(dt_exif_prefetch_t *pf);
+
+/** same as dt_exif_read() and dt_exif_xmp_read(), but using the metadata of pf if it was
+    prefetched for the same file. pf may be NULL. */
+gboolean dt_exif_read_prefetched(dt_image_t *img, const char *path, const dt_exif_prefetch_t *pf);
+gboolean dt_exif_xmp_read_prefetched(dt_image_t *img, const char *filename, const gboolean history_only,
+                                     const dt_exif_prefetch_t *pf);
+
 /** apply default import metadata */
 void dt_exif_apply_default_metadata(dt_image_t *img);
 
@@ -0,0 +1,238 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_timing.h"
+
+#include <locale.h>
+
+// exports run in worker threads, each of them records its own export
+static __thread dt_export_timing_t *_current = NULL;
+
+static size_t _peak_memory(void)
+{
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru)) return 0;
+#ifdef __APPLE__
+  return (size_t)ru.ru_maxrss;        // bytes
+#else
+  return (size_t)ru.ru_maxrss * 1024; // kB on linux, bsd and our windows wrapper
+#endif
+}
+
+dt_export_timing_t *dt_export_timing_begin(const dt_imgid_t imgid)
+{
+  dt_export_timing_free(_current);
+  _current = calloc(1, sizeof(dt_export_timing_t));
+  if(_current) _current->imgid = imgid;
+  return _current;
+}
+
+dt_export_timing_t *dt_export_timing_end(const gboolean success)
+{
+  dt_export_timing_t *timing = _current;
+  _current = NULL;
+  if(timing)
+  {
+    timing->success = success;
+    timing->peak_memory = _peak_memory();
+    timing->modules = g_list_reverse(timing->modules);
+  }
+  return timing;
+}
+
+dt_export_timing_t *dt_export_timing_current(void)
+{
+  return _current;
+}
+
+void dt_export_timing_add_module(const char *op,
+                                 const char *name,
+                                 const double process,
+                                 const double blend,
+                                 const gboolean tiling,
+                                 const gboolean gpu)
+{
+  if(!_current) return;
+
+  dt_export_timing_module_t *m = calloc(1, sizeof(dt_export_timing_module_t));
+  if(!m) return;
+  g_strlcpy(m->op, op, sizeof(m->op));
+  g_strlcpy(m->name, name, sizeof(m->name));
+  m->process = process;
+  m->blend = blend;
+  m->tiling = tiling;
+  m->gpu = gpu;
+  // prepended for speed, dt_export_timing_end() restores the order
+  _current->modules = g_list_prepend(_current->modules, m);
+}
+
+void dt_export_timing_free(dt_export_timing_t *timing)
+{
+  if(!timing) return;
+  g_list_free_full(timing->modules, free);
+  free(timing);
+}
+
+dt_export_timing_format_t dt_export_timing_format_from_filename(const char *filename)
+{
+  const char *ext = filename ? strrchr(filename, '.') : NULL;
+  return ext && !g_ascii_strcasecmp(ext, ".csv")
+    ? DT_EXPORT_TIMING_CSV
+    : DT_EXPORT_TIMING_JSON;
+}
+
+static gchar *_write_json(GList *timings)
+{
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "version");
+  json_builder_add_string_value(builder, darktable_package_version);
+  json_builder_set_member_name(builder, "images");
+  json_builder_begin_array(builder);
+
+  for(GList *l = timings; l; l = g_list_next(l))
+  {
+    const dt_export_timing_t *t = l->data;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "id");
+    json_builder_add_int_value(builder, t->imgid);
+    json_builder_set_member_name(builder, "filename");
+    json_builder_add_string_value(builder, t->filename);
+    json_builder_set_member_name(builder, "success");
+    json_builder_add_boolean_value(builder, t->success);
+    json_builder_set_member_name(builder, "load");
+    json_builder_add_double_value(builder, t->load);
+    json_builder_set_member_name(builder, "pipe");
+    json_builder_add_double_value(builder, t->pipe);
+    json_builder_set_member_name(builder, "write");
+    json_builder_add_double_value(builder, t->write);
+    json_builder_set_member_name(builder, "total");
+    json_builder_add_double_value(builder, t->total);
+    json_builder_set_member_name(builder, "peak_memory");
+    json_builder_add_int_value(builder, t->peak_memory);
+
+    json_builder_set_member_name(builder, "modules");
+    json_builder_begin_array(builder);
+    for(GList *ml = t->modules; ml; ml = g_list_next(ml))
+    {
+      const dt_export_timing_module_t *m = ml->data;
+      json_builder_begin_object(builder);
+      json_builder_set_member_name(builder, "op");
+      json_builder_add_string_value(builder, m->op);
+      json_builder_set_member_name(builder, "name");
+      json_builder_add_string_value(builder, m->name);
+      json_builder_set_member_name(builder, "process");
+      json_builder_add_double_value(builder, m->process);
+      json_builder_set_member_name(builder, "blend");
+      json_builder_add_double_value(builder, m->blend);
+      json_builder_set_member_name(builder, "tiling");
+      json_builder_add_boolean_value(builder, m->tiling);
+      json_builder_set_member_name(builder, "device");
+      json_builder_add_string_value(builder, m->gpu ? "GPU" : "CPU");
+      json_builder_end_object(builder);
+    }
+    json_builder_end_array(builder);
+
+    json_builder_end_object(builder);
+  }
+
+  json_builder_end_array(builder);
+  json_builder_end_object(builder);
+
+  JsonGenerator *gen = json_generator_new();
+  json_generator_set_pretty(gen, TRUE);
+  JsonNode *root = json_builder_get_root(builder);
+  json_generator_set_root(gen, root);
+  gchar *json = json_generator_to_data(gen, NULL);
+
+  json_node_free(root);
+  g_object_unref(gen);
+  g_object_unref(builder);
+  return json;
+}
+
+// a field quoted if it contains a separator, quote or line break
+static gchar *_csv_field(const char *value)
+{
+  if(!strpbrk(value, ";\"\n\r")) return g_strdup(value);
+
+  gchar **parts = g_strsplit(value, "\"", -1);
+  gchar *escaped = g_strjoinv("\"\"", parts);
+  gchar *field = g_strdup_printf("\"%s\"", escaped);
+  g_strfreev(parts);
+  g_free(escaped);
+  return field;
+}
+
+/* one line per image and step, so that the file can be loaded as a
+   single table. the image wide steps have an empty module column.
+*/
+static gchar *_write_csv(GList *timings)
+{
+  GString *csv = g_string_new("id;filename;step;module;time;tiling;device;peak_memory\n");
+
+  for(GList *l = timings; l; l = g_list_next(l))
+  {
+    const dt_export_timing_t *t = l->data;
+    gchar *filename = _csv_field(t->filename);
+    g_string_append_printf(csv, "%d;%s;load;;%.6f;;;\n", t->imgid, filename, t->load);
+    for(GList *ml = t->modules; ml; ml = g_list_next(ml))
+    {
+      const dt_export_timing_module_t *m = ml->data;
+      g_string_append_printf(csv, "%d;%s;process;%s;%.6f;%d;%s;\n",
+                             t->imgid, filename, m->name, m->process, m->tiling,
+                             m->gpu ? "GPU" : "CPU");
+      if(m->blend > 0.0)
+        g_string_append_printf(csv, "%d;%s;blend;%s;%.6f;;%s;\n",
+                               t->imgid, filename, m->name, m->blend, m->gpu ? "GPU" : "CPU");
+    }
+    g_string_append_printf(csv, "%d;%s;pipe;;%.6f;;;\n", t->imgid, filename, t->pipe);
+    g_string_append_printf(csv, "%d;%s;write;;%.6f;;;\n", t->imgid, filename, t->write);
+    g_string_append_printf(csv, "%d;%s;total;;%.6f;;;%zu\n", t->imgid, filename, t->total, t->peak_memory);
+    g_free(filename);
+  }
+
+  return g_string_free(csv, FALSE);
+}
+
+gboolean dt_export_timing_write(GList *timings,
+                                const char *filename,
+                                const dt_export_timing_format_t format)
+{
+  // in C locale so that numbers always use a decimal point
+  gchar *old_locale = g_strdup(setlocale(LC_NUMERIC, NULL));
+  setlocale(LC_NUMERIC, "C");
+  gchar *data = format == DT_EXPORT_TIMING_CSV ? _write_csv(timings) : _write_json(timings);
+  setlocale(LC_NUMERIC, old_locale);
+  g_free(old_locale);
+
+  GError *error = NULL;
+  const gboolean ok = data && g_file_set_contents(filename, data, -1, &error);
+  if(!ok)
+    dt_print(DT_DEBUG_ALWAYS, "[export_timing] can't write `%s': %s",
+             filename, error ? error->message : "no data");
+  g_clear_error(&error);
+  g_free(data);
+  return !ok;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,92 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+#include <stdio.h>
+
+/* Machine readable timing of exports.
+
+   A caller wanting the timings of an export sets up a record with
+   dt_export_timing_begin() and the export code running in the same
+   thread fills it in: dt_imageio_export_with_flags() adds the load,
+   pipe and write times and the pixelpipe adds one entry per processed
+   module. Nothing is recorded if no record is active for the thread.
+*/
+
+typedef struct dt_export_timing_module_t
+{
+  char op[20];
+  char name[64];         // op followed by the instance id of dt_iop_get_instance_id()
+  double process;        // wall time of the module including blending, secs
+  double blend;          // part of process spent blending, secs
+  gboolean tiling;
+  gboolean gpu;
+} dt_export_timing_module_t;
+
+typedef struct dt_export_timing_t
+{
+  dt_imgid_t imgid;
+  char filename[PATH_MAX];
+  gboolean success;
+  double load;           // loading the image and its history
+  double pipe;           // processing the pixelpipe
+  double write;          // encoding and writing the output file by the format module
+  double total;          // the whole export as seen by the storage
+  size_t peak_memory;    // peak resident memory of the whole process so far, bytes,
+                         // not of this image alone if exports run in parallel
+  GList *modules;        // dt_export_timing_module_t in processing order
+} dt_export_timing_t;
+
+typedef enum dt_export_timing_format_t
+{
+  DT_EXPORT_TIMING_JSON = 0,
+  DT_EXPORT_TIMING_CSV = 1
+} dt_export_timing_format_t;
+
+// start recording the export of imgid done by the calling thread
+dt_export_timing_t *dt_export_timing_begin(const dt_imgid_t imgid);
+// stop recording, returns the finished record which is owned by the caller
+dt_export_timing_t *dt_export_timing_end(const gboolean success);
+// the record of the calling thread, NULL if there is none
+dt_export_timing_t *dt_export_timing_current(void);
+
+void dt_export_timing_add_module(const char *op,
+                                 const char *name,
+                                 const double process,
+                                 const double blend,
+                                 const gboolean tiling,
+                                 const gboolean gpu);
+
+void dt_export_timing_free(dt_export_timing_t *timing);
+
+// guess the format from the file extension, json unless it ends in .csv
+dt_export_timing_format_t dt_export_timing_format_from_filename(const char *filename);
+
+// write a list of dt_export_timing_t, returns TRUE on error
+gboolean dt_export_timing_write(GList *timings,
+                                const char *filename,
+                                const dt_export_timing_format_t format);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -1818,7 +1818,8 @@ static dt_imgid_t _image_import_internal(const dt_filmid_t film_id,
                                          const char *filename,
                                          const gboolean override_ignore_nonraws,
                                          const gboolean lua_locking,
-                                         const gboolean raise_signals)
+                                         const gboolean raise_signals,
+                                         const dt_exif_prefetch_t *pf)
 {
   char *normalized_filename = dt_util_normalize_path(filename);
   if(!normalized_filename || !dt_util_test_image_file(normalized_filename))
@@ -2047,14 +2048,14 @@ static dt_imgid_t _image_import_internal(const dt_filmid_t film_id,
     img->group_id = group_id;
 
     // read dttags and exif for database queries!
-    if(dt_exif_read(img, normalized_filename))
+    if(dt_exif_read_prefetched(img, normalized_filename, pf))
       img->exif_inited = FALSE;
     char dtfilename[PATH_MAX] = { 0 };
     g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
     // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
     g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-    res = dt_exif_xmp_read(img, dtfilename, FALSE);
+    res = dt_exif_xmp_read_prefetched(img, dtfilename, FALSE, pf);
   }
   // write through to db, but not to xmp.
   dt_image_cache_write_release(img, DT_IMAGE_CACHE_RELAXED);
@@ -2169,14 +2170,24 @@ dt_imgid_t dt_image_import(const dt_filmid_t film_id,
                            const gboolean raise_signals)
 {
   return _image_import_internal(film_id, filename, override_ignore_nonraws,
-                                TRUE, raise_signals);
+                                TRUE, raise_signals, NULL);
+}
+
+dt_imgid_t dt_image_import_prefetched(const dt_filmid_t film_id,
+                                      const char *filename,
+                                      const gboolean override_ignore_nonraws,
+                                      const gboolean raise_signals,
+                                      const dt_exif_prefetch_t *pf)
+{
+  return _image_import_internal(film_id, filename, override_ignore_nonraws,
+                                TRUE, raise_signals, pf);
 }
 
 dt_imgid_t dt_image_import_lua(const dt_filmid_t film_id,
                                const char *filename,
                                const gboolean override_ignore_nonraws)
 {
-  return _image_import_internal(film_id, filename, override_ignore_nonraws, FALSE, TRUE);
+  return _image_import_internal(film_id, filename, override_ignore_nonraws, FALSE, TRUE, NULL);
 }
 
 void dt_image_init(dt_image_t *img)
@@ -3048,6 +3059,152 @@ gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid)
   return error;
 }
 
+// images whose sidecars are written at once by dt_image_write_sidecar_files()
+#define DT_SIDECAR_BATCH_SIZE 64
+
+static void _write_sidecar_batch(const GList *imgs,
+                                 const dt_imageio_write_xmp_t xmp_mode)
+{
+  // one query for the paths and for whether the sidecars are needed,
+  // same as in dt_image_write_sidecar_file(), dt_image_altered() and
+  // dt_tag_count_attached()
+  gchar *ids = NULL;
+  int count = 0;
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    if(!dt_is_valid_imgid(GPOINTER_TO_INT(l->data))) continue;
+    dt_util_str_cat(&ids, count ? ",%d" : "%d", GPOINTER_TO_INT(l->data));
+    count++;
+  }
+  if(!count) return;
+
+  // clang-format off
+  gchar *query = g_strdup_printf
+    ("SELECT i.id, f.folder || '" G_DIR_SEPARATOR_S "' || i.filename, i.version,"
+     "       CASE"
+     "        WHEN h.imgid IS NULL THEN 0"
+     "        WHEN h.basic_hash == h.current_hash THEN 0"
+     "        WHEN h.auto_hash == h.current_hash THEN 0"
+     "        WHEN (h.basic_hash IS NULL OR h.current_hash != h.basic_hash) AND"
+     "             (h.auto_hash IS NULL OR h.current_hash != h.auto_hash) THEN 1"
+     "        ELSE 0 END,"
+     "       (SELECT COUNT(t.tagid) FROM main.tagged_images AS t"
+     "        WHERE t.imgid = i.id AND t.tagid NOT IN memory.darktable_tags)"
+     " FROM main.images AS i"
+     " JOIN main.film_rolls AS f ON f.id = i.film_id"
+     " LEFT JOIN main.history_hash AS h ON h.imgid = i.id"
+     " WHERE i.id IN (%s)",
+     ids);
+  // clang-format on
+  g_free(ids);
+
+  dt_exif_xmp_sidecar_t *sidecars = calloc(count, sizeof(dt_exif_xmp_sidecar_t));
+  gboolean *done = calloc(count, sizeof(gboolean));
+  int n = 0;
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(n < count && sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const dt_imgid_t imgid = sqlite3_column_int(stmt, 0);
+    dt_exif_xmp_sidecar_t *sidecar = &sidecars[n];
+    sidecar->imgid = imgid;
+    g_strlcpy(sidecar->filename, (const char *)sqlite3_column_text(stmt, 1),
+              sizeof(sidecar->filename));
+
+    // the original is not there, use the local copy if there is one
+    if(!g_file_test(sidecar->filename, G_FILE_TEST_EXISTS))
+    {
+      gboolean from_cache = TRUE;
+      dt_image_full_path(imgid, sidecar->filename, sizeof(sidecar->filename), &from_cache);
+      if(!from_cache) continue;
+    }
+
+    dt_image_path_append_version_no_db(sqlite3_column_int(stmt, 2),
+                                       sidecar->filename, sizeof(sidecar->filename));
+    g_strlcat(sidecar->filename, ".xmp", sizeof(sidecar->filename));
+
+    const gboolean altered = sqlite3_column_int(stmt, 3) || sqlite3_column_int(stmt, 4) > 0;
+    if(xmp_mode == DT_WRITE_XMP_ALWAYS
+       || (xmp_mode == DT_WRITE_XMP_LAZY && altered))
+    {
+      // the image may be gone since, as checked by dt_exif_xmp_write()
+      gchar imgfname[PATH_MAX] = { 0 };
+      gboolean from_cache = TRUE;
+      dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
+      sidecar->error = !g_file_test(imgfname, G_FILE_TEST_IS_REGULAR);
+    }
+    else
+    {
+      // image not altered and XMP only after edit, we need here to
+      // delete the XMP.
+      if(xmp_mode == DT_WRITE_XMP_LAZY)
+        g_unlink(sidecar->filename);
+      done[n] = TRUE;
+    }
+    n++;
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  // the sidecars are read and written by several threads, the
+  // database is only read from this one
+  const int nthreads = MAX(1, MIN(n, 4));
+  DT_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(nthreads) if(nthreads > 1))
+  for(int k = 0; k < n; k++)
+    if(!done[k] && !sidecars[k].error) dt_exif_xmp_sidecar_load(&sidecars[k]);
+
+  for(int k = 0; k < n; k++)
+    if(!done[k]) dt_exif_xmp_sidecar_encode(&sidecars[k]);
+
+  DT_OMP_PRAGMA(parallel for schedule(dynamic) num_threads(nthreads) if(nthreads > 1))
+  for(int k = 0; k < n; k++)
+    if(!done[k]) dt_exif_xmp_sidecar_save(&sidecars[k]);
+
+  /* The timestamp must be put into db
+     - in case of no reported error while writing the sidecar
+     - or if no sidecar writing was required
+  */
+  dt_database_start_transaction(darktable.db);
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "UPDATE main.images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1",
+     -1, &stmt, NULL);
+  for(int k = 0; k < n; k++)
+  {
+    if(sidecars[k].error) continue;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, sidecars[k].imgid);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
+
+  for(int k = 0; k < n; k++)
+    dt_exif_xmp_sidecar_cleanup(&sidecars[k]);
+  free(sidecars);
+  free(done);
+}
+
+void dt_image_write_sidecar_files(const GList *imgs)
+{
+  const dt_imageio_write_xmp_t xmp_mode = dt_image_get_xmp_mode();
+
+  GList *batch = NULL;
+  int count = 0;
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    batch = g_list_prepend(batch, l->data);
+    if(++count == DT_SIDECAR_BATCH_SIZE || !g_list_next(l))
+    {
+      _write_sidecar_batch(batch, xmp_mode);
+      g_list_free(batch);
+      batch = NULL;
+      count = 0;
+    }
+  }
+}
+
 void dt_image_synch_xmps(const GList *imgs)
 {
   dt_sidecar_synch_enqueue_list(imgs);
@@ -468,6 +468,13 @@ dt_imgid_t dt_image_import(dt_filmid_t film_id,
                            const char *filename,
                            const gboolean override_ignore_nonraws,
                            const gboolean raise_signals);
+/** same as dt_image_import(), using metadata read ahead by dt_exif_prefetch(). */
+struct dt_exif_prefetch_t;
+dt_imgid_t dt_image_import_prefetched(const dt_filmid_t film_id,
+                                      const char *filename,
+                                      const gboolean override_ignore_nonraws,
+                                      const gboolean raise_signals,
+                                      const struct dt_exif_prefetch_t *pf);
 /** imports a new image from raw/etc file and adds it to the data base
  * and image cache. Use from lua thread.*/
 dt_imgid_t dt_image_import_lua(const dt_filmid_t film_id,
@@ -612,6 +619,9 @@ gboolean dt_image_safe_remove(const dt_imgid_t imgid);
 void dt_image_local_copy_synch(void);
 // xmp functions:
 gboolean dt_image_write_sidecar_file(const dt_imgid_t imgid);
+/* same as dt_image_write_sidecar_file() for many images, with fewer
+   queries and the files written by several threads */
+void dt_image_write_sidecar_files(const GList *imgs);
 void dt_image_synch_xmp(const int32_t selected);
 void dt_image_synch_xmps(const GList *img);
 void dt_image_synch_all_xmp(const gchar *pathname);
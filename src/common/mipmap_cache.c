@@ -23,12 +23,14 @@
 #include "common/file_location.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
+#include "common/mipmap_pack.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
 #include "imageio/imageio_common.h"
 #include "imageio/imageio_jpeg.h"
 #include "imageio/imageio_module.h"
+#include "imageio/qoi.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -461,6 +463,163 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf,
   return dsc + 1;
 }
 
+static inline gboolean _mipmap_cache_disk_backend(const dt_mipmap_cache_t *cache,
+                                                  const dt_mipmap_size_t mip)
+{
+  return cache->cachedir[0]
+    && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_LDR_MAX)
+        || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_LDR_MAX));
+}
+
+// the extension of thumbnail files per codec
+static const char *_codec_extension[DT_MIPMAP_CODEC_COUNT] = { "jpg", "qoi" };
+
+// qoi has no room for metadata, the color space follows the image
+#define DT_MIPMAP_QOI_TRAILER "dtcs"
+#define DT_MIPMAP_QOI_TRAILER_SIZE 8
+
+dt_mipmap_cache_codec_t dt_mipmap_cache_get_codec(void)
+{
+  return dt_conf_is_equal("cache_disk_codec", "QOI")
+    ? DT_MIPMAP_CODEC_QOI
+    : DT_MIPMAP_CODEC_JPEG;
+}
+
+const char *dt_mipmap_cache_codec_name(const dt_mipmap_cache_codec_t codec)
+{
+  return codec == DT_MIPMAP_CODEC_QOI ? "qoi" : "jpeg";
+}
+
+uint8_t *dt_mipmap_cache_encode(const uint8_t *in,
+                                const int width,
+                                const int height,
+                                const dt_colorspaces_color_profile_type_t color_space,
+                                const dt_mipmap_cache_codec_t codec,
+                                size_t *length)
+{
+  *length = 0;
+  if(codec == DT_MIPMAP_CODEC_QOI)
+  {
+    // alpha isn't used by thumbnails, rgb only packs better
+    uint8_t *rgb = dt_alloc_align_uint8((size_t)3 * width * height);
+    if(!rgb) return NULL;
+    const size_t npixels = (size_t)width * height;
+    for(size_t k = 0; k < npixels; k++)
+      for(int c = 0; c < 3; c++) rgb[3 * k + c] = in[4 * k + c];
+
+    const qoi_desc desc = { .width = width, .height = height, .channels = 3, .colorspace = QOI_SRGB };
+    int len = 0;
+    uint8_t *qoi = qoi_encode(rgb, &desc, &len);
+    dt_free_align(rgb);
+    uint8_t *blob = qoi ? realloc(qoi, len + DT_MIPMAP_QOI_TRAILER_SIZE) : NULL;
+    if(!blob)
+    {
+      free(qoi);
+      return NULL;
+    }
+    const int32_t cs = color_space;
+    memcpy(blob + len, DT_MIPMAP_QOI_TRAILER, 4);
+    memcpy(blob + len + 4, &cs, sizeof(cs));
+    *length = len + DT_MIPMAP_QOI_TRAILER_SIZE;
+    return blob;
+  }
+
+  // dt_imageio_jpeg_compress() can't grow its output buffer which is
+  // as large as the pixels, so the headers of a jpeg might not fit for
+  // tiny thumbnails. those are kept as QOI, decoding tells them apart.
+  const size_t size = (size_t)4 * width * height;
+  if(size < 65536)
+    return dt_mipmap_cache_encode(in, width, height, color_space, DT_MIPMAP_CODEC_QOI, length);
+  uint8_t *blob = malloc(size);
+  if(!blob) return NULL;
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  const int len = dt_imageio_jpeg_compress(in, blob, width, height,
+                                           MIN(100, MAX(10, cache_quality)));
+  if(len <= 1)
+  {
+    free(blob);
+    return NULL;
+  }
+  *length = len;
+  return blob;
+}
+
+gboolean dt_mipmap_cache_decode(const uint8_t *blob,
+                                const size_t length,
+                                uint8_t *out,
+                                const uint32_t max_width,
+                                const uint32_t max_height,
+                                int *width,
+                                int *height,
+                                dt_colorspaces_color_profile_type_t *color_space)
+{
+  if(length > 4 && !memcmp(blob, "qoif", 4))
+  {
+    if(length > INT_MAX) return TRUE;
+    qoi_desc desc;
+    uint8_t *rgba = qoi_decode(blob, (int)length, &desc, 4);
+    if(!rgba) return TRUE;
+    if(desc.width > max_width || desc.height > max_height)
+    {
+      free(rgba);
+      return TRUE;
+    }
+    memcpy(out, rgba, (size_t)4 * desc.width * desc.height);
+    free(rgba);
+
+    if(*color_space == DT_COLORSPACE_NONE)
+    {
+      int32_t cs = DT_COLORSPACE_DISPLAY;
+      const uint8_t *trailer = blob + length - DT_MIPMAP_QOI_TRAILER_SIZE;
+      if(length > DT_MIPMAP_QOI_TRAILER_SIZE
+         && !memcmp(trailer, DT_MIPMAP_QOI_TRAILER, 4))
+        memcpy(&cs, trailer + 4, sizeof(cs));
+      *color_space = cs;
+    }
+    *width = desc.width;
+    *height = desc.height;
+    return FALSE;
+  }
+
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(blob, length, &jpg)
+     || jpg.width > max_width
+     || jpg.height > max_height)
+    return TRUE;
+
+  if(*color_space == DT_COLORSPACE_NONE)
+    *color_space = dt_imageio_jpeg_read_color_space(&jpg);
+  if(dt_imageio_jpeg_decompress(&jpg, out))
+    return TRUE;
+
+  *width = jpg.width;
+  *height = jpg.height;
+  return FALSE;
+}
+
+// decode a thumbnail of the disk backend into the buffer following dsc.
+// a color space of DT_COLORSPACE_NONE is read from the thumbnail itself.
+static gboolean _mipmap_cache_decompress(const dt_mipmap_cache_t *cache,
+                                         const dt_mipmap_size_t mip,
+                                         dt_mipmap_buffer_dsc_t *dsc,
+                                         const uint8_t *blob,
+                                         const size_t len,
+                                         dt_colorspaces_color_profile_type_t color_space)
+{
+  int width = 0, height = 0;
+  if(dt_mipmap_cache_decode(blob, len, (uint8_t *)(dsc + 1),
+                            cache->max_width[mip], cache->max_height[mip],
+                            &width, &height, &color_space))
+    return TRUE;
+
+  dsc->width = width;
+  dsc->height = height;
+  dsc->iscale = 1.0f;
+  dsc->color_space = color_space;
+  return FALSE;
+}
+
 // callback for the cache backend to initialize payload pointers
 static void _mipmap_cache_allocate_dynamic(void *data,
                                            dt_cache_entry_t *entry)
@@ -525,17 +684,43 @@ static void _mipmap_cache_allocate_dynamic(void *data,
   int loaded_from_disk = 0;
   if(mip <= DT_MIPMAP_LDR_MAX)
   {
-    if(cache->cachedir[0]
-       && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_LDR_MAX)
-           || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_LDR_MAX)))
+    if(_mipmap_cache_disk_backend(cache, mip))
     {
       // try and load from disk, if successful set flag
+      dt_mipmap_pack_t *pack = cache->pack[mip];
+      dt_mipmap_pack_blob_t packed;
       char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename),
-               "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-               _get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
-      if(f)
+      FILE *f = NULL;
+      // thumbnails written with another codec are still good
+      const dt_mipmap_cache_codec_t codec = dt_mipmap_cache_get_codec();
+      for(int c = 0; c < DT_MIPMAP_CODEC_COUNT && !pack && !f; c++)
+      {
+        snprintf(filename, sizeof(filename),
+                 "%s.d/%d/%" PRIu32 ".%s", cache->cachedir, (int)mip,
+                 _get_imgid(entry->key),
+                 _codec_extension[(codec + c) % DT_MIPMAP_CODEC_COUNT]);
+        f = g_fopen(filename, "rb");
+      }
+      if(pack && dt_mipmap_pack_read(pack, _get_imgid(entry->key), &packed))
+      {
+        if(_mipmap_cache_decompress(cache, mip, dsc, packed.data, packed.length,
+                                    packed.color_space))
+        {
+          dt_print(DT_DEBUG_ALWAYS,
+                   "[mipmap_cache] failed to decompress thumbnail for ID=%d from `%s'!",
+                   _get_imgid(entry->key), pack->path);
+          dt_mipmap_pack_remove(pack, _get_imgid(entry->key));
+        }
+        else
+        {
+          dt_print(DT_DEBUG_CACHE,
+                   "[mipmap_cache] grab mip %d for ID=%d from disk cache pack", mip,
+                   _get_imgid(entry->key));
+          loaded_from_disk = 1;
+        }
+        dt_mipmap_pack_release(&packed);
+      }
+      else if(f)
       {
         uint8_t *blob = 0;
         fseek(f, 0, SEEK_END);
@@ -546,13 +731,7 @@ static void _mipmap_cache_allocate_dynamic(void *data,
         fseek(f, 0, SEEK_SET);
         const int rd = fread(blob, sizeof(uint8_t), len, f);
         if(rd != len) goto read_error;
-        dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip]
-               || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, (uint8_t *)entry->data + sizeof(*dsc)))
+        if(_mipmap_cache_decompress(cache, mip, dsc, blob, len, DT_COLORSPACE_NONE))
         {
           dt_print(DT_DEBUG_ALWAYS,
                    "[mipmap_cache] failed to decompress thumbnail for ID=%d from `%s'!",
@@ -562,10 +741,6 @@ static void _mipmap_cache_allocate_dynamic(void *data,
         dt_print(DT_DEBUG_CACHE,
                  "[mipmap_cache] grab mip %d for ID=%d from disk cache", mip,
                  _get_imgid(entry->key));
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-        dsc->iscale = 1.0f;
-        dsc->color_space = color_space;
         loaded_from_disk = 1;
         if(0)
         {
@@ -603,11 +778,58 @@ static void _mipmap_cache_unlink_ondisk_thumbnail(void *data,
   // if(dt_conf_get_bool("cache_disk_backend"))
   if(cache->cachedir[0])
   {
-    char filename[PATH_MAX] = { 0 };
-    snprintf(filename, sizeof(filename),
-             "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
-    g_unlink(filename);
+    if(cache->pack[mip])
+      dt_mipmap_pack_remove(cache->pack[mip], imgid);
+
+    for(int c = 0; c < DT_MIPMAP_CODEC_COUNT; c++)
+    {
+      char filename[PATH_MAX] = { 0 };
+      snprintf(filename, sizeof(filename),
+               "%s.d/%d/%"PRIu32".%s", cache->cachedir, (int)mip, imgid, _codec_extension[c]);
+      g_unlink(filename);
+    }
+  }
+}
+
+// check the disk isn't full before writing filename
+static gboolean _mipmap_cache_disk_full(const char *filename)
+{
+  struct statvfs vfsbuf;
+  if(statvfs(filename, &vfsbuf))
+  {
+    dt_print(DT_DEBUG_ALWAYS,
+             "[mipmap_cache] aborting image write since couldn't determine free space available to write %s",
+             filename);
+    return TRUE;
   }
+
+  const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+  if(free_mb < 100)
+  {
+    dt_print(DT_DEBUG_ALWAYS,
+             "[mipmap_cache] aborting image write as only %" PRId64 " MB free to write %s",
+             free_mb, filename);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static void _mipmap_cache_write_pack(dt_mipmap_pack_t *pack,
+                                     const dt_imgid_t imgid,
+                                     const dt_mipmap_buffer_dsc_t *dsc)
+{
+  // as for files, don't rewrite existing thumbnails
+  if(dt_mipmap_pack_contains(pack, imgid)
+     || _mipmap_cache_disk_full(pack->path))
+    return;
+
+  // the color space is kept in the pack instead of exif data
+  size_t len = 0;
+  uint8_t *blob = dt_mipmap_cache_encode((const uint8_t *)(dsc + 1), dsc->width, dsc->height,
+                                         dsc->color_space, dt_mipmap_cache_get_codec(), &len);
+  if(blob)
+    dt_mipmap_pack_write(pack, imgid, blob, len, dsc->color_space);
+  free(blob);
 }
 
 static void _mipmap_cache_deallocate_dynamic(void *data,
@@ -625,11 +847,11 @@ static void _mipmap_cache_deallocate_dynamic(void *data,
       {
         _mipmap_cache_unlink_ondisk_thumbnail(data, _get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0]
-              && ((dt_conf_get_bool("cache_disk_backend")
-                   && mip < DT_MIPMAP_LDR_MAX)
-                  || (dt_conf_get_bool("cache_disk_backend_full")
-                      && mip == DT_MIPMAP_LDR_MAX)))
+      else if(_mipmap_cache_disk_backend(cache, mip) && cache->pack[mip])
+      {
+        _mipmap_cache_write_pack(cache->pack[mip], _get_imgid(entry->key), dsc);
+      }
+      else if(_mipmap_cache_disk_backend(cache, mip))
       {
         // serialize to disk
         char filename[PATH_MAX] = {0};
@@ -638,9 +860,10 @@ static void _mipmap_cache_deallocate_dynamic(void *data,
         const int mkd = g_mkdir_with_parents(filename, 0750);
         if(!mkd)
         {
+          const dt_mipmap_cache_codec_t codec = dt_mipmap_cache_get_codec();
           snprintf(filename, sizeof(filename),
-                   "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-                   _get_imgid(entry->key));
+                   "%s.d/%d/%" PRIu32 ".%s", cache->cachedir, (int)mip,
+                   _get_imgid(entry->key), _codec_extension[codec]);
           // Don't write existing files as both performance and
           // quality (lossy jpg) suffer
           FILE *f = NULL;
@@ -648,44 +871,41 @@ static void _mipmap_cache_deallocate_dynamic(void *data,
              && (f = g_fopen(filename, "wb")))
           {
             // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if(!statvfs(filename, &vfsbuf))
-            {
-              const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if(free_mb < 100)
-              {
-                dt_print(DT_DEBUG_ALWAYS,
-                         "[mipmap_cache] aborting image write as only %" PRId64 " MB free to write %s",
-                         free_mb, filename);
-                goto write_error;
-              }
-            }
-            else
-            {
-              dt_print(DT_DEBUG_ALWAYS,
-                       "[mipmap_cache] aborting image write since couldn't determine free space available to write %s",
-                       filename);
+            if(_mipmap_cache_disk_full(filename))
               goto write_error;
-            }
 
-            const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
+            int failed = 0;
+            if(codec == DT_MIPMAP_CODEC_QOI)
             {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
+              size_t len = 0;
+              uint8_t *blob = dt_mipmap_cache_encode((uint8_t *)entry->data + sizeof(*dsc),
+                                                     dsc->width, dsc->height,
+                                                     dsc->color_space, codec, &len);
+              failed = !blob || fwrite(blob, 1, len, f) != len;
+              free(blob);
             }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
+            else
             {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+              const int cache_quality = dt_conf_get_int("database_cache_quality");
+              const uint8_t *exif = NULL;
+              int exif_len = 0;
+              if(dsc->color_space == DT_COLORSPACE_SRGB)
+              {
+                exif = dt_mipmap_cache_exif_data_srgb;
+                exif_len = dt_mipmap_cache_exif_data_srgb_length;
+              }
+              else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
+              {
+                exif = dt_mipmap_cache_exif_data_adobergb;
+                exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+              }
+              failed = dt_imageio_jpeg_write(filename,
+                                             (uint8_t *)entry->data + sizeof(*dsc),
+                                             dsc->width, dsc->height,
+                                             MIN(100, MAX(10, cache_quality)),
+                                             exif, exif_len);
             }
-            if(dt_imageio_jpeg_write(filename,
-                                     (uint8_t *)entry->data + sizeof(*dsc),
-                                     dsc->width, dsc->height,
-                                     MIN(100, MAX(10, cache_quality)),
-                                     exif, exif_len))
+            if(failed)
             {
 write_error:
               g_unlink(filename);
@@ -706,6 +926,34 @@ static uint32_t _nearest_power_of_two(const uint32_t value)
   return rc;
 }
 
+static void _mipmap_cache_open_packs(dt_mipmap_cache_t *cache)
+{
+  if(!cache->cachedir[0]) return;
+
+  const gboolean use_packs = dt_conf_get_bool("cache_disk_backend_pack");
+  for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip <= DT_MIPMAP_LDR_MAX; mip++)
+  {
+    char dirname[PATH_MAX] = { 0 };
+    snprintf(dirname, sizeof(dirname), "%s.d/%d", cache->cachedir, (int)mip);
+    if(use_packs && _mipmap_cache_disk_backend(cache, mip))
+    {
+      // takes over the thumbnails of the directory layout on the first run
+      cache->pack[mip] = dt_mipmap_pack_open(cache->cachedir, mip, dirname);
+    }
+    else if(!use_packs)
+    {
+      // thumbnails invalidated while packs are off would come back stale
+      // once they are turned on again, so drop them
+      char filename[PATH_MAX] = { 0 };
+      snprintf(filename, sizeof(filename), "%s.d/%d.pack", cache->cachedir, (int)mip);
+      if(!g_unlink(filename))
+        dt_print(DT_DEBUG_CACHE, "[mipmap_cache] removed unused thumbnail pack `%s'", filename);
+      snprintf(filename, sizeof(filename), "%s.d/%d.idx", cache->cachedir, (int)mip);
+      g_unlink(filename);
+    }
+  }
+}
+
 void dt_mipmap_cache_init()
 {
   dt_mipmap_cache_t *cache = calloc(1, sizeof(dt_mipmap_cache_t));
@@ -770,19 +1018,27 @@ void dt_mipmap_cache_init()
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
 
-  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
+  // the largest fixed size thumbnails are far bigger than the smallest ones
+  // and must still fit into a shard's share of the quota. full size ones
+  // (DT_MIPMAP_LDR_MAX) depend on the image and are left to the cache's
+  // eviction across shards.
+  dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem,
+                dt_cache_auto_shards(max_mem, cache->buffer_size[DT_MIPMAP_LDR_MAX - 1]));
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache,
                                  _mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache,
                                 _mipmap_cache_deallocate_dynamic, cache);
+  if(dt_conf_get_bool("cache_scan_resistant"))
+    dt_cache_set_policy(&cache->mip_thumbs.cache, DT_CACHE_POLICY_SLRU);
 
   // even with one thread you want two buffers. one for dr one for thumbs.
   // Also have the nr of cache entries larger than worker threads
   const int full_entries = 2 * dt_worker_threads();
   const int32_t max_mem_bufs = _nearest_power_of_two(full_entries);
 
-  // for this buffer, because it can be very busy during import
-  dt_cache_init(&cache->mip_full.cache, 0, max_mem_bufs);
+  // for this buffer, because it can be very busy during import.
+  // only a few slots here, so keep a single shard to honour the quota exactly.
+  dt_cache_init(&cache->mip_full.cache, 0, max_mem_bufs, 1);
   dt_cache_set_allocate_callback(&cache->mip_full.cache,
                                  _mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_full.cache,
@@ -790,7 +1046,7 @@ void dt_mipmap_cache_init()
   cache->buffer_size[DT_MIPMAP_FULL] = 0;
 
   // same for mipf:
-  dt_cache_init(&cache->mip_f.cache, 0, max_mem_bufs);
+  dt_cache_init(&cache->mip_f.cache, 0, max_mem_bufs, 1);
   dt_cache_set_allocate_callback(&cache->mip_f.cache,
                                  _mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_f.cache,
@@ -798,6 +1054,8 @@ void dt_mipmap_cache_init()
   cache->buffer_size[DT_MIPMAP_F] = sizeof(dt_mipmap_buffer_dsc_t)
                                         + 4 * sizeof(float) * cache->max_width[DT_MIPMAP_F]
                                           * cache->max_height[DT_MIPMAP_F];
+
+  _mipmap_cache_open_packs(cache);
 }
 
 void dt_mipmap_cache_cleanup()
@@ -808,25 +1066,43 @@ void dt_mipmap_cache_cleanup()
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  // after the caches as these write their thumbnails on cleanup
+  for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip <= DT_MIPMAP_LDR_MAX; mip++)
+    dt_mipmap_pack_close(cache->pack[mip]);
   darktable.mipmap_cache = NULL;
   free(cache);
 }
 
+static void _print_hit_rate(const char *level,
+                            dt_cache_t *cache)
+{
+  const uint64_t lookups = cache->stats_hits + cache->stats_misses;
+  dt_print(DT_DEBUG_ALWAYS,
+           "[mipmap_cache] %s hit rate %6.2f%% (%"PRIu64"/%"PRIu64"), %"PRIu64" promoted",
+           level,
+           lookups ? 100.0 * cache->stats_hits / (double)lookups : 0.0,
+           cache->stats_hits, lookups, cache->stats_promotions);
+}
+
 void dt_mipmap_cache_print()
 {
   dt_mipmap_cache_t *cache = darktable.mipmap_cache;
   if(!cache) return;
 
   dt_print(DT_DEBUG_ALWAYS,"[mipmap_cache] thumbs fill %.2f/%.2f MB (%.2f%%)",
-           cache->mip_thumbs.cache.cost / (1024.0 * 1024.0),
+           dt_cache_get_cost(&cache->mip_thumbs.cache) / (1024.0 * 1024.0),
            cache->mip_thumbs.cache.cost_quota / (1024.0 * 1024.0),
-           100.0f * (float)cache->mip_thumbs.cache.cost / (float)cache->mip_thumbs.cache.cost_quota);
+           100.0f * (float)dt_cache_get_cost(&cache->mip_thumbs.cache) / (float)cache->mip_thumbs.cache.cost_quota);
   dt_print(DT_DEBUG_ALWAYS,"[mipmap_cache] float fill %"PRIu32"/%"PRIu32" slots (%.2f%%)",
-           (uint32_t)cache->mip_f.cache.cost, (uint32_t)cache->mip_f.cache.cost_quota,
-           100.0f * (float)cache->mip_f.cache.cost / (float)cache->mip_f.cache.cost_quota);
+           (uint32_t)dt_cache_get_cost(&cache->mip_f.cache), (uint32_t)cache->mip_f.cache.cost_quota,
+           100.0f * (float)dt_cache_get_cost(&cache->mip_f.cache) / (float)cache->mip_f.cache.cost_quota);
   dt_print(DT_DEBUG_ALWAYS,"[mipmap_cache] full  fill %"PRIu32"/%"PRIu32" slots (%.2f%%)",
-           (uint32_t)cache->mip_full.cache.cost, (uint32_t)cache->mip_full.cache.cost_quota,
-           100.0f * (float)cache->mip_full.cache.cost / (float)cache->mip_full.cache.cost_quota);
+           (uint32_t)dt_cache_get_cost(&cache->mip_full.cache), (uint32_t)cache->mip_full.cache.cost_quota,
+           100.0f * (float)dt_cache_get_cost(&cache->mip_full.cache) / (float)cache->mip_full.cache.cost_quota);
+
+  _print_hit_rate("thumb", &cache->mip_thumbs.cache);
+  _print_hit_rate("float", &cache->mip_f.cache);
+  _print_hit_rate("full ", &cache->mip_full.cache);
 
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -949,11 +1225,8 @@ void dt_mipmap_cache_get_with_caller(dt_mipmap_buffer_t *buf,
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || mip < DT_MIPMAP_0)
       return;
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename),
-             "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_on_disk(imgid, mip)) return;
     dt_control_add_job(DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_BLOCKING)
@@ -1199,14 +1472,8 @@ void dt_mipmap_cache_get_with_caller(dt_mipmap_buffer_t *buf,
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename),
-               "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_on_disk(imgid, mip))
+      dt_mipmap_cache_get(0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = NO_IMGID;
@@ -1517,6 +1784,27 @@ static void _init_8(uint8_t *buf,
   char filename[PATH_MAX] = { 0 };
   gboolean from_cache = TRUE;
 
+  // the nearest larger level in memory is the cheapest source by far, it
+  // has been through the pipe or comes from the embedded thumbnail already
+  for(dt_mipmap_size_t k = size + 1; k <= DT_MIPMAP_LDR_MAX; k++)
+  {
+    dt_mipmap_buffer_t tmp;
+    dt_mipmap_cache_get(&tmp, imgid, k, DT_MIPMAP_TESTLOCK, 'r');
+    if(tmp.buf == NULL)
+      continue;
+    const gboolean usable = tmp.width > ERR_IMG_MAX_DIM || tmp.height > ERR_IMG_MAX_DIM;
+    if(usable)
+    {
+      dt_print(DT_DEBUG_CACHE,
+               "[mipmap_cache] generate mip %d for ID=%d from level %d",
+               size, imgid, k);
+      *color_space = tmp.color_space;
+      dt_iop_downsample_8(tmp.buf, tmp.width, tmp.height, buf, wd, ht, width, height);
+    }
+    dt_mipmap_cache_release(&tmp);
+    if(usable) return;
+  }
+
   /* do not even try to process file if it isn't available */
   dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
   if(!*filename || !g_file_test(filename, G_FILE_TEST_EXISTS))
@@ -1606,29 +1894,6 @@ static void _init_8(uint8_t *buf,
     }
   }
 
-  if(res)
-  {
-    //try to generate mip from larger mip
-    for(dt_mipmap_size_t k = size + 1; k <= DT_MIPMAP_LDR_MAX; k++)
-    {
-      dt_mipmap_buffer_t tmp;
-      dt_mipmap_cache_get(&tmp, imgid, k, DT_MIPMAP_TESTLOCK, 'r');
-      if(tmp.buf == NULL)
-        continue;
-      dt_print(DT_DEBUG_CACHE,
-               "[mipmap_cache] generate mip %d for ID=%d from level %d",
-               size, imgid, k);
-      *color_space = tmp.color_space;
-      // downsample
-      dt_iop_flip_and_zoom_8(tmp.buf, tmp.width, tmp.height, buf,
-                             wd, ht, ORIENTATION_NONE, width, height);
-
-      dt_mipmap_cache_release(&tmp);
-      res = FALSE;
-      break;
-    }
-  }
-
   if(res)
   {
     // try the real thing: rawspeed + pixelpipe
@@ -1701,25 +1966,55 @@ void dt_mipmap_cache_copy_thumbnails(const dt_imgid_t dst_imgid,
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip <= DT_MIPMAP_LDR_MAX; mip++)
     {
-      // try and load from disk, if successful set flag
-      char srcpath[PATH_MAX] = {0};
-      char dstpath[PATH_MAX] = {0};
-      snprintf(srcpath, sizeof(srcpath),
-               "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, src_imgid);
-      snprintf(dstpath, sizeof(dstpath),
-               "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, dst_imgid);
-      GFile *src = g_file_new_for_path(srcpath);
-      GFile *dst = g_file_new_for_path(dstpath);
-      GError *gerror = NULL;
-      g_file_copy(src, dst, G_FILE_COPY_NONE, NULL, NULL, NULL, &gerror);
-      // ignore errors, we tried what we could.
-      g_object_unref(dst);
-      g_object_unref(src);
-      g_clear_error(&gerror);
+      if(cache->pack[mip])
+      {
+        dt_mipmap_pack_copy(cache->pack[mip], dst_imgid, src_imgid);
+        continue;
+      }
+      for(int c = 0; c < DT_MIPMAP_CODEC_COUNT; c++)
+      {
+        // try and load from disk, if successful set flag
+        char srcpath[PATH_MAX] = {0};
+        char dstpath[PATH_MAX] = {0};
+        snprintf(srcpath, sizeof(srcpath),
+                 "%s.d/%d/%"PRIu32".%s", cache->cachedir, (int)mip, src_imgid,
+                 _codec_extension[c]);
+        snprintf(dstpath, sizeof(dstpath),
+                 "%s.d/%d/%"PRIu32".%s", cache->cachedir, (int)mip, dst_imgid,
+                 _codec_extension[c]);
+        GFile *src = g_file_new_for_path(srcpath);
+        GFile *dst = g_file_new_for_path(dstpath);
+        GError *gerror = NULL;
+        g_file_copy(src, dst, G_FILE_COPY_NONE, NULL, NULL, NULL, &gerror);
+        // ignore errors, we tried what we could.
+        g_object_unref(dst);
+        g_object_unref(src);
+        g_clear_error(&gerror);
+      }
     }
   }
 }
 
+gboolean dt_mipmap_cache_on_disk(const dt_imgid_t imgid,
+                                 const dt_mipmap_size_t mip)
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  if(!cache->cachedir[0] || mip > DT_MIPMAP_LDR_MAX)
+    return FALSE;
+
+  if(cache->pack[mip])
+    return dt_mipmap_pack_contains(cache->pack[mip], imgid);
+
+  for(int c = 0; c < DT_MIPMAP_CODEC_COUNT; c++)
+  {
+    char filename[PATH_MAX] = { 0 };
+    snprintf(filename, sizeof(filename),
+             "%s.d/%d/%"PRIu32".%s", cache->cachedir, (int)mip, imgid, _codec_extension[c]);
+    if(dt_util_test_image_file(filename)) return TRUE;
+  }
+  return FALSE;
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
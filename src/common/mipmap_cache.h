@@ -96,6 +96,8 @@ typedef struct dt_mipmap_cache_one_t
   long int stats_standin;    // texture used as stand-in
 } dt_mipmap_cache_one_t;
 
+struct dt_mipmap_pack_t;
+
 typedef struct dt_mipmap_cache_t
 {
   // real width and height are stored per element
@@ -110,6 +112,8 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // disk backend in pack files instead of one jpeg per thumbnail, per ldr level
+  struct dt_mipmap_pack_t *pack[DT_MIPMAP_F];
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -161,6 +165,42 @@ dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace(void);
 // only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_imgid_t dst_imgid, const dt_imgid_t src_imgid);
 
+// is there a thumbnail of the image at this size in the disk backend?
+gboolean dt_mipmap_cache_on_disk(const dt_imgid_t imgid, const dt_mipmap_size_t mip);
+
+// formats of the thumbnails in the disk backend
+typedef enum dt_mipmap_cache_codec_t
+{
+  DT_MIPMAP_CODEC_JPEG = 0, // lossy and small
+  DT_MIPMAP_CODEC_QOI = 1,  // lossless, several times faster to decode but larger
+  DT_MIPMAP_CODEC_COUNT
+} dt_mipmap_cache_codec_t;
+
+// the codec selected in preferences for new thumbnails
+dt_mipmap_cache_codec_t dt_mipmap_cache_get_codec(void);
+const char *dt_mipmap_cache_codec_name(const dt_mipmap_cache_codec_t codec);
+
+// compress an 8-bit 4 channel thumbnail, returns a buffer to be free()d or NULL.
+// the color space is kept in the data unless it's a jpeg. tiny thumbnails are
+// always compressed as QOI.
+uint8_t *dt_mipmap_cache_encode(const uint8_t *in,
+                                const int width,
+                                const int height,
+                                const dt_colorspaces_color_profile_type_t color_space,
+                                const dt_mipmap_cache_codec_t codec,
+                                size_t *length);
+// decompress a thumbnail of any codec into out, which takes max_width x max_height
+// pixels. a color space of DT_COLORSPACE_NONE is taken from the data.
+// returns TRUE on error.
+gboolean dt_mipmap_cache_decode(const uint8_t *blob,
+                                const size_t length,
+                                uint8_t *out,
+                                const uint32_t max_width,
+                                const uint32_t max_height,
+                                int *width,
+                                int *height,
+                                dt_colorspaces_color_profile_type_t *color_space);
+
 // return the mipmap corresponding to text value saved in prefs
 dt_mipmap_size_t dt_mipmap_cache_get_min_mip_from_pref(const char *value);
 
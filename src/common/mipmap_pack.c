@@ -0,0 +1,519 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DT_MIPMAP_PACK_MAGIC 0xD7BAC001
+#define DT_MIPMAP_PACK_INDEX_MAGIC 0xD7BAC1D0
+#define DT_MIPMAP_PACK_INDEX_VERSION 1
+
+// record header in the pack, followed by length bytes of payload.
+// a length of zero removes the thumbnail of imgid.
+typedef struct _pack_record_t
+{
+  uint32_t magic;
+  int32_t imgid;
+  uint32_t length;
+  int32_t color_space;
+} _pack_record_t;
+
+typedef struct _pack_index_header_t
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  uint64_t dead;
+  uint64_t count;
+} _pack_index_header_t;
+
+typedef struct _pack_index_entry_t
+{
+  int32_t imgid;
+  int32_t color_space;
+  uint32_t length;
+  uint32_t unused;
+  uint64_t offset;
+} _pack_index_entry_t;
+
+// in memory index entry, offset is the one of the payload
+typedef struct _pack_entry_t
+{
+  uint64_t offset;
+  uint32_t length;
+  int32_t color_space;
+} _pack_entry_t;
+
+static inline uint64_t _map_length(const dt_mipmap_pack_t *pack)
+{
+  return pack->map ? g_mapped_file_get_length(pack->map) : 0;
+}
+
+static void _pack_remap(dt_mipmap_pack_t *pack)
+{
+  if(pack->map) g_mapped_file_unref(pack->map);
+  pack->map = g_mapped_file_new(pack->path, FALSE, NULL);
+}
+
+// make sure the mapping covers [offset, offset + length)
+static gboolean _pack_mapped(dt_mipmap_pack_t *pack,
+                             const uint64_t offset,
+                             const uint64_t length)
+{
+  if(offset + length > _map_length(pack)) _pack_remap(pack);
+  return offset + length <= _map_length(pack);
+}
+
+// account for a record found at offset in the index
+static void _pack_apply(dt_mipmap_pack_t *pack,
+                        const _pack_record_t *rec,
+                        const uint64_t offset)
+{
+  _pack_entry_t *old = g_hash_table_lookup(pack->index, GINT_TO_POINTER(rec->imgid));
+  if(old) pack->dead += sizeof(_pack_record_t) + old->length;
+
+  if(rec->length == 0)
+  {
+    g_hash_table_remove(pack->index, GINT_TO_POINTER(rec->imgid));
+    pack->dead += sizeof(_pack_record_t);
+  }
+  else
+  {
+    _pack_entry_t *entry = g_malloc(sizeof(_pack_entry_t));
+    entry->offset = offset + sizeof(_pack_record_t);
+    entry->length = rec->length;
+    entry->color_space = rec->color_space;
+    g_hash_table_replace(pack->index, GINT_TO_POINTER(rec->imgid), entry);
+  }
+}
+
+// read the records from offset to the end of the mapping, returns
+// FALSE if the pack ends in a partial or broken record
+static gboolean _pack_scan(dt_mipmap_pack_t *pack,
+                           uint64_t offset)
+{
+  const uint8_t *base = pack->map ? (const uint8_t *)g_mapped_file_get_contents(pack->map) : NULL;
+  const uint64_t length = _map_length(pack);
+
+  while(offset + sizeof(_pack_record_t) <= length)
+  {
+    _pack_record_t rec;
+    memcpy(&rec, base + offset, sizeof(rec));
+    if(rec.magic != DT_MIPMAP_PACK_MAGIC
+       || offset + sizeof(rec) + rec.length > length)
+      break;
+    _pack_apply(pack, &rec, offset);
+    offset += sizeof(rec) + rec.length;
+  }
+  pack->size = offset;
+  return offset == length;
+}
+
+static gboolean _pack_append(dt_mipmap_pack_t *pack,
+                             const dt_imgid_t imgid,
+                             const uint8_t *data,
+                             const size_t length,
+                             const dt_colorspaces_color_profile_type_t color_space)
+{
+  if(!pack->f || length > UINT32_MAX) return TRUE;
+
+  const _pack_record_t rec = { DT_MIPMAP_PACK_MAGIC, imgid, length, color_space };
+  if(fwrite(&rec, sizeof(rec), 1, pack->f) != 1
+     || (length && fwrite(data, length, 1, pack->f) != 1))
+  {
+    // whatever made it to the file is garbage now, stop appending and
+    // let closing rewrite the pack from the known records
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't write to `%s', disabling it", pack->path);
+    fclose(pack->f);
+    pack->f = NULL;
+    return TRUE;
+  }
+
+  _pack_apply(pack, &rec, pack->size);
+  pack->size += sizeof(rec) + length;
+  return FALSE;
+}
+
+static gboolean _pack_load_index(dt_mipmap_pack_t *pack,
+                                 const uint64_t file_size)
+{
+  gchar *contents = NULL;
+  gsize length = 0;
+  if(!g_file_get_contents(pack->index_path, &contents, &length, NULL))
+    return FALSE;
+
+  const _pack_index_header_t *header = (const _pack_index_header_t *)contents;
+  const gboolean valid = length >= sizeof(_pack_index_header_t)
+    && header->magic == DT_MIPMAP_PACK_INDEX_MAGIC
+    && header->version == DT_MIPMAP_PACK_INDEX_VERSION
+    && header->size <= file_size
+    && length == sizeof(_pack_index_header_t) + header->count * sizeof(_pack_index_entry_t);
+
+  if(valid)
+  {
+    const _pack_index_entry_t *entries = (const _pack_index_entry_t *)(header + 1);
+    for(uint64_t k = 0; k < header->count; k++)
+    {
+      if(entries[k].offset + entries[k].length > header->size) continue;
+      _pack_entry_t *entry = g_malloc(sizeof(_pack_entry_t));
+      entry->offset = entries[k].offset;
+      entry->length = entries[k].length;
+      entry->color_space = entries[k].color_space;
+      g_hash_table_replace(pack->index, GINT_TO_POINTER(entries[k].imgid), entry);
+    }
+    pack->size = header->size;
+    pack->dead = header->dead;
+  }
+
+  g_free(contents);
+  return valid;
+}
+
+static void _pack_save_index(dt_mipmap_pack_t *pack)
+{
+  const guint count = g_hash_table_size(pack->index);
+  const size_t length = sizeof(_pack_index_header_t) + count * sizeof(_pack_index_entry_t);
+  _pack_index_header_t *header = g_malloc0(length);
+  header->magic = DT_MIPMAP_PACK_INDEX_MAGIC;
+  header->version = DT_MIPMAP_PACK_INDEX_VERSION;
+  header->size = pack->size;
+  header->dead = pack->dead;
+  header->count = count;
+
+  _pack_index_entry_t *out = (_pack_index_entry_t *)(header + 1);
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, pack->index);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    const _pack_entry_t *entry = value;
+    out->imgid = GPOINTER_TO_INT(key);
+    out->color_space = entry->color_space;
+    out->length = entry->length;
+    out->offset = entry->offset;
+    out++;
+  }
+
+  GError *error = NULL;
+  if(!g_file_set_contents(pack->index_path, (const gchar *)header, length, &error))
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't write `%s': %s",
+             pack->index_path, error->message);
+  g_clear_error(&error);
+  g_free(header);
+}
+
+static gint _sort_imgid(gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+}
+
+// the pack is left as it is when it can't be compacted, possibly with a
+// broken tail after the known records. that is accounted as dead space so
+// that records appended after it are indexed at the offsets they land at.
+static void _pack_skip_tail(dt_mipmap_pack_t *pack)
+{
+  GStatBuf st;
+  if(!pack->f || fflush(pack->f) || g_stat(pack->path, &st)) return;
+  const uint64_t file_size = st.st_size;
+  if(file_size > pack->size)
+  {
+    pack->dead += file_size - pack->size;
+    pack->size = file_size;
+  }
+}
+
+// rewrite the pack with the live records only, in imgid order which
+// is also the usual order of a collection
+static void _pack_compact(dt_mipmap_pack_t *pack)
+{
+  if(!_pack_mapped(pack, 0, pack->size) && pack->size)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't map `%s' for compacting", pack->path);
+    _pack_skip_tail(pack);
+    return;
+  }
+
+  gchar *tmp_path = g_strdup_printf("%s.tmp", pack->path);
+  FILE *f = g_fopen(tmp_path, "wb");
+  if(!f)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't create `%s' for compacting", tmp_path);
+    g_free(tmp_path);
+    _pack_skip_tail(pack);
+    return;
+  }
+
+  const uint8_t *base = (const uint8_t *)g_mapped_file_get_contents(pack->map);
+  GList *imgids = g_list_sort(g_hash_table_get_keys(pack->index), _sort_imgid);
+  const guint count = g_list_length(imgids);
+  uint64_t *offsets = g_malloc_n(count + 1, sizeof(uint64_t));
+  uint64_t size = 0;
+  gboolean error = FALSE;
+  int k = 0;
+  for(GList *l = imgids; l && !error; l = g_list_next(l), k++)
+  {
+    const _pack_entry_t *entry = g_hash_table_lookup(pack->index, l->data);
+    const _pack_record_t rec = { DT_MIPMAP_PACK_MAGIC, GPOINTER_TO_INT(l->data),
+                                 entry->length, entry->color_space };
+    error = fwrite(&rec, sizeof(rec), 1, f) != 1
+         || fwrite(base + entry->offset, entry->length, 1, f) != 1;
+    offsets[k] = size + sizeof(rec);
+    size += sizeof(rec) + entry->length;
+  }
+  error |= fclose(f) != 0;
+
+  if(error)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't compact `%s'", pack->path);
+    g_unlink(tmp_path);
+    _pack_skip_tail(pack);
+  }
+  else
+  {
+    // the saved index refers to the old layout
+    g_unlink(pack->index_path);
+    if(pack->f) fclose(pack->f);
+    if(pack->map) g_mapped_file_unref(pack->map);
+    pack->map = NULL;
+    g_unlink(pack->path);
+    if(g_rename(tmp_path, pack->path))
+    {
+      dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't replace `%s', dropping its thumbnails",
+               pack->path);
+      g_hash_table_remove_all(pack->index);
+      size = 0;
+    }
+    else
+    {
+      k = 0;
+      for(GList *l = imgids; l; l = g_list_next(l), k++)
+      {
+        _pack_entry_t *entry = g_hash_table_lookup(pack->index, l->data);
+        entry->offset = offsets[k];
+      }
+    }
+    dt_print(DT_DEBUG_CACHE, "[mipmap_pack] compacted `%s' from %" PRIu64 " to %" PRIu64 " bytes",
+             pack->path, pack->size, size);
+    pack->size = size;
+    pack->dead = 0;
+    pack->f = g_fopen(pack->path, "ab");
+    _pack_remap(pack);
+    _pack_save_index(pack);
+  }
+
+  g_list_free(imgids);
+  g_free(offsets);
+  g_free(tmp_path);
+}
+
+// move the jpeg files of the directory layout into the pack
+static void _pack_migrate(dt_mipmap_pack_t *pack,
+                          const char *dir)
+{
+  GDir *gdir = g_dir_open(dir, 0, NULL);
+  if(!gdir) return;
+
+  int migrated = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(gdir)))
+  {
+    if(!g_str_has_suffix(name, ".jpg") && !g_str_has_suffix(name, ".qoi")) continue;
+    const dt_imgid_t imgid = strtol(name, NULL, 10);
+    gchar *filename = g_build_filename(dir, name, NULL);
+    gchar *contents = NULL;
+    gsize length = 0;
+    // the color space of these is found in the thumbnails themselves
+    if(imgid > 0
+       && !g_hash_table_contains(pack->index, GINT_TO_POINTER(imgid))
+       && g_file_get_contents(filename, &contents, &length, NULL)
+       && length > 0
+       && !_pack_append(pack, imgid, (const uint8_t *)contents, length, DT_COLORSPACE_NONE))
+      migrated++;
+    if(pack->f) g_unlink(filename);
+    g_free(contents);
+    g_free(filename);
+  }
+  g_dir_close(gdir);
+
+  if(pack->f)
+  {
+    fflush(pack->f);
+    g_rmdir(dir);
+  }
+  if(migrated)
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] moved %d thumbnails from `%s' to `%s'",
+             migrated, dir, pack->path);
+}
+
+static void _pack_free(dt_mipmap_pack_t *pack)
+{
+  if(pack->f) fclose(pack->f);
+  if(pack->map) g_mapped_file_unref(pack->map);
+  g_hash_table_destroy(pack->index);
+  dt_pthread_mutex_destroy(&pack->lock);
+  free(pack);
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *cachedir,
+                                      const int level,
+                                      const char *migrate_dir)
+{
+  char dirname[PATH_MAX] = { 0 };
+  snprintf(dirname, sizeof(dirname), "%s.d", cachedir);
+  if(g_mkdir_with_parents(dirname, 0750))
+    return NULL;
+
+  dt_mipmap_pack_t *pack = calloc(1, sizeof(dt_mipmap_pack_t));
+  snprintf(pack->path, sizeof(pack->path), "%s/%d.pack", dirname, level);
+  snprintf(pack->index_path, sizeof(pack->index_path), "%s/%d.idx", dirname, level);
+  dt_pthread_mutex_init(&pack->lock, NULL);
+  pack->index = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+  GStatBuf st;
+  const uint64_t file_size = g_stat(pack->path, &st) ? 0 : st.st_size;
+  pack->f = g_fopen(pack->path, "ab");
+  _pack_remap(pack);
+  if(!pack->f || (file_size && !pack->map))
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] can't open `%s'", pack->path);
+    _pack_free(pack);
+    return NULL;
+  }
+
+  // the index is up to date for everything but what a crashed session
+  // appended, read the remaining records from the pack itself
+  if(!_pack_load_index(pack, file_size))
+  {
+    g_hash_table_remove_all(pack->index);
+    pack->size = pack->dead = 0;
+  }
+  const uint64_t indexed = pack->size;
+  if(!_pack_scan(pack, indexed))
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[mipmap_pack] `%s' has a broken tail at %" PRIu64 ", repairing",
+             pack->path, pack->size);
+    _pack_compact(pack);
+  }
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] opened `%s' with %u thumbnails, %" PRIu64 " of %"
+           PRIu64 " bytes scanned", pack->path, g_hash_table_size(pack->index),
+           pack->size - indexed, pack->size);
+
+  if(migrate_dir) _pack_migrate(pack, migrate_dir);
+  return pack;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+
+  if(pack->map && (!pack->f || pack->dead > pack->size / 2))
+    _pack_compact(pack);
+  else if(pack->f)
+    _pack_save_index(pack);
+
+  _pack_free(pack);
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack,
+                                 const dt_imgid_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const gboolean found = g_hash_table_contains(pack->index, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&pack->lock);
+  return found;
+}
+
+gboolean dt_mipmap_pack_read(dt_mipmap_pack_t *pack,
+                             const dt_imgid_t imgid,
+                             dt_mipmap_pack_blob_t *blob)
+{
+  memset(blob, 0, sizeof(dt_mipmap_pack_blob_t));
+
+  dt_pthread_mutex_lock(&pack->lock);
+  const _pack_entry_t *entry = g_hash_table_lookup(pack->index, GINT_TO_POINTER(imgid));
+  if(entry && _pack_mapped(pack, entry->offset, entry->length))
+  {
+    // the reference keeps the data valid even if the pack is remapped meanwhile
+    blob->map = g_mapped_file_ref(pack->map);
+    blob->data = (const uint8_t *)g_mapped_file_get_contents(pack->map) + entry->offset;
+    blob->length = entry->length;
+    blob->color_space = entry->color_space;
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+  return blob->map != NULL;
+}
+
+void dt_mipmap_pack_release(dt_mipmap_pack_blob_t *blob)
+{
+  if(blob->map) g_mapped_file_unref(blob->map);
+  blob->map = NULL;
+  blob->data = NULL;
+}
+
+gboolean dt_mipmap_pack_write(dt_mipmap_pack_t *pack,
+                              const dt_imgid_t imgid,
+                              const uint8_t *data,
+                              const size_t length,
+                              const dt_colorspaces_color_profile_type_t color_space)
+{
+  if(!length) return TRUE;
+
+  dt_pthread_mutex_lock(&pack->lock);
+  // readers may remap right away, so the record has to be in the file
+  const gboolean error = _pack_append(pack, imgid, data, length, color_space)
+    || fflush(pack->f);
+  dt_pthread_mutex_unlock(&pack->lock);
+  return error;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack,
+                           const dt_imgid_t imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->index, GINT_TO_POINTER(imgid))
+     && !_pack_append(pack, imgid, NULL, 0, DT_COLORSPACE_NONE))
+    fflush(pack->f);
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack,
+                         const dt_imgid_t dst_imgid,
+                         const dt_imgid_t src_imgid)
+{
+  dt_pthread_mutex_lock(&pack->lock);
+  const _pack_entry_t *entry = g_hash_table_lookup(pack->index, GINT_TO_POINTER(src_imgid));
+  if(entry && _pack_mapped(pack, entry->offset, entry->length))
+  {
+    // appending doesn't touch the mapping, no need to copy the payload first
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(pack->map) + entry->offset;
+    if(!_pack_append(pack, dst_imgid, data, entry->length, entry->color_space))
+      fflush(pack->f);
+  }
+  dt_pthread_mutex_unlock(&pack->lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
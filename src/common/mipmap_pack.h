@@ -0,0 +1,97 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+#include "common/darktable.h"
+
+/* Thumbnail pack files for the mipmap disk backend.
+
+   Instead of one jpeg file per image and mip level all thumbnails of a
+   level are appended to a single `<level>.pack` file. Each record is a
+   small header followed by the compressed thumbnail, a removal appends
+   a header without payload. The pack is memory mapped for reading.
+
+   The imgid -> record map is kept in memory and saved to `<level>.idx`
+   on close. The index remembers up to where it covers the pack, so
+   records appended by a session that did not close cleanly are found
+   by scanning the tail. Space of replaced and removed records is given
+   back by rewriting the pack on close once it is mostly dead.
+
+   When opened for the first time, the `<level>/<imgid>.jpg` and `.qoi`
+   files of the directory layout are imported and removed.
+*/
+
+typedef struct dt_mipmap_pack_t
+{
+  char path[PATH_MAX];       // the pack, <cachedir>.d/<level>.pack
+  char index_path[PATH_MAX]; // the saved index, <cachedir>.d/<level>.idx
+  dt_pthread_mutex_t lock;
+  FILE *f;                   // for appending
+  GMappedFile *map;          // for reading, remapped once records are past its end
+  GHashTable *index;         // imgid -> record
+  uint64_t size;             // bytes of valid records in the pack
+  uint64_t dead;             // bytes taken by replaced or removed records
+} dt_mipmap_pack_t;
+
+// a thumbnail read from a pack, valid until dt_mipmap_pack_release()
+typedef struct dt_mipmap_pack_blob_t
+{
+  const uint8_t *data;
+  size_t length;
+  dt_colorspaces_color_profile_type_t color_space;
+  GMappedFile *map;
+} dt_mipmap_pack_blob_t;
+
+// open or create the pack for a mip level, migrating thumbnail files from
+// migrate_dir if that exists. returns NULL if the pack can't be used.
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *cachedir,
+                                      const int level,
+                                      const char *migrate_dir);
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack,
+                                 const dt_imgid_t imgid);
+
+// returns TRUE if a thumbnail was found
+gboolean dt_mipmap_pack_read(dt_mipmap_pack_t *pack,
+                             const dt_imgid_t imgid,
+                             dt_mipmap_pack_blob_t *blob);
+void dt_mipmap_pack_release(dt_mipmap_pack_blob_t *blob);
+
+// append a thumbnail replacing any older one, returns TRUE on error
+gboolean dt_mipmap_pack_write(dt_mipmap_pack_t *pack,
+                              const dt_imgid_t imgid,
+                              const uint8_t *data,
+                              const size_t length,
+                              const dt_colorspaces_color_profile_type_t color_space);
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack,
+                           const dt_imgid_t imgid);
+
+// give dst_imgid the thumbnail of src_imgid
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack,
+                         const dt_imgid_t dst_imgid,
+                         const dt_imgid_t src_imgid);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -487,6 +487,60 @@ static gboolean _opencl_read_device_config(const int devid)
   return !existing_device || !safety_ok;
 }
 
+// kernels of a device built in parallel, the workers take the next program
+typedef struct _opencl_build_t
+{
+  int dev;
+  const char *kerneldir;
+  const char *cachedir;
+  char **includemd5;
+  GPtrArray *names;   // program file names from programs.conf
+  GArray *progs;      // and their numbers
+  dt_atomic_int next;
+  dt_atomic_int failed;
+  dt_atomic_int cached;
+  dt_atomic_int missing;
+} _opencl_build_t;
+
+static void *_opencl_build_worker(void *data)
+{
+  _opencl_build_t *build = (_opencl_build_t *)data;
+  char filename[PATH_MAX] = { 0 };
+  char binname[PATH_MAX] = { 0 };
+
+  while(!dt_atomic_get_int(&build->failed))
+  {
+    const int n = dt_atomic_add_int(&build->next, 1);
+    if(n >= (int)build->names->len) break;
+
+    const char *programname = g_ptr_array_index(build->names, n);
+    const int prog = g_array_index(build->progs, int, n);
+    snprintf(filename, sizeof(filename),
+             "%s" G_DIR_SEPARATOR_S "%s", build->kerneldir, programname);
+    snprintf(binname, sizeof(binname),
+             "%s" G_DIR_SEPARATOR_S "%s.bin", build->cachedir, programname);
+    dt_print_nts(DT_DEBUG_OPENCL | DT_DEBUG_VERBOSE,
+             "[dt_opencl_device_init] testing program `%s'\n", programname);
+    gboolean loaded_cached;
+    char md5sum[33];
+    if(!_opencl_load_program(build->dev, prog, programname, filename, binname,
+                             build->cachedir, md5sum, build->includemd5, &loaded_cached))
+    {
+      dt_atomic_add_int(&build->missing, 1);
+      continue;
+    }
+    if(_opencl_build_program(build->dev, prog, binname, build->cachedir, md5sum, loaded_cached))
+    {
+      dt_print_nts(DT_DEBUG_OPENCL,
+               "[dt_opencl_device_init] failed to compile program `%s'\n", programname);
+      dt_atomic_set_int(&build->failed, 1);
+      break;
+    }
+    if(loaded_cached) dt_atomic_add_int(&build->cached, 1);
+  }
+  return NULL;
+}
+
 // returns 0 if all ok or an error if we failed to init this device
 static gboolean _opencl_device_init(dt_opencl_t *cl,
                                     const int dev,
@@ -581,7 +635,6 @@ static gboolean _opencl_device_init(dt_opencl_t *cl,
   char kerneldir[PATH_MAX] = { 0 };
   char *filename = calloc(PATH_MAX, sizeof(char));
   char *confentry = calloc(PATH_MAX, sizeof(char));
-  char *binname = calloc(PATH_MAX, sizeof(char));
 
   dt_pthread_mutex_init(&cl->dev[dev].lock, NULL);
 
@@ -1054,11 +1107,19 @@ static gboolean _opencl_device_init(dt_opencl_t *cl,
   }
 
   // now load all darktable cl kernels.
-  // TODO: compile as a job?
   double tstart = dt_get_debug_wtime();
+  // the statistics are kept without debug output too
+  const double programs_start = dt_get_wtime();
   FILE *f = g_fopen(filename, "rb");
   if(f)
   {
+    _opencl_build_t build = { .dev = dev,
+                              .kerneldir = kerneldir,
+                              .cachedir = cachedir,
+                              .includemd5 = includemd5 };
+    build.names = g_ptr_array_new_with_free_func(g_free);
+    build.progs = g_array_new(FALSE, FALSE, sizeof(int));
+
     while(!feof(f))
     {
       int prog = -1;
@@ -1102,35 +1163,48 @@ static gboolean _opencl_device_init(dt_opencl_t *cl,
         dt_print_nts(DT_DEBUG_OPENCL,
                  "[dt_opencl_device_init] malformed entry in programs.conf `%s';"
                  " ignoring it\n", confentry);
-        continue;
-      }
-
-      snprintf(filename, PATH_MAX * sizeof(char),
-               "%s" G_DIR_SEPARATOR_S "%s", kerneldir, programname);
-      snprintf(binname, PATH_MAX * sizeof(char),
-               "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
-      dt_print_nts(DT_DEBUG_OPENCL | DT_DEBUG_VERBOSE,
-               "[dt_opencl_device_init] testing program `%s'\n", programname);
-      gboolean loaded_cached;
-      char md5sum[33];
-      if(_opencl_load_program(dev, prog, programname, filename, binname, cachedir,
-                              md5sum, includemd5, &loaded_cached)
-         && _opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached))
-      {
-        dt_print_nts(DT_DEBUG_OPENCL,
-                 "[dt_opencl_device_init] failed to compile program `%s'\n", programname);
-        fclose(f);
         g_strfreev(tokens);
-        res = TRUE;
-        goto end;
+        continue;
       }
 
+      g_ptr_array_add(build.names, g_strdup(programname));
+      g_array_append_val(build.progs, prog);
       g_strfreev(tokens);
     }
-
     fclose(f);
+
+    // the programs are independent, so they are loaded and built by
+    // several threads with this one taking part
+    const int nthreads = dt_conf_get_bool("opencl_parallel_build")
+      ? MAX(1, MIN((int)dt_get_num_procs(), (int)build.names->len))
+      : 1;
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    int started = 0;
+    for(; threads && started < nthreads - 1; started++)
+      if(dt_pthread_create(&threads[started], _opencl_build_worker, &build)) break;
+    _opencl_build_worker(&build);
+    for(int k = 0; k < started; k++)
+      dt_pthread_join(threads[k]);
+    free(threads);
+
+    const gboolean failed = dt_atomic_get_int(&build.failed);
+    const int loaded = build.names->len - dt_atomic_get_int(&build.missing);
+    cl->dev[dev].programs_cached = dt_atomic_get_int(&build.cached);
+    cl->dev[dev].programs_built = loaded - cl->dev[dev].programs_cached;
+    cl->dev[dev].programs_time = dt_get_wtime() - programs_start;
+    g_ptr_array_free(build.names, TRUE);
+    g_array_free(build.progs, TRUE);
+
+    if(failed)
+    {
+      res = TRUE;
+      goto end;
+    }
+
     dt_print_nts(DT_DEBUG_OPENCL,
-                 "   KERNEL LOADING TIME:      %.4lf sec\n", dt_get_lap_time(&tstart));
+                 "   KERNEL LOADING TIME:      %.4lf sec (%d cached, %d built, %d threads)\n",
+                 dt_get_lap_time(&tstart), cl->dev[dev].programs_cached,
+                 cl->dev[dev].programs_built, started + 1);
   }
   else
   {
@@ -1168,7 +1242,6 @@ end:
 
   free(filename);
   free(confentry);
-  free(binname);
 
   return res;
 }
@@ -2555,13 +2628,12 @@ static gboolean _opencl_build_program(const int dev,
     {
       if(cl->dev[dev].devid == devices[i])
       {
-        char dup[PATH_MAX] = { 0 };
-        g_strlcpy(dup, binname, sizeof(dup));
-        char *bname = basename(dup);
-
         // save opencl compiled binary as md5sum-named file
         char filename[PATH_MAX] = { 0 };
 #if defined(_WIN32)
+        char dup[PATH_MAX] = { 0 };
+        g_strlcpy(dup, binname, sizeof(dup));
+        char *bname = basename(dup);
         snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "%s.%s",
                  cachedir, bname, md5sum);
 #else
@@ -2575,12 +2647,10 @@ static gboolean _opencl_build_program(const int dev,
         fclose(f);
 
 #if !defined(_WIN32)
-        // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328)
-        char cwd[PATH_MAX] = { 0 };
-        if(!getcwd(cwd, sizeof(cwd))) goto ret;
-        if(chdir(cachedir) != 0) goto ret;
-        if(symlink(md5sum, bname) != 0) goto ret;
-        if(chdir(cwd) != 0) goto ret;
+        // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328).
+        // the target is relative to the link, so there is no need to chdir()
+        // which would affect the other threads building programs
+        if(symlink(md5sum, binname) != 0) goto ret;
 #endif //!defined(_WIN32)
       }
     }
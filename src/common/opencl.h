@@ -205,6 +205,12 @@ typedef struct dt_opencl_device_t
 
   // lets keep the vendor for runtime checks
   int vendor_id;
+
+  // programs loaded from the binary cache and compiled at init, and the
+  // time it took
+  int programs_cached;
+  int programs_built;
+  double programs_time;
 } dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
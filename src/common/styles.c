@@ -28,6 +28,7 @@
 #include "common/image_cache.h"
 #include "common/tags.h"
 #include "control/control.h"
+#include "control/jobs/control_jobs.h"
 #include "develop/develop.h"
 #include "gui/accelerators.h"
 #include "gui/styles.h"
@@ -806,202 +807,339 @@ void dt_styles_apply_style_item(dt_develop_t *dev,
   }
 }
 
-void _styles_apply_to_image_ext(const char *name,
-                                const gboolean duplicate,
-                                const gboolean overwrite,
-                                const dt_imgid_t imgid,
-                                const gboolean undo)
+// a style read from the database once, to be applied to any number of images
+typedef struct _style_prepared_t
 {
-  sqlite3_stmt *stmt;
+  gchar *name;
+  GList *iop_list;   // the module order of the style, NULL if it has none
+  GList *items;      // the dt_style_item_t of the style
+  guint tagid;       // darktable|style|<name>
+  gboolean tagged;
+} _style_prepared_t;
+
+struct dt_styles_batch_t
+{
+  GList *styles;     // _style_prepared_t
+  guint changed_tagid;
+  gboolean changed_tagged;
+  GList *imgs;       // the images changed, updated by dt_styles_batch_end()
+};
+
+static dt_style_item_t *_style_item_copy(const dt_style_item_t *item)
+{
+  dt_style_item_t *copy = malloc(sizeof(dt_style_item_t));
+  *copy = *item;
+  copy->name = g_strdup(item->name);
+  copy->operation = g_strdup(item->operation);
+  copy->multi_name = g_strdup(item->multi_name);
+  copy->params = malloc(item->params_size);
+  memcpy(copy->params, item->params, item->params_size);
+  copy->blendop_params = malloc(item->blendop_params_size);
+  memcpy(copy->blendop_params, item->blendop_params, item->blendop_params_size);
+  return copy;
+}
+
+static void _style_prepared_free(gpointer data)
+{
+  _style_prepared_t *style = data;
+  g_free(style->name);
+  g_list_free_full(style->iop_list, g_free);
+  g_list_free_full(style->items, dt_style_item_free);
+  free(style);
+}
 
+static _style_prepared_t *_style_prepare(const char *name)
+{
   const int style_id = dt_styles_get_id_by_name(name);
+  if(style_id == 0) return NULL;
+
+  _style_prepared_t *style = calloc(1, sizeof(_style_prepared_t));
+  style->name = g_strdup(name);
+  style->iop_list = dt_styles_module_order_list(name);
+
+  // go through all entries in style
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "SELECT num, module, operation, op_params, enabled,"
+     "       blendop_params, blendop_version, multi_priority,"
+     "       multi_name, multi_name_hand_edited"
+     " FROM data.style_items WHERE styleid=?1 "
+     " ORDER BY operation, multi_priority",
+     -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, style_id);
 
-  if(style_id != 0)
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    dt_imgid_t newimgid = NO_IMGID;
+    dt_style_item_t *style_item = malloc(sizeof(dt_style_item_t));
+
+    style_item->num = sqlite3_column_int(stmt, 0);
+    style_item->selimg_num = 0;
+    style_item->enabled = sqlite3_column_int(stmt, 4);
+    style_item->multi_priority = sqlite3_column_int(stmt, 7);
+    style_item->name = NULL;
+    style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
+    style_item->multi_name_hand_edited = sqlite3_column_int(stmt, 9);
+    // see dt_iop_get_instance_name() for why multi_name is handled this way
+    style_item->multi_name =
+      g_strdup((style_item->multi_priority > 0 || style_item->multi_name_hand_edited)
+               ? (char *)sqlite3_column_text(stmt, 8)
+               : "");
+    style_item->module_version = sqlite3_column_int(stmt, 1);
+    style_item->blendop_version = sqlite3_column_int(stmt, 6);
+    style_item->params_size = sqlite3_column_bytes(stmt, 3);
+    style_item->params = (void *)malloc(style_item->params_size);
+    memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3),
+           style_item->params_size);
+    style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
+    style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
+    memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5),
+           style_item->blendop_params_size);
+    style_item->iop_order = 0;
+
+    style->items = g_list_prepend(style->items, style_item);
+  }
+  sqlite3_finalize(stmt);
+  style->items = g_list_reverse(style->items); // list was built in reverse order, so un-reverse it
 
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
+  gchar ntag[512] = { 0 };
+  gchar *local_name = dt_util_localize_segmented_name(name, FALSE);
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", local_name);
+  g_free(local_name);
+  style->tagged = dt_tag_new(ntag, &style->tagid);
+
+  return style;
+}
+
+// apply a prepared style, with a batch the thumbnail update is left to
+// dt_styles_batch_apply() and the aspect ratio and sidecar updates to
+// dt_styles_batch_end()
+static void _style_apply_prepared(const _style_prepared_t *style,
+                                  const gboolean duplicate,
+                                  const gboolean overwrite,
+                                  const dt_imgid_t imgid,
+                                  const gboolean undo,
+                                  dt_styles_batch_t *batch)
+{
+  dt_imgid_t newimgid = NO_IMGID;
+
+  /* check if we should make a duplicate before applying style */
+  if(duplicate)
+  {
+    newimgid = dt_image_duplicate(imgid);
+    if(dt_is_valid_imgid(newimgid))
     {
-      newimgid = dt_image_duplicate(imgid);
-      if(dt_is_valid_imgid(newimgid))
-      {
-        if(overwrite)
-          dt_history_delete_on_image_ext(newimgid, FALSE, TRUE);
-        else
-          dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE, TRUE, TRUE);
-      }
+      if(overwrite)
+        dt_history_delete_on_image_ext(newimgid, FALSE, TRUE);
+      else
+        dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE, TRUE, TRUE);
     }
-    else
-      newimgid = imgid;
+  }
+  else
+    newimgid = imgid;
 
-    // now deal with the history
-    GList *modules_used = NULL;
+  // now deal with the history
+  GList *modules_used = NULL;
 
-    dt_develop_t _dev_dest = { 0 };
+  dt_develop_t _dev_dest = { 0 };
 
-    dt_develop_t *dev_dest = &_dev_dest;
+  dt_develop_t *dev_dest = &_dev_dest;
 
-    dt_dev_init(dev_dest, FALSE);
+  dt_dev_init(dev_dest, FALSE);
 
-    dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
-    dev_dest->image_storage.id = imgid;
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+  dev_dest->image_storage.id = imgid;
 
-    // now let's deal with the iop-order (possibly merging style & target lists)
-    GList *iop_list = dt_styles_module_order_list(name);
-    if(iop_list)
-    {
-      // the style has an iop-order, we need to merge the multi-instance from target image
-      // get target image iop-order list:
-      GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
-      // get multi-instance modules if any:
-      GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
-      // if some where found merge them with the style list
-      if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
-      // finally we have the final list for the image
-      dt_ioppr_write_iop_order_list(iop_list, newimgid);
-      g_list_free_full(iop_list, g_free);
-      g_list_free_full(img_iop_order_list, g_free);
-      g_list_free_full(mi, g_free);
-    }
+  // now let's deal with the iop-order (possibly merging style & target lists)
+  if(style->iop_list)
+  {
+    GList *iop_list = dt_ioppr_iop_order_copy_deep(style->iop_list);
+    // the style has an iop-order, we need to merge the multi-instance from target image
+    // get target image iop-order list:
+    GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
+    // get multi-instance modules if any:
+    GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
+    // if some where found merge them with the style list
+    if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
+    // finally we have the final list for the image
+    dt_ioppr_write_iop_order_list(iop_list, newimgid);
+    g_list_free_full(iop_list, g_free);
+    g_list_free_full(img_iop_order_list, g_free);
+    g_list_free_full(mi, g_free);
+  }
 
-    dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
+  dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
 
-    dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
+  dt_dev_pop_history_items_ext(dev_dest, dev_dest->history_end);
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
 
-    dt_print(DT_DEBUG_IOPORDER | DT_DEBUG_PIPE,
-             "[styles_apply_to_image_ext] Apply `%s' on ID=%i, history size %i",
-             name, newimgid, dev_dest->history_end);
+  dt_print(DT_DEBUG_IOPORDER | DT_DEBUG_PIPE,
+           "[styles_apply_to_image_ext] Apply `%s' on ID=%i, history size %i",
+           style->name, newimgid, dev_dest->history_end);
 
-    // go through all entries in style
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2
-      (dt_database_get(darktable.db),
-       "SELECT num, module, operation, op_params, enabled,"
-       "       blendop_params, blendop_version, multi_priority,"
-       "       multi_name, multi_name_hand_edited"
-       " FROM data.style_items WHERE styleid=?1 "
-       " ORDER BY operation, multi_priority",
-       -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, style_id);
+  // the items get the multi-priority and order of this image, so work on a copy
+  GList *si_list = NULL;
+  for(const GList *l = style->items; l; l = g_list_next(l))
+    si_list = g_list_prepend(si_list, _style_item_copy(l->data));
+  si_list = g_list_reverse(si_list);
 
-    GList *si_list = NULL;
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      dt_style_item_t *style_item = malloc(sizeof(dt_style_item_t));
-
-      style_item->num = sqlite3_column_int(stmt, 0);
-      style_item->selimg_num = 0;
-      style_item->enabled = sqlite3_column_int(stmt, 4);
-      style_item->multi_priority = sqlite3_column_int(stmt, 7);
-      style_item->name = NULL;
-      style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
-      style_item->multi_name_hand_edited = sqlite3_column_int(stmt, 9);
-      // see dt_iop_get_instance_name() for why multi_name is handled this way
-      style_item->multi_name =
-        g_strdup((style_item->multi_priority > 0 || style_item->multi_name_hand_edited)
-                 ? (char *)sqlite3_column_text(stmt, 8)
-                 : "");
-      style_item->module_version = sqlite3_column_int(stmt, 1);
-      style_item->blendop_version = sqlite3_column_int(stmt, 6);
-      style_item->params_size = sqlite3_column_bytes(stmt, 3);
-      style_item->params = (void *)malloc(style_item->params_size);
-      memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3),
-             style_item->params_size);
-      style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
-      style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
-      memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5),
-             style_item->blendop_params_size);
-      style_item->iop_order = 0;
-
-      si_list = g_list_prepend(si_list, style_item);
-    }
-    sqlite3_finalize(stmt);
-    si_list = g_list_reverse(si_list); // list was built in reverse order, so un-reverse it
+  dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
+
+  for(GList *l = si_list; l; l = g_list_next(l))
+  {
+    dt_style_item_t *style_item = l->data;
+    dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
+  }
 
-    dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
+  g_list_free_full(si_list, dt_style_item_free);
 
-    for(GList *l = si_list; l; l = g_list_next(l))
-    {
-      dt_style_item_t *style_item = l->data;
-      dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
-    }
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
 
-    g_list_free_full(si_list, dt_style_item_free);
+  dt_undo_lt_history_t *hist = NULL;
+  if(undo)
+  {
+    hist = dt_history_snapshot_item_init();
+    hist->imgid = newimgid;
+    dt_history_snapshot_undo_create
+      (hist->imgid, &hist->before, &hist->before_history_end);
+  }
 
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
+  // write history and forms to db
+  dt_dev_write_history_ext(dev_dest, newimgid);
 
-    dt_undo_lt_history_t *hist = NULL;
-    if(undo)
-    {
-      hist = dt_history_snapshot_item_init();
-      hist->imgid = newimgid;
-      dt_history_snapshot_undo_create
-        (hist->imgid, &hist->before, &hist->before_history_end);
-    }
+  if(undo)
+  {
+    dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
+    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
+                   dt_history_snapshot_undo_pop,
+                   dt_history_snapshot_undo_lt_history_data_free);
+    dt_undo_end_group(darktable.undo);
+  }
 
-    // write history and forms to db
-    dt_dev_write_history_ext(dev_dest, newimgid);
+  dt_dev_cleanup(dev_dest);
 
-    if(undo)
-    {
-      dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
-      dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-      dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
-                     dt_history_snapshot_undo_pop,
-                     dt_history_snapshot_undo_lt_history_data_free);
-      dt_undo_end_group(darktable.undo);
-    }
+  g_list_free(modules_used);
 
-    dt_dev_cleanup(dev_dest);
+  /* add tag */
+  if(style->tagged) dt_tag_attach(style->tagid, newimgid, FALSE, FALSE);
+  guint tagid = batch ? batch->changed_tagid : 0;
+  const gboolean changed_tagged = batch
+    ? batch->changed_tagged
+    : dt_tag_new("darktable|changed", &tagid);
+  if(changed_tagged)
+  {
+    dt_tag_attach(tagid, newimgid, FALSE, FALSE);
+    dt_image_cache_set_change_timestamp(imgid);
+  }
 
-    g_list_free(modules_used);
+  /* if current image in develop reload history */
+  if(dt_dev_is_current_image(darktable.develop, newimgid))
+  {
+    dt_dev_reload_history_items(darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop,
+                            dt_dev_modulegroups_get(darktable.develop));
+  }
 
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    gchar *local_name = dt_util_localize_segmented_name(name, FALSE);
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", local_name);
-    g_free(local_name);
+  dt_image_update_final_size(newimgid);
 
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, newimgid, FALSE, FALSE);
-    if(dt_tag_new("darktable|changed", &tagid))
-    {
-      dt_tag_attach(tagid, newimgid, FALSE, FALSE);
-      dt_image_cache_set_change_timestamp(imgid);
-    }
+  if(batch)
+  {
+    // computing the aspect ratio needs a thumbnail, leave it to the end
+    dt_image_reset_aspect_ratio(newimgid, FALSE);
+    // all styles of the batch are applied to an image in a row, so it is
+    // already at the head of the list unless each style made a duplicate
+    if(!batch->imgs || GPOINTER_TO_INT(batch->imgs->data) != newimgid)
+      batch->imgs = g_list_prepend(batch->imgs, GINT_TO_POINTER(newimgid));
+    return;
+  }
 
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop,
-                              dt_dev_modulegroups_get(darktable.develop));
-    }
+  /* remove old obsolete thumbnails */
+  dt_mipmap_cache_remove(newimgid);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(newimgid);
-    dt_image_update_final_size(newimgid);
+  /* update the aspect ratio. recompute only if really needed for performance reasons */
+  if(darktable.collection->params.sorts[DT_COLLECTION_SORT_ASPECT_RATIO])
+    dt_image_set_aspect_ratio(newimgid, TRUE);
+  else
+    dt_image_reset_aspect_ratio(newimgid, TRUE);
 
-    /* update the aspect ratio. recompute only if really needed for performance reasons */
-    if(darktable.collection->params.sorts[DT_COLLECTION_SORT_ASPECT_RATIO])
-      dt_image_set_aspect_ratio(newimgid, TRUE);
-    else
-      dt_image_reset_aspect_ratio(newimgid, TRUE);
+  /* update xmp file */
+  dt_image_synch_xmp(newimgid);
 
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
+  /* redraw center view to update visible mipmaps */
+  DT_CONTROL_SIGNAL_RAISE(DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
+}
+
+void _styles_apply_to_image_ext(const char *name,
+                                const gboolean duplicate,
+                                const gboolean overwrite,
+                                const dt_imgid_t imgid,
+                                const gboolean undo)
+{
+  _style_prepared_t *style = _style_prepare(name);
+  if(!style) return;
+
+  _style_apply_prepared(style, duplicate, overwrite, imgid, undo, NULL);
+  _style_prepared_free(style);
+}
+
+dt_styles_batch_t *dt_styles_batch_begin(const GList *names)
+{
+  dt_styles_batch_t *batch = calloc(1, sizeof(dt_styles_batch_t));
+  for(const GList *l = names; l; l = g_list_next(l))
+  {
+    _style_prepared_t *style = _style_prepare((const char *)l->data);
+    if(style) batch->styles = g_list_prepend(batch->styles, style);
+  }
+  batch->styles = g_list_reverse(batch->styles);
+  batch->changed_tagged = dt_tag_new("darktable|changed", &batch->changed_tagid);
+  return batch;
+}
+
+void dt_styles_batch_apply(dt_styles_batch_t *batch,
+                           const gboolean duplicate,
+                           const gboolean overwrite,
+                           const dt_imgid_t imgid)
+{
+  const GList *done = batch->imgs;
+  for(const GList *l = batch->styles; l; l = g_list_next(l))
+    _style_apply_prepared(l->data, duplicate, overwrite, imgid, TRUE, batch);
 
+  // the thumbnails are updated right away, so none is stale while the
+  // rest of the batch is applied
+  for(const GList *l = batch->imgs; l != done; l = g_list_next(l))
+  {
+    const dt_imgid_t newimgid = GPOINTER_TO_INT(l->data);
+    /* remove old obsolete thumbnails */
+    dt_mipmap_cache_remove(newimgid);
     /* redraw center view to update visible mipmaps */
     DT_CONTROL_SIGNAL_RAISE(DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
   }
 }
 
+void dt_styles_batch_end(dt_styles_batch_t *batch)
+{
+  GList *imgs = g_list_reverse(batch->imgs);
+  if(imgs)
+  {
+    /* update xmp files */
+    dt_image_synch_xmps(imgs);
+
+    /* the aspect ratios are recomputed in the background if sorted by them */
+    if(darktable.collection->params.sorts[DT_COLLECTION_SORT_ASPECT_RATIO])
+      dt_control_update_aspect_ratios(g_list_copy(imgs));
+  }
+
+  g_list_free(imgs);
+  g_list_free_full(batch->styles, _style_prepared_free);
+  free(batch);
+}
+
 void dt_styles_apply_to_image(const char *name,
                               const gboolean duplicate,
                               const gboolean overwrite,
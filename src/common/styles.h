@@ -109,6 +109,17 @@ void dt_styles_apply_to_image(const char *name,
                               const gboolean overwrite,
                               const dt_imgid_t imgid);
 
+/** applies styles to many images: the styles are read once by _begin(), the thumbnails are
+    updated by _apply() and the aspect ratios and sidecars of the changed images once by _end() */
+typedef struct dt_styles_batch_t dt_styles_batch_t;
+dt_styles_batch_t *dt_styles_batch_begin(const GList *names);
+/** applies all styles of the batch to image by imgid, same as dt_styles_apply_to_image() */
+void dt_styles_batch_apply(dt_styles_batch_t *batch,
+                           const gboolean duplicate,
+                           const gboolean overwrite,
+                           const dt_imgid_t imgid);
+void dt_styles_batch_end(dt_styles_batch_t *batch);
+
 /** applies the style to the currently edited image in the darkroom.
     does nothing if not called with a proper dev struct initialized */
 void dt_styles_apply_to_dev(const char *name, const dt_imgid_t imgid);
@@ -0,0 +1,152 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/trace.h"
+
+// small sequential thread ids read better in the timeline than pthread ids
+static dt_atomic_int _next_tid;
+static __thread int _tid = 0;
+
+static int _thread_id(void)
+{
+  if(_tid == 0) _tid = dt_atomic_add_int(&_next_tid, 1) + 1;
+  return _tid;
+}
+
+gboolean dt_trace_init(const char *filename)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[dt_trace_init] can't open trace file `%s'", filename);
+    return TRUE;
+  }
+
+  dt_trace_t *trace = calloc(1, sizeof(dt_trace_t));
+  trace->file = f;
+  trace->first = TRUE;
+  dt_pthread_mutex_init(&trace->lock, NULL);
+  fputs("[\n", f);
+  darktable.trace = trace;
+
+  dt_trace_thread_name("main");
+  dt_print(DT_DEBUG_ALWAYS, "[dt_trace_init] writing trace to `%s'", filename);
+  return FALSE;
+}
+
+void dt_trace_cleanup(void)
+{
+  dt_trace_t *trace = darktable.trace;
+  if(!trace) return;
+
+  darktable.trace = NULL;
+  dt_pthread_mutex_lock(&trace->lock);
+  fputs("\n]\n", trace->file);
+  fclose(trace->file);
+  dt_pthread_mutex_unlock(&trace->lock);
+  dt_pthread_mutex_destroy(&trace->lock);
+  free(trace);
+}
+
+gchar *dt_trace_escape(const char *s)
+{
+  if(!s) return g_strdup("");
+
+  // only quotes, backslashes and control characters need escaping,
+  // UTF-8 is valid JSON as is
+  GString *out = g_string_sized_new(strlen(s));
+  for(const unsigned char *c = (const unsigned char *)s; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+    {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, *c);
+    }
+    else if(*c < 0x20)
+      g_string_append_printf(out, "\\u%04x", *c);
+    else
+      g_string_append_c(out, *c);
+  }
+  return g_string_free(out, FALSE);
+}
+
+static void _write_event(dt_trace_t *trace, const char *event)
+{
+  dt_pthread_mutex_lock(&trace->lock);
+  if(!trace->first) fputs(",\n", trace->file);
+  trace->first = FALSE;
+  fputs(event, trace->file);
+  fflush(trace->file);
+  dt_pthread_mutex_unlock(&trace->lock);
+}
+
+void dt_trace_span(const char *category,
+                   const char *name,
+                   const double start,
+                   const double end,
+                   const char *args,
+                   ...)
+{
+  dt_trace_t *trace = darktable.trace;
+  if(!trace) return;
+
+  gchar *vargs = NULL;
+  if(args)
+  {
+    va_list ap;
+    va_start(ap, args);
+    vargs = g_strdup_vprintf(args, ap);
+    va_end(ap);
+  }
+
+  // timestamps are in microseconds relative to the start of darktable
+  char ts[G_ASCII_DTOSTR_BUF_SIZE], dur[G_ASCII_DTOSTR_BUF_SIZE];
+  g_ascii_formatd(ts, sizeof(ts), "%.1f", (start - darktable.start_wtime) * 1e6);
+  g_ascii_formatd(dur, sizeof(dur), "%.1f", MAX(0.0, end - start) * 1e6);
+
+  gchar *ename = dt_trace_escape(name);
+  gchar *ecategory = dt_trace_escape(category);
+  gchar *event = g_strdup_printf("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                                 "\"ts\":%s,\"dur\":%s,\"pid\":1,\"tid\":%d,\"args\":{%s}}",
+                                 ename, ecategory, ts, dur, _thread_id(), vargs ? vargs : "");
+  _write_event(trace, event);
+  g_free(event);
+  g_free(ecategory);
+  g_free(ename);
+  g_free(vargs);
+}
+
+void dt_trace_thread_name(const char *name)
+{
+  dt_trace_t *trace = darktable.trace;
+  if(!trace) return;
+
+  gchar *ename = dt_trace_escape(name);
+  gchar *event = g_strdup_printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                                 "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                                 _thread_id(), ename);
+  _write_event(trace, event);
+  g_free(event);
+  g_free(ename);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,71 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/* Timeline tracing in the Chrome trace event format.
+
+   Started by `--trace <file>`, every span is appended to the file as a
+   complete ("X") event as soon as it is finished, so a trace is usable
+   even if darktable is killed. Load it into chrome://tracing or
+   https://ui.perfetto.dev to see how pipes and jobs overlap.
+
+   Spans carry their category (e.g. the pipe type), a name and an
+   optional set of arguments given as a JSON object body, like
+   "\"device\":\"CPU\",\"tiling\":false". User controlled strings
+   in the arguments, like image file names, go through
+   dt_trace_escape() first.
+*/
+
+typedef struct dt_trace_t
+{
+  FILE *file;
+  dt_pthread_mutex_t lock;
+  gboolean first;
+} dt_trace_t;
+
+// open the trace file, returns TRUE on error
+gboolean dt_trace_init(const char *filename);
+void dt_trace_cleanup(void);
+
+static inline gboolean dt_trace_enabled(void)
+{
+  return darktable.trace != NULL;
+}
+
+// record a span between two dt_get_wtime() timestamps
+void dt_trace_span(const char *category,
+                   const char *name,
+                   const double start,
+                   const double end,
+                   const char *args,
+                   ...) __attribute__((format(printf, 5, 6)));
+
+// give the calling thread a name shown in the timeline
+void dt_trace_thread_name(const char *name);
+
+// a copy of s usable inside a JSON string, free with g_free()
+gchar *dt_trace_escape(const char *s);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
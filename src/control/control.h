@@ -186,7 +186,8 @@ typedef struct dt_control_t
   dt_atomic_int quitting;
   dt_atomic_int pending_jobs;
   gboolean cups_started;
-  gboolean export_scheduled;
+  int32_t exports_scheduled; // export jobs currently running
+  int32_t max_exports;       // number of export jobs allowed to run concurrently
   dt_pthread_mutex_t queue_mutex, cond_mutex;
   pthread_cond_t cond;
   int32_t num_threads;
@@ -1789,6 +1789,8 @@ void dt_update_thumbs_thread(void *p)
   // return if any thumbcache dir is not writable
   for(dt_mipmap_size_t k = DT_MIPMAP_1; k <= DT_MIPMAP_LDR_MAX-1; k++)
   {
+    if(darktable.mipmap_cache->pack[k]) continue;
+
     char dirname[PATH_MAX] = { 0 };
     snprintf(dirname, sizeof(dirname), "%s.d/%d", darktable.mipmap_cache->cachedir, k);
     if(g_mkdir_with_parents(dirname, 0750))
@@ -18,6 +18,8 @@
 
 #include "control/jobs.h"
 #include "control/control.h"
+#include "control/conf.h"
+#include "common/trace.h"
 
 #define DT_CONTROL_FG_PRIORITY 4
 #define DT_CONTROL_MAX_JOBS 30
@@ -54,6 +56,7 @@ typedef struct _dt_job_t
   char description[DT_CONTROL_DESCRIPTION_LEN];
   dt_view_type_flags_t view_creator;
   gboolean is_synchronous;
+  double queued_time;
 } _dt_job_t;
 
 /** check if two jobs are to be considered equal. a simple memcmp won't work since the mutexes probably won't
@@ -88,6 +91,8 @@ static void _control_job_set_state(_dt_job_t *job,
     job->progress = NULL;
   }
   job->state = state;
+  if(state == DT_JOB_STATE_QUEUED && dt_trace_enabled())
+    job->queued_time = dt_get_wtime();
   /* pass state change to callback */
   if(job->state_changed_cb) job->state_changed_cb(job, state);
   dt_pthread_mutex_unlock(&job->state_mutex);
@@ -196,6 +201,17 @@ static void _control_job_print(_dt_job_t *job, const char *info, const char *err
 }
 
 
+// the time spent waiting in the queue shows stalls, the run span itself is
+// lined up with the pipes processed by the job
+static void _control_job_trace(const _dt_job_t *job, const double start)
+{
+  if(!dt_trace_enabled()) return;
+  const double waited = job->queued_time > 0.0 ? start - job->queued_time : 0.0;
+  dt_trace_span("job", job->description, start, dt_get_wtime(),
+                "\"queue\":\"%s\",\"priority\":%d,\"queued_us\":%d,\"result\":%d",
+                _queuename(job->queue), job->priority, (int)(waited * 1e6), job->result);
+}
+
 static __thread int32_t threadid = -1;
 // As threadid is `per thread` we don't have to use atomics
 static inline int32_t _control_get_threadid()
@@ -238,7 +254,9 @@ static gboolean _control_run_job_res(dt_control_t *control, int32_t res)
     _control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_get_wtime();
     job->result = job->execute(job);
+    _control_job_trace(job, start);
 
     _control_job_set_state(job, DT_JOB_STATE_FINISHED);
     _control_job_print(job, "run_job-", "", res);
@@ -248,6 +266,16 @@ static gboolean _control_run_job_res(dt_control_t *control, int32_t res)
   return FALSE;
 }
 
+// the export pipes running and about to run split the pixelpipe memory
+// between them, see dt_get_available_mem(). queue_mutex must be held.
+static void _control_update_pipe_share(dt_control_t *control)
+{
+  const int exports = control->exports_scheduled
+                      + (int)control->queue_length[DT_JOB_QUEUE_USER_EXPORT];
+  darktable.dtresources.pipe_share =
+    exports ? CLAMP(exports, 1, dt_control_jobs_max_exports()) : 1;
+}
+
 static _dt_job_t *_control_schedule_job(dt_control_t *control)
 {
   /*
@@ -270,7 +298,8 @@ static _dt_job_t *_control_schedule_job(dt_control_t *control)
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
     if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
+    if(i == DT_JOB_QUEUE_USER_EXPORT
+       && control->exports_scheduled >= dt_control_jobs_max_exports()) continue;
     _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
     if(_job->priority > max_priority)
     {
@@ -294,7 +323,11 @@ static _dt_job_t *_control_schedule_job(dt_control_t *control)
   GList **queue = &control->queues[winner_queue];
   *queue = g_list_delete_link(*queue, *queue);
   control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
+  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT)
+  {
+    control->exports_scheduled++;
+    _control_update_pipe_share(control);
+  }
 
   // and place it in scheduled job array (for job deduping)
   control->job[_control_get_threadid()] = job;
@@ -318,7 +351,9 @@ static void _control_job_execute(_dt_job_t *job)
   _control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
   /* execute job */
+  const double start = dt_get_wtime();
   job->result = job->execute(job);
+  _control_job_trace(job, start);
 
   _control_job_set_state(job, DT_JOB_STATE_FINISHED);
   _control_job_print(job, "run_job-", "", DT_CTL_WORKER_RESERVED + _control_get_threadid());
@@ -340,7 +375,11 @@ static gboolean _control_run_job(dt_control_t *control)
   // remove the job from scheduled job array (for job deduping)
   dt_pthread_mutex_lock(&control->queue_mutex);
   control->job[_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
+  if(job->queue == DT_JOB_QUEUE_USER_EXPORT)
+  {
+    control->exports_scheduled--;
+    _control_update_pipe_share(control);
+  }
   dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // and free it
@@ -514,6 +553,7 @@ static void *_control_work_res(void *ptr)
   char name[16] = {0};
   snprintf(name, sizeof(name), "worker res %d", threadid);
   dt_pthread_setname(name);
+  dt_trace_thread_name(name);
   free(params);
   const int32_t threadid_res = _control_get_threadid_res();
   while(dt_control_running())
@@ -559,6 +599,7 @@ static void *_control_work(void *ptr)
   char name[16] = {0};
   snprintf(name, sizeof(name), "worker %d", threadid);
   dt_pthread_setname(name);
+  dt_trace_thread_name(name);
   free(params);
   while(dt_control_running())
   {
@@ -607,12 +648,49 @@ double dt_control_job_get_progress(const dt_job_t *job)
 }
 
 
+/* Every export job runs its own pipe and the pipes share the memory
+   darktable grants to pixelpipes. So we only allow as many exports in
+   parallel as that budget holds export pipes of a reasonable size, which is
+   estimated as a few single buffers for the input, the output and the
+   modules' intermediates, but at least the 512MB a pipe is always granted.
+   We also always keep two workers free for thumbnails and other foreground
+   work.
+*/
+#define DT_EXPORT_PIPE_BUFFERS 8
+
+static int _control_max_exports(const int32_t num_threads)
+{
+  const int requested = MAX(1, dt_conf_get_int("max_concurrent_exports"));
+  const size_t budget = dt_get_available_mem() * MAX(1, darktable.dtresources.pipe_share);
+  const size_t export_mem = MAX(512lu * DT_MEGA, DT_EXPORT_PIPE_BUFFERS * dt_get_singlebuffer_mem());
+  const int by_memory = MAX(1, (int)(budget / export_mem));
+  const int by_workers = MAX(1, num_threads - 2);
+  const int max_exports = MIN(requested, MIN(by_memory, by_workers));
+  dt_print(DT_DEBUG_CONTROL,
+           "[dt_control_jobs_init] %d concurrent export jobs (requested %d, memory %d, workers %d)",
+           max_exports, requested, by_memory, by_workers);
+  return max_exports;
+}
+
+int dt_control_jobs_max_exports()
+{
+  dt_control_t *control = darktable.control;
+  if(!control) return 1;
+  // the system resources are only known after the control has been set up,
+  // so this is evaluated the first time an export is to be scheduled.
+  if(control->max_exports <= 0)
+    control->max_exports = _control_max_exports(control->num_threads);
+  return control->max_exports;
+}
+
 // moved out of control.c to be able to make some helper functions static
 void dt_control_jobs_init()
 {
   dt_control_t *control = darktable.control;
   // start threads
   control->num_threads = dt_worker_threads();
+  control->exports_scheduled = 0;
+  control->max_exports = 0;
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
   // allocate enough jobs to match _control_get_threadid()
   control->job = (dt_job_t **)calloc(control->num_threads+1, sizeof(dt_job_t *));
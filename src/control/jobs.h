@@ -46,7 +46,7 @@ typedef enum dt_job_queue_t
   DT_JOB_QUEUE_USER_FG = 0,     // gui actions, ...
   DT_JOB_QUEUE_SYSTEM_FG = 1,   // thumbnail creation, ..., may be pushed out of the queue
   DT_JOB_QUEUE_USER_BG = 2,     // imports, ...
-  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time
+  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. at most dt_control_jobs_max_exports() of these are scheduled at a time
   DT_JOB_QUEUE_SYSTEM_BG = 4,   // some lua stuff that may not be pushed out of the queue, ...
   DT_JOB_QUEUE_MAX = 5,
   DT_JOB_QUEUE_SYNCHRONOUS = 1000 // don't queue, run immediately and don't return until done
@@ -82,6 +82,8 @@ double dt_control_job_get_progress(const dt_job_t *job);
 void dt_control_jobs_init(void);
 void dt_control_jobs_cleanup(void);
 int dt_control_jobs_pending(void);
+/** number of export jobs allowed to run concurrently, depends on memory and worker threads */
+int dt_control_jobs_max_exports(void);
 
 gboolean dt_control_add_job(dt_job_queue_t queue_id, dt_job_t *job);
 gboolean dt_control_add_job_res(dt_job_t *job, const int32_t res);
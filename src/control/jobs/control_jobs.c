@@ -102,6 +102,7 @@ typedef struct dt_control_export_t
   gchar *icc_filename;
   dt_iop_color_intent_t icc_intent;
   gchar *metadata_export;
+  int first, total; // position of this job's images in the whole export
 } dt_control_export_t;
 
 typedef struct dt_control_import_t
@@ -1985,6 +1986,9 @@ static int32_t _control_apply_styles_job_run(dt_job_t *job)
 
   const gboolean is_overwrite = style_data->overwrite;
 
+  // the styles are read once for all images
+  dt_styles_batch_t *batch = dt_styles_batch_begin(styles);
+
   double prev_time = 0;
   for(GList *t = imgs ; t && !_job_cancelled(job); t = g_list_next(t))
   {
@@ -2003,10 +2007,7 @@ static int32_t _control_apply_styles_job_run(dt_job_t *job)
     if(is_overwrite && !duplicate)
       dt_history_delete_on_image_ext(imgid, FALSE, TRUE);
 
-    for(GList *style = styles; style; style = g_list_next(style))
-    {
-      dt_styles_apply_to_image((const char*)style->data, duplicate, is_overwrite, imgid);
-    }
+    dt_styles_batch_apply(batch, duplicate, is_overwrite, imgid);
 
     if(is_overwrite && g_list_is_singleton(styles))
     {
@@ -2018,6 +2019,7 @@ static int32_t _control_apply_styles_job_run(dt_job_t *job)
     fraction += 1.0 / total;
     _update_progress(job, fraction, &prev_time);
   }
+  dt_styles_batch_end(batch);
   dt_undo_end_group(darktable.undo);
   DT_CONTROL_SIGNAL_RAISE(DT_SIGNAL_TAG_CHANGED);
 
@@ -2030,9 +2032,13 @@ static int32_t _control_apply_styles_job_run(dt_job_t *job)
   return 0;
 }
 
+// export jobs may run in parallel, only the last one finishing restarts the crawler
+static dt_atomic_int _exports_running;
+
 static int32_t _control_export_job_run(dt_job_t *job)
 {
-  dt_stop_backthumbs_crawler(FALSE);
+  if(dt_atomic_add_int(&_exports_running, 1) == 0)
+    dt_stop_backthumbs_crawler(FALSE);
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
   dt_control_export_t *settings = params->data;
   dt_imageio_module_format_t *mformat =
@@ -2075,11 +2081,18 @@ static int32_t _control_export_job_run(dt_job_t *job)
   else
     h = sh < fh ? sh : fh;
 
-  const guint total = g_list_length(params->index);
-  if(total > 0)
-    dt_control_log(ngettext("exporting %d image..", "exporting %d images..", total), total);
-  else
-    dt_control_log(_("no image to export"));
+  // when the export is split over several jobs, sequence numbers and
+  // progress messages refer to the whole export
+  const guint count = g_list_length(params->index);
+  const guint first = settings->total > 0 ? settings->first : 0;
+  const guint total = settings->total > 0 ? settings->total : count;
+  if(first == 0)
+  {
+    if(total > 0)
+      dt_control_log(ngettext("exporting %d image..", "exporting %d images..", total), total);
+    else
+      dt_control_log(_("no image to export"));
+  }
 
   double fraction = 0;
 
@@ -2126,7 +2139,7 @@ static int32_t _control_export_job_run(dt_job_t *job)
   {
     const dt_imgid_t imgid = GPOINTER_TO_INT(t->data);
     t = g_list_next(t);
-    const guint num = total - g_list_length(t);
+    const guint num = first + count - g_list_length(t);
 
     // progress message
     // update the message. initialize_store() might have changed the number of images
@@ -2171,7 +2184,7 @@ static int32_t _control_export_job_run(dt_job_t *job)
       }
     }
 
-    fraction += 1.0 / total;
+    fraction += 1.0 / count;
     _update_progress(job, fraction, &prev_time);
   }
   g_list_free_full(metadata.list, g_free);
@@ -2186,7 +2199,8 @@ end:
   dt_ui_notify_user();
 
   if(tag_change) DT_CONTROL_SIGNAL_RAISE(DT_SIGNAL_TAG_CHANGED);
-  dt_start_backthumbs_crawler();
+  if(dt_atomic_sub_int(&_exports_running, 1) == 1)
+    dt_start_backthumbs_crawler();
   return 0;
 }
 
@@ -2272,6 +2286,30 @@ void dt_control_duplicate_images(const gboolean virgin)
                                           PROGRESS_CANCELLABLE, TRUE));
 }
 
+static int32_t _control_update_aspect_ratios_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
+  GList *t = params->index;
+  const guint total = g_list_length(t);
+  double fraction = 0.0;
+
+  dt_control_job_set_progress_message(job, ngettext("updating aspect ratio of %d image",
+                                                    "updating aspect ratio of %d images",
+                                                    total), total);
+  double prev_time = 0;
+  for(; t && !_job_cancelled(job); t = g_list_next(t))
+  {
+    dt_image_set_aspect_ratio(GPOINTER_TO_INT(t->data), FALSE);
+    fraction += 1.0 / total;
+    _update_progress(job, fraction, &prev_time);
+  }
+
+  dt_collection_update_query(darktable.collection,
+                             DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_ASPECT_RATIO,
+                             g_list_copy(params->index));
+  return 0;
+}
+
 void dt_control_flip_images(const int32_t cw)
 {
   dt_control_add_job(DT_JOB_QUEUE_USER_FG,
@@ -2280,6 +2318,28 @@ void dt_control_flip_images(const int32_t cw)
                                           NULL, PROGRESS_CANCELLABLE, TRUE));
 }
 
+void dt_control_update_aspect_ratios(GList *imgs)
+{
+  dt_job_t *job = dt_control_job_create(&_control_update_aspect_ratios_job_run,
+                                        "%s", N_("update aspect ratios"));
+  if(!job)
+  {
+    g_list_free(imgs);
+    return;
+  }
+  dt_control_image_enumerator_t *params = _control_image_enumerator_alloc();
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    g_list_free(imgs);
+    return;
+  }
+  dt_control_job_add_progress(job, _("update aspect ratios"), TRUE);
+  params->index = imgs;
+  dt_control_job_set_params(job, params, _control_image_enumerator_cleanup);
+  dt_control_add_job(DT_JOB_QUEUE_USER_BG, job);
+}
+
 void dt_control_monochrome_images(const int32_t mode)
 {
   dt_control_add_job(DT_JOB_QUEUE_USER_FG,
@@ -2743,43 +2803,35 @@ static void _control_export_cleanup(void *p)
   _control_image_enumerator_cleanup(params);
 }
 
-void dt_control_export(GList *imgid_list,
-                       const int max_width,
-                       const int max_height,
-                       const int format_index,
-                       const int storage_index,
-                       const gboolean high_quality,
-                       const gboolean upscale,
-                       const gboolean dimensions_scale,
-                       const gboolean is_scaling,
-                       const double scale_factor,
-                       const gboolean export_masks,
-                       char *style,
-                       const gboolean style_append,
-                       const dt_colorspaces_color_profile_type_t icc_type,
-                       const gchar *icc_filename,
-                       const dt_iop_color_intent_t icc_intent,
-                       const gchar *metadata_export)
+static dt_job_t *_control_export_job_create(GList *imgs,
+                                            const dt_control_export_t *settings)
 {
   dt_job_t *job = dt_control_job_create(&_control_export_job_run, "export");
-  if(!job) return;
+  if(!job)
+  {
+    g_list_free(imgs);
+    return NULL;
+  }
   dt_control_image_enumerator_t *params = _control_export_alloc();
   if(!params)
   {
+    g_list_free(imgs);
     dt_control_job_dispose(job);
-    return;
+    return NULL;
   }
   dt_control_job_set_params(job, params, _control_export_cleanup);
 
-  params->index = imgid_list;
+  params->index = imgs;
 
   dt_control_export_t *data = params->data;
-  data->max_width = max_width;
-  data->max_height = max_height;
-  data->format_index = format_index;
-  data->storage_index = storage_index;
+  *data = *settings;
+  data->sdata = NULL;
+  data->fdata = NULL;
+  data->icc_filename = g_strdup(settings->icc_filename);
+  data->metadata_export = g_strdup(settings->metadata_export);
 
-  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(storage_index);
+  dt_imageio_module_storage_t *mstorage =
+    dt_imageio_get_storage_by_index(settings->storage_index);
   g_assert(mstorage);
   // get shared storage param struct (global sequence counter, one picasa connection etc)
   dt_imageio_module_data_t *sdata = mstorage->get_params(mstorage);
@@ -2788,11 +2840,12 @@ void dt_control_export(GList *imgid_list,
     dt_control_log(_("failed to get parameters from storage module `%s', aborting export."),
                    mstorage->name(mstorage));
     dt_control_job_dispose(job);
-    return;
+    return NULL;
   }
   data->sdata = sdata;
 
-  dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(format_index);
+  dt_imageio_module_format_t *mformat =
+    dt_imageio_get_format_by_index(settings->format_index);
   g_assert(mformat);
   void *fdata = mformat->get_params(mformat);
   if(fdata == NULL)
@@ -2800,25 +2853,86 @@ void dt_control_export(GList *imgid_list,
     dt_control_log(_("failed to get parameters from format module `%s', aborting export."),
                    mformat->name());
     dt_control_job_dispose(job);
-    return;
+    return NULL;
   }
   data->fdata = fdata;
 
-  data->high_quality = high_quality;
-  data->export_masks = export_masks;
-  data->upscale = ((max_width == 0 && max_height == 0)
-                   && !dimensions_scale) ? FALSE : upscale;
-  data->is_scaling = is_scaling;
-  data->scale_factor = scale_factor;
-  g_strlcpy(data->style, style, sizeof(data->style));
-  data->style_append = style_append;
-  data->icc_type = icc_type;
-  data->icc_filename = g_strdup(icc_filename);
-  data->icc_intent = icc_intent;
-  data->metadata_export = g_strdup(metadata_export);
-
   dt_control_job_add_progress(job, _("export images"), TRUE);
-  dt_control_add_job(DT_JOB_QUEUE_USER_EXPORT, job);
+  return job;
+}
+
+void dt_control_export(GList *imgid_list,
+                       const int max_width,
+                       const int max_height,
+                       const int format_index,
+                       const int storage_index,
+                       const gboolean high_quality,
+                       const gboolean upscale,
+                       const gboolean dimensions_scale,
+                       const gboolean is_scaling,
+                       const double scale_factor,
+                       const gboolean export_masks,
+                       char *style,
+                       const gboolean style_append,
+                       const dt_colorspaces_color_profile_type_t icc_type,
+                       const gchar *icc_filename,
+                       const dt_iop_color_intent_t icc_intent,
+                       const gchar *metadata_export)
+{
+  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(storage_index);
+  g_assert(mstorage);
+
+  dt_control_export_t settings = { 0 };
+  settings.max_width = max_width;
+  settings.max_height = max_height;
+  settings.format_index = format_index;
+  settings.storage_index = storage_index;
+  settings.high_quality = high_quality;
+  settings.export_masks = export_masks;
+  settings.upscale = ((max_width == 0 && max_height == 0)
+                      && !dimensions_scale) ? FALSE : upscale;
+  settings.is_scaling = is_scaling;
+  settings.scale_factor = scale_factor;
+  g_strlcpy(settings.style, style, sizeof(settings.style));
+  settings.style_append = style_append;
+  settings.icc_type = icc_type;
+  settings.icc_filename = (gchar *)icc_filename;
+  settings.icc_intent = icc_intent;
+  settings.metadata_export = (gchar *)metadata_export;
+
+  // storages with initialize_store() or finalize_store() work on the
+  // whole set of images at once (galleries, mails, ...) and are never
+  // split. for all others the images are dealt out in contiguous chunks
+  // to as many export jobs as may run concurrently.
+  const int total = g_list_length(imgid_list);
+  const gboolean can_split = !mstorage->initialize_store && !mstorage->finalize_store;
+  const int num_jobs =
+    can_split ? CLAMP(dt_control_jobs_max_exports(), 1, MAX(1, total)) : 1;
+  settings.total = num_jobs > 1 ? total : 0;
+
+  GList *imgs = imgid_list;
+  for(int j = 0; j < num_jobs; j++)
+  {
+    const int first = (int)((int64_t)total * j / num_jobs);
+    const int next = (int)((int64_t)total * (j + 1) / num_jobs);
+    GList *chunk = imgs;
+    if(j < num_jobs - 1)
+    {
+      GList *last = g_list_nth(chunk, next - first - 1);
+      imgs = last->next;
+      last->next = NULL;
+      imgs->prev = NULL;
+    }
+
+    settings.first = first;
+    dt_job_t *job = _control_export_job_create(chunk, &settings);
+    if(!job)
+    {
+      if(j < num_jobs - 1) g_list_free(imgs);
+      break;
+    }
+    dt_control_add_job(DT_JOB_QUEUE_USER_EXPORT, job);
+  }
 
   // tell the storage that we got its params for an export so it can
   // reset itself to a safe state
@@ -37,6 +37,8 @@ void dt_control_delete_images(void);
 void dt_control_delete_duplicate(const dt_imgid_t imgid);
 void dt_control_duplicate_images(const gboolean virgin);
 void dt_control_flip_images(const int32_t cw);
+/** recompute the aspect ratio of the images in the background, takes ownership of imgs */
+void dt_control_update_aspect_ratios(GList *imgs);
 void dt_control_monochrome_images(const int32_t mode);
 gboolean dt_control_remove_images(void);
 void dt_control_move_images(void);
@@ -18,7 +18,10 @@
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
 #include "common/collection.h"
+#include "common/database.h"
+#include "common/exif.h"
 #include "common/film.h"
+#include "common/image.h"
 #include <stdlib.h>
 
 typedef struct dt_film_import1_t
@@ -227,6 +230,99 @@ static int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// the metadata of the files to import is read and parsed by worker threads
+// ahead of the import loop, which decodes it and does all the database
+// writes from the job thread. Each image keeps its own transactions: nested
+// transactions aren't enabled and the connection is shared with other
+// threads, so a batch would also swallow their commits and rollbacks.
+#define DT_IMPORT_PREFETCH_AHEAD 64
+
+typedef struct _import_prefetch_t
+{
+  gchar **files;            // the images, in import order
+  int count;
+  dt_exif_prefetch_t **pf;  // metadata of the files prefetched and not yet taken
+  gboolean *done;
+  int next;                 // next file for a worker
+  int taken;                // files taken by the import loop
+  int prefetched;
+  gboolean stop;
+  dt_pthread_mutex_t lock;
+  pthread_cond_t ready;     // a file has been prefetched
+  pthread_cond_t room;      // the import loop took a file
+} _import_prefetch_t;
+
+static void *_import_prefetch_worker(void *data)
+{
+  _import_prefetch_t *p = data;
+  dt_pthread_setname("import-meta");
+
+  dt_pthread_mutex_lock(&p->lock);
+  while(!p->stop && p->next < p->count)
+  {
+    // don't run too far ahead, the metadata of raw files can be large
+    if(p->next >= p->taken + DT_IMPORT_PREFETCH_AHEAD)
+    {
+      dt_pthread_cond_wait(&p->room, &p->lock);
+      continue;
+    }
+    const int k = p->next++;
+    dt_pthread_mutex_unlock(&p->lock);
+
+    gchar *path = dt_util_normalize_path(p->files[k]);
+    dt_exif_prefetch_t *pf = path ? dt_exif_prefetch(path) : NULL;
+    g_free(path);
+
+    dt_pthread_mutex_lock(&p->lock);
+    p->pf[k] = pf;
+    p->done[k] = TRUE;
+    p->prefetched++;
+    pthread_cond_broadcast(&p->ready);
+  }
+  dt_pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+// wait for the metadata of file k, to be freed by the caller
+static dt_exif_prefetch_t *_import_prefetch_take(_import_prefetch_t *p,
+                                                 const int k)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  while(!p->done[k])
+    dt_pthread_cond_wait(&p->ready, &p->lock);
+  dt_exif_prefetch_t *pf = p->pf[k];
+  p->pf[k] = NULL;
+  p->taken = k + 1;
+  pthread_cond_broadcast(&p->room);
+  dt_pthread_mutex_unlock(&p->lock);
+  return pf;
+}
+
+static int _import_prefetch_count(_import_prefetch_t *p)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  const int prefetched = p->prefetched;
+  dt_pthread_mutex_unlock(&p->lock);
+  return prefetched;
+}
+
+static void _import_prefetch_stop(_import_prefetch_t *p,
+                                  pthread_t *workers,
+                                  const int nworkers)
+{
+  dt_pthread_mutex_lock(&p->lock);
+  p->stop = TRUE;
+  pthread_cond_broadcast(&p->room);
+  dt_pthread_mutex_unlock(&p->lock);
+
+  for(int k = 0; k < nworkers; k++)
+    dt_pthread_join(workers[k]);
+
+  // whatever a cancelled import did not take
+  for(int k = 0; k < p->count; k++)
+    if(p->pf[k]) dt_exif_prefetch_free(p->pf[k]);
+}
+
 static void _film_import1(dt_job_t *job, dt_film_t *film, GList *images)
 {
   // first, gather all images to import if not already given
@@ -296,15 +392,41 @@ static void _film_import1(dt_job_t *job, dt_film_t *film, GList *images)
   const guint total = g_list_length(images);
   dt_control_job_set_progress_message(job, ngettext("importing %d image", "importing %d images", total), total);
 
+  /* start reading the metadata of the images in the background */
+  _import_prefetch_t prefetch = { 0 };
+  prefetch.count = total;
+  prefetch.files = calloc(total, sizeof(gchar *));
+  prefetch.pf = calloc(total, sizeof(dt_exif_prefetch_t *));
+  prefetch.done = calloc(total, sizeof(gboolean));
+  int k = 0;
+  for(GList *image = images; image; image = g_list_next(image))
+    prefetch.files[k++] = image->data;
+  dt_pthread_mutex_init(&prefetch.lock, NULL);
+  pthread_cond_init(&prefetch.ready, NULL);
+  pthread_cond_init(&prefetch.room, NULL);
+
+  const int nworkers = MAX(1, MIN(dt_worker_threads(), (int)total));
+  pthread_t *workers = calloc(nworkers, sizeof(pthread_t));
+  int started = 0;
+  for(; started < nworkers; started++)
+    if(dt_pthread_create(&workers[started], _import_prefetch_worker, &prefetch)) break;
+  // without workers the import loop reads the metadata itself
+  if(!started) prefetch.stop = TRUE;
+
   GList *imgs = NULL;
   GList *all_imgs = NULL;
 
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
   int pending = 0;
-  double last_update = dt_get_wtime();
-  for(GList *image = images; image; image = g_list_next(image))
+  int imported = 0;
+  const double start = dt_get_wtime();
+  double last_update = start;
+  k = 0;
+  for(GList *image = images; image; image = g_list_next(image), k++)
   {
+    dt_exif_prefetch_t *pf = started ? _import_prefetch_take(&prefetch, k) : NULL;
+
     gchar *cdn = g_path_get_dirname((const gchar *)image->data);
 
     /* check if we need to initialize a new filmroll */
@@ -333,13 +455,17 @@ static void _film_import1(dt_job_t *job, dt_film_t *film, GList *images)
     g_free(cdn);
 
     /* import image */
-    const dt_imgid_t imgid = dt_image_import(cfr->id, (const gchar *)image->data, FALSE, FALSE);
+    const dt_imgid_t imgid =
+      dt_image_import_prefetched(cfr->id, (const gchar *)image->data, FALSE, FALSE, pf);
+    if(pf) dt_exif_prefetch_free(pf);
     pending++;  // we have another image which hasn't been reported yet
+    imported++;
     fraction += 1.0 / total;
     dt_control_job_set_progress(job, fraction);
 
     all_imgs = g_list_prepend(all_imgs, GINT_TO_POINTER(imgid));
     imgs = g_list_append(imgs, GINT_TO_POINTER(imgid));
+
     const double curr_time = dt_get_wtime();
     // if we've imported at least four images without an update, and it's been at least half a second since the last
     //   one, update the interface
@@ -352,11 +478,30 @@ static void _film_import1(dt_job_t *job, dt_film_t *film, GList *images)
       // restart the update count and timer
       pending = 0;
       last_update = curr_time;
+
+      const double elapsed = curr_time - start;
+      dt_control_job_set_progress_message
+        (job, _("importing %d/%d images (metadata %.0f/s, database %.0f/s)"),
+         imported, (int)total,
+         (started ? _import_prefetch_count(&prefetch) : imported) / elapsed,
+         imported / elapsed);
     }
     if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED)
       break;
   }
 
+  _import_prefetch_stop(&prefetch, workers, started);
+  dt_print(DT_DEBUG_PERF,
+           "[film_import] %d images in %.3f secs, metadata read by %d threads",
+           imported, dt_get_wtime() - start, started);
+  free(workers);
+  free(prefetch.files);
+  free(prefetch.pf);
+  free(prefetch.done);
+  pthread_cond_destroy(&prefetch.ready);
+  pthread_cond_destroy(&prefetch.room);
+  dt_pthread_mutex_destroy(&prefetch.lock);
+
   g_list_free_full(images, g_free);
   all_imgs = g_list_reverse(all_imgs);
 
@@ -62,6 +62,78 @@ dt_job_t *dt_image_load_job_create(dt_imgid_t id, dt_mipmap_size_t mip)
   return job;
 }
 
+typedef struct dt_image_prefetch_t
+{
+  dt_atomic_int *generation;
+  int expected;
+  dt_mipmap_size_t mip;
+  GArray *imgids;
+} dt_image_prefetch_t;
+
+static void _image_prefetch_free(void *p)
+{
+  dt_image_prefetch_t *params = p;
+  g_array_free(params->imgids, TRUE);
+  free(params);
+}
+
+static int32_t _image_prefetch_job_run(dt_job_t *job)
+{
+  dt_image_prefetch_t *params = dt_control_job_get_params(job);
+
+  for(guint k = 0; k < params->imgids->len; k++)
+  {
+    // the requester has moved on, the rest isn't wanted any longer
+    if(dt_atomic_get_int(params->generation) != params->expected
+       || dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED)
+      break;
+
+    const dt_imgid_t imgid = g_array_index(params->imgids, dt_imgid_t, k);
+
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(&buf, imgid, params->mip, DT_MIPMAP_TESTLOCK, 'r');
+    if(buf.buf)
+    {
+      dt_mipmap_cache_release(&buf);
+      continue;
+    }
+
+    // only what the disk cache has, thumbnails to be processed are
+    // left to the thumbtable when they get shown
+    if(!dt_mipmap_cache_on_disk(imgid, params->mip)) continue;
+
+    dt_mipmap_cache_get(&buf, imgid, params->mip, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(&buf);
+  }
+  return 0;
+}
+
+dt_job_t *dt_image_prefetch_job_create(GArray *imgids,
+                                       const dt_mipmap_size_t mip,
+                                       dt_atomic_int *generation)
+{
+  dt_job_t *job = dt_control_job_create(&_image_prefetch_job_run,
+                                        "prefetch %u images mip %d", imgids->len, mip);
+  if(!job)
+  {
+    g_array_free(imgids, TRUE);
+    return NULL;
+  }
+  dt_image_prefetch_t *params = calloc(1, sizeof(dt_image_prefetch_t));
+  if(!params)
+  {
+    g_array_free(imgids, TRUE);
+    dt_control_job_dispose(job);
+    return NULL;
+  }
+  dt_control_job_set_params(job, params, _image_prefetch_free);
+  params->generation = generation;
+  params->expected = dt_atomic_get_int(generation);
+  params->mip = mip;
+  params->imgids = imgids;
+  return job;
+}
+
 typedef struct dt_image_import_t
 {
   dt_filmid_t film_id;
@@ -25,6 +25,12 @@
 
 dt_job_t *dt_image_load_job_create(dt_imgid_t imgid, dt_mipmap_size_t mip);
 
+// load the thumbnails of imgids that are in the disk cache, stops as soon
+// as *generation changes. takes ownership of imgids (an array of dt_imgid_t).
+dt_job_t *dt_image_prefetch_job_create(GArray *imgids,
+                                       const dt_mipmap_size_t mip,
+                                       dt_atomic_int *generation);
+
 dt_job_t *dt_image_import_job_create(dt_filmid_t filmid, const char *filename);
 
 // clang-format off
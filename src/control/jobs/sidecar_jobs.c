@@ -18,6 +18,9 @@
 
 #include "control/jobs/sidecar_jobs.h"
 
+// sidecars written by the background job before it gives others a chance to run
+#define DT_SIDECAR_JOB_BATCH 64
+
 static GSList *pending_images = NULL;
 static gboolean background_running = FALSE;
 
@@ -86,15 +89,22 @@ static int32_t _control_write_sidecars_job_run(dt_job_t *job)
         g_slist_free(new_imgs);
       }
     }
-    // synchronize the first few images on the queue
-    for(int i = 0; imgs && i < 3; i++)
+    // synchronize a batch of images from the head of the queue, an
+    // image enqueued again while waiting is written only once as
+    // `enqueued' keeps it from being added twice
+    GList *batch = NULL;
+    for(int i = 0; imgs && i < DT_SIDECAR_JOB_BATCH; i++)
     {
-      dt_imgid_t imgid = GPOINTER_TO_INT(imgs->data);
-      dt_image_write_sidecar_file(imgid);
-      // remove the head of the image queue
-      g_hash_table_remove(enqueued, GINT_TO_POINTER(imgid));
+      batch = g_list_prepend(batch, imgs->data);
+      g_hash_table_remove(enqueued, imgs->data);
       imgs = g_slist_delete_link(imgs, imgs);
     }
+    if(batch)
+    {
+      batch = g_list_reverse(batch);
+      dt_image_write_sidecar_files(batch);
+      g_list_free(batch);
+    }
     if(imgs) // do we have more images already queued?
     {
       // give others a chance to run by sleeping 10ms; avoids apparent
@@ -141,10 +151,7 @@ void dt_sidecar_synch_enqueue_list(const GList *imgs)
   if(!background_running)
   {
     // synchronize the sidecars immediately instead of queueing them for background write
-    for(const GList *ilist = imgs; ilist; ilist = g_list_next(ilist))
-    {
-      dt_image_write_sidecar_file(GPOINTER_TO_INT(ilist->data));
-    }
+    dt_image_write_sidecar_files(imgs);
     return;
   }
   GSList *new_imgs = NULL;
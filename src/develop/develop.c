@@ -3064,6 +3064,31 @@ static char *_transform_type(const dt_dev_transform_direction_t transf_direction
   }
 }
 
+// does the piece take part in a transform of the given direction
+static inline gboolean _dev_distort_piece_active(dt_develop_t *dev,
+                                                 const dt_dev_pixelpipe_t *pipe,
+                                                 dt_iop_module_t *module,
+                                                 const dt_dev_pixelpipe_iop_t *piece,
+                                                 const double iop_order,
+                                                 const dt_dev_transform_direction_t transf_direction)
+{
+  return piece->enabled
+    && piece->data
+    && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
+        || (transf_direction == DT_DEV_TRANSFORM_DIR_ALL_GEOMETRY
+            && !(module->operation_tags() & IOP_TAG_GEOMETRY))
+        || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL
+            && module->iop_order >= iop_order)
+        || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL
+            && module->iop_order > iop_order)
+        || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL
+            && module->iop_order <= iop_order)
+        || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL
+            && module->iop_order < iop_order))
+    && !(dt_iop_module_is_skipped(dev, module)
+         && (pipe->type & DT_DEV_PIXELPIPE_BASIC));
+}
+
 // running with the history locked
 static gboolean _dev_distort_transform_locked(dt_develop_t *dev,
                                               dt_dev_pixelpipe_t *pipe,
@@ -3090,22 +3115,8 @@ static gboolean _dev_distort_transform_locked(dt_develop_t *dev,
       ? module->distort_backtransform
       : module->distort_transform;
 
-    if(piece->enabled
-       && transform
-       && piece->data
-       && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_ALL_GEOMETRY
-               && !(module->operation_tags() & IOP_TAG_GEOMETRY))
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL
-               && module->iop_order >= iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_EXCL
-               && module->iop_order > iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_INCL
-               && module->iop_order <= iop_order)
-           || (transf_direction == DT_DEV_TRANSFORM_DIR_BACK_EXCL
-               && module->iop_order < iop_order))
-       && !(dt_iop_module_is_skipped(dev, module)
-            && (pipe->type & DT_DEV_PIXELPIPE_BASIC)))
+    if(transform
+       && _dev_distort_piece_active(dev, pipe, module, piece, iop_order, transf_direction))
     {
       if(log)
       {
@@ -3137,6 +3148,429 @@ static gboolean _dev_distort_transform_locked(dt_develop_t *dev,
   return TRUE;
 }
 
+/* Warp fields for large point lists.
+
+   Masks back-transform every point of their grid through the whole
+   module chain. For lists of at least DT_DEV_WARP_MIN_BUILD points the
+   chain is instead evaluated once on a coarse grid spanning the points,
+   and the points are interpolated bilinearly from that grid. Cells where
+   the interpolation at the cell centre or the middle of an edge is off by
+   more than DT_DEV_WARP_TOLERANCE, or that contain invalid nodes, are
+   marked so their points still go through the chain, as do the points
+   outside of the grid. Warps smaller than a cell can't be seen that way,
+   so chains with liquify don't use a field at all.
+
+   The fields are kept per pipe, keyed by the hashes of the pieces the
+   chain runs through, the same ones used by dt_dev_hash_distort_plus(),
+   and their regions of interest. A field is reused by any later list
+   with the same chain, so masks, color pickers and overlays share it
+   until the history or the pipe dimensions change.
+*/
+
+#define DT_DEV_WARP_CELLS 128         // grid cells per axis
+#define DT_DEV_WARP_ENTRIES 4         // fields kept per pipe
+#define DT_DEV_WARP_MIN_BUILD 65536   // points needed to build a field, about its own cost
+#define DT_DEV_WARP_MIN_REUSE 4096    // points needed to use an existing field
+#define DT_DEV_WARP_TOLERANCE 0.25f   // max interpolation error in pixels
+
+typedef struct dt_dev_warp_field_t
+{
+  dt_hash_t hash;  // chain and direction, DT_INVALID_HASH if unused
+  uint64_t used;   // to drop the least recently used field
+  float x0, y0;    // origin of the grid
+  float sx, sy;    // cell size
+  float *nodes;    // transformed grid nodes, (DT_DEV_WARP_CELLS + 1)^2 points
+  uint8_t *exact;  // cells that must go through the chain
+} dt_dev_warp_field_t;
+
+typedef struct dt_dev_warp_cache_t
+{
+  dt_dev_warp_field_t field[DT_DEV_WARP_ENTRIES];
+  uint64_t clock;
+} dt_dev_warp_cache_t;
+
+static void _dev_warp_field_clear(dt_dev_warp_field_t *field)
+{
+  dt_free_align(field->nodes);
+  g_free(field->exact);
+  memset(field, 0, sizeof(dt_dev_warp_field_t));
+  field->hash = DT_INVALID_HASH;
+}
+
+void dt_dev_distort_cache_cleanup(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_warp_cache_t *cache = pipe->warp_cache;
+  if(!cache) return;
+  for(int k = 0; k < DT_DEV_WARP_ENTRIES; k++)
+    _dev_warp_field_clear(&cache->field[k]);
+  g_free(cache);
+  pipe->warp_cache = NULL;
+}
+
+// running with the history locked
+static dt_hash_t _dev_warp_hash_locked(dt_develop_t *dev,
+                                       dt_dev_pixelpipe_t *pipe,
+                                       const gboolean back,
+                                       const double iop_order,
+                                       const dt_dev_transform_direction_t transf_direction)
+{
+  dt_hash_t hash = dt_hash(DT_INITHASH, &back, sizeof(back));
+  hash = dt_hash(hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  hash = dt_hash(hash, &pipe->iheight, sizeof(pipe->iheight));
+  hash = dt_hash(hash, &pipe->iscale, sizeof(pipe->iscale));
+
+  GList *modules = g_list_first(pipe->iop);
+  GList *pieces = g_list_first(pipe->nodes);
+  while(modules)
+  {
+    if(!pieces) return DT_INVALID_HASH;
+    dt_iop_module_t *module = modules->data;
+    dt_dev_pixelpipe_iop_t *piece = pieces->data;
+    const gboolean has_transform = back ? module->distort_backtransform != NULL
+                                        : module->distort_transform != NULL;
+    if(has_transform
+       && _dev_distort_piece_active(dev, pipe, module, piece, iop_order, transf_direction))
+    {
+      // params not committed yet, the chain is not known
+      if(piece->hash == DT_INVALID_HASH) return DT_INVALID_HASH;
+      // its warps may be much smaller than a cell
+      if(dt_iop_module_is(module, "liquify")) return DT_INVALID_HASH;
+      hash = dt_hash(hash, &piece->hash, sizeof(piece->hash));
+      hash = dt_hash(hash, &piece->iscale, sizeof(piece->iscale));
+      hash = dt_hash(hash, &piece->buf_in, sizeof(piece->buf_in));
+      hash = dt_hash(hash, &piece->buf_out, sizeof(piece->buf_out));
+    }
+    modules = g_list_next(modules);
+    pieces = g_list_next(pieces);
+  }
+  return hash;
+}
+
+static inline gboolean _dev_warp_in_grid(const float gx,
+                                         const float gy)
+{
+  // also false for NaN
+  return gx >= 0.0f && gx <= DT_DEV_WARP_CELLS && gy >= 0.0f && gy <= DT_DEV_WARP_CELLS;
+}
+
+// the cell of the field a point falls into, -1 if it has to go through the chain
+static inline int _dev_warp_cell(const dt_dev_warp_field_t *field,
+                                 const float x,
+                                 const float y,
+                                 float *fx,
+                                 float *fy)
+{
+  const float gx = (x - field->x0) / field->sx;
+  const float gy = (y - field->y0) / field->sy;
+  if(!_dev_warp_in_grid(gx, gy))
+    return -1;
+  const int i = MIN((int)gx, DT_DEV_WARP_CELLS - 1);
+  const int j = MIN((int)gy, DT_DEV_WARP_CELLS - 1);
+  const int cell = j * DT_DEV_WARP_CELLS + i;
+  if(field->exact[cell]) return -1;
+  *fx = gx - i;
+  *fy = gy - j;
+  return cell;
+}
+
+// is the middle of a and b within the tolerance of the transformed sample,
+// NaN or inf in any of them fails
+static inline gboolean _dev_warp_sample_ok(const float *a,
+                                           const float *b,
+                                           const float *sample)
+{
+  const float err = hypotf(0.5f * (a[0] + b[0]) - sample[0], 0.5f * (a[1] + b[1]) - sample[1]);
+  return err <= DT_DEV_WARP_TOLERANCE;
+}
+
+static gboolean _dev_warp_build(dt_develop_t *dev,
+                                dt_dev_pixelpipe_t *pipe,
+                                const gboolean back,
+                                const double iop_order,
+                                const dt_dev_transform_direction_t transf_direction,
+                                dt_dev_warp_field_t *field,
+                                const float x0,
+                                const float y0,
+                                const float x1,
+                                const float y1)
+{
+  const int n = DT_DEV_WARP_CELLS;
+  const size_t nodes = (size_t)(n + 1) * (n + 1);
+  const size_t cells = (size_t)n * n;
+  const size_t edges = (size_t)n * (n + 1); // in each direction
+  const size_t samples = nodes + cells + 2 * edges;
+  const float sx = MAX((x1 - x0) / n, 1e-3f);
+  const float sy = MAX((y1 - y0) / n, 1e-3f);
+
+  // the grid nodes followed by the cell centres and the middles of the
+  // horizontal and vertical edges, all through the chain at once
+  float *pts = dt_alloc_align_float(2 * samples);
+  uint8_t *exact = g_try_malloc0(cells);
+  if(!pts || !exact)
+  {
+    dt_free_align(pts);
+    g_free(exact);
+    return FALSE;
+  }
+
+  for(int j = 0; j <= n; j++)
+    for(int i = 0; i <= n; i++)
+    {
+      const size_t k = (size_t)j * (n + 1) + i;
+      pts[2 * k] = x0 + i * sx;
+      pts[2 * k + 1] = y0 + j * sy;
+    }
+  float *centres = pts + 2 * nodes;
+  for(int j = 0; j < n; j++)
+    for(int i = 0; i < n; i++)
+    {
+      const size_t k = (size_t)j * n + i;
+      centres[2 * k] = x0 + (i + 0.5f) * sx;
+      centres[2 * k + 1] = y0 + (j + 0.5f) * sy;
+    }
+  float *hedges = centres + 2 * cells;
+  for(int j = 0; j <= n; j++)
+    for(int i = 0; i < n; i++)
+    {
+      const size_t k = (size_t)j * n + i;
+      hedges[2 * k] = x0 + (i + 0.5f) * sx;
+      hedges[2 * k + 1] = y0 + j * sy;
+    }
+  float *vedges = hedges + 2 * edges;
+  for(int j = 0; j < n; j++)
+    for(int i = 0; i <= n; i++)
+    {
+      const size_t k = (size_t)j * (n + 1) + i;
+      vedges[2 * k] = x0 + i * sx;
+      vedges[2 * k + 1] = y0 + (j + 0.5f) * sy;
+    }
+
+  if(!_dev_distort_transform_locked(dev, pipe, back, iop_order, transf_direction,
+                                    pts, samples))
+  {
+    dt_free_align(pts);
+    g_free(exact);
+    return FALSE;
+  }
+
+  int exact_cells = 0;
+  for(int j = 0; j < n; j++)
+    for(int i = 0; i < n; i++)
+    {
+      const float *p00 = pts + 2 * ((size_t)j * (n + 1) + i);
+      const float *p10 = p00 + 2;
+      const float *p01 = p00 + 2 * (n + 1);
+      const float *p11 = p01 + 2;
+      const float *c = centres + 2 * ((size_t)j * n + i);
+      const float *top = hedges + 2 * ((size_t)j * n + i);
+      const float *bottom = top + 2 * n;
+      const float *left = vedges + 2 * ((size_t)j * (n + 1) + i);
+      const float *right = left + 2;
+      const float diag[2] = { 0.5f * (p00[0] + p11[0]), 0.5f * (p00[1] + p11[1]) };
+      const float antidiag[2] = { 0.5f * (p10[0] + p01[0]), 0.5f * (p10[1] + p01[1]) };
+      // bilinear interpolation in the centre is the mean of both diagonals
+      if(!_dev_warp_sample_ok(diag, antidiag, c)
+         || !_dev_warp_sample_ok(p00, p10, top)
+         || !_dev_warp_sample_ok(p01, p11, bottom)
+         || !_dev_warp_sample_ok(p00, p01, left)
+         || !_dev_warp_sample_ok(p10, p11, right))
+      {
+        exact[(size_t)j * n + i] = 1;
+        exact_cells++;
+      }
+    }
+
+  // keep the nodes only, the other samples are done with
+  float *kept = dt_alloc_align_float(2 * nodes);
+  if(!kept)
+  {
+    dt_free_align(pts);
+    g_free(exact);
+    return FALSE;
+  }
+  memcpy(kept, pts, sizeof(float) * 2 * nodes);
+  dt_free_align(pts);
+
+  _dev_warp_field_clear(field);
+  field->x0 = x0;
+  field->y0 = y0;
+  field->sx = sx;
+  field->sy = sy;
+  field->nodes = kept;
+  field->exact = exact;
+
+  dt_print_pipe(DT_DEBUG_PERF | DT_DEBUG_VERBOSE, "warp field",
+                pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
+                "%s %s, order=%d, %.0fx%.0f at %.0f %.0f, %d of %d cells exact",
+                back ? "back" : "forward", _transform_type(transf_direction),
+                (int)iop_order, x1 - x0, y1 - y0, x0, y0, exact_cells, (int)cells);
+  return TRUE;
+}
+
+// running with the history locked, returns FALSE if the chain has to do all points
+static gboolean _dev_distort_transform_warp(dt_develop_t *dev,
+                                            dt_dev_pixelpipe_t *pipe,
+                                            const gboolean back,
+                                            const double iop_order,
+                                            const dt_dev_transform_direction_t transf_direction,
+                                            float *points,
+                                            const size_t points_count,
+                                            gboolean *success)
+{
+  if(points_count < DT_DEV_WARP_MIN_REUSE
+     || !dt_conf_get_bool("distort_warp_cache"))
+    return FALSE;
+
+  const dt_hash_t hash = _dev_warp_hash_locked(dev, pipe, back, iop_order, transf_direction);
+  if(hash == DT_INVALID_HASH) return FALSE;
+
+  if(!pipe->warp_cache)
+  {
+    pipe->warp_cache = g_try_malloc0(sizeof(dt_dev_warp_cache_t));
+    if(!pipe->warp_cache) return FALSE;
+    for(int k = 0; k < DT_DEV_WARP_ENTRIES; k++)
+      pipe->warp_cache->field[k].hash = DT_INVALID_HASH;
+  }
+  dt_dev_warp_cache_t *cache = pipe->warp_cache;
+
+  dt_dev_warp_field_t *field = NULL;
+  dt_dev_warp_field_t *oldest = &cache->field[0];
+  for(int k = 0; k < DT_DEV_WARP_ENTRIES; k++)
+  {
+    dt_dev_warp_field_t *f = &cache->field[k];
+    if(f->hash == hash) field = f;
+    if(f->used < oldest->used) oldest = f;
+  }
+
+  // a field that doesn't cover enough of the points is rebuilt for them,
+  // points in cells marked exact don't count as they would be the same
+  // in a new field
+  size_t inside = 0;
+  if(field)
+  {
+    for(size_t k = 0; k < points_count; k++)
+    {
+      const float gx = (points[2 * k] - field->x0) / field->sx;
+      const float gy = (points[2 * k + 1] - field->y0) / field->sy;
+      if(_dev_warp_in_grid(gx, gy)) inside++;
+    }
+  }
+
+  if(!field || inside < points_count / 4 * 3)
+  {
+    if(points_count < DT_DEV_WARP_MIN_BUILD) return FALSE;
+
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+    for(size_t k = 0; k < points_count; k++)
+    {
+      const float x = points[2 * k];
+      const float y = points[2 * k + 1];
+      if(!isfinite(x) || !isfinite(y)) continue;
+      x0 = MIN(x0, x);
+      y0 = MIN(y0, y);
+      x1 = MAX(x1, x);
+      y1 = MAX(y1, y);
+    }
+    if(x0 > x1 || y0 > y1) return FALSE;
+    // the new grid spans these points only, growing it would make the
+    // cells coarser and leave more of them to the chain
+    if(!field) field = oldest;
+
+    if(!_dev_warp_build(dev, pipe, back, iop_order, transf_direction, field, x0, y0, x1, y1))
+    {
+      _dev_warp_field_clear(field);
+      return FALSE;
+    }
+    field->hash = hash;
+  }
+  field->used = ++cache->clock;
+
+  // points in cells marked exact or outside of the grid go through the chain
+  size_t exact_count = 0;
+  for(size_t k = 0; k < points_count; k++)
+  {
+    float fx, fy;
+    if(_dev_warp_cell(field, points[2 * k], points[2 * k + 1], &fx, &fy) < 0) exact_count++;
+  }
+
+  size_t *exact_idx = NULL;
+  float *exact_pts = NULL;
+  if(exact_count)
+  {
+    exact_idx = g_try_malloc(sizeof(size_t) * exact_count);
+    exact_pts = dt_alloc_align_float(2 * exact_count);
+    if(!exact_idx || !exact_pts)
+    {
+      g_free(exact_idx);
+      dt_free_align(exact_pts);
+      return FALSE;
+    }
+    size_t e = 0;
+    for(size_t k = 0; k < points_count; k++)
+    {
+      float fx, fy;
+      if(_dev_warp_cell(field, points[2 * k], points[2 * k + 1], &fx, &fy) >= 0) continue;
+      exact_idx[e] = k;
+      exact_pts[2 * e] = points[2 * k];
+      exact_pts[2 * e + 1] = points[2 * k + 1];
+      e++;
+    }
+  }
+
+  const dt_dev_warp_field_t *const f = field;
+  DT_OMP_FOR()
+  for(size_t k = 0; k < points_count; k++)
+  {
+    float fx, fy;
+    const int cell = _dev_warp_cell(f, points[2 * k], points[2 * k + 1], &fx, &fy);
+    if(cell < 0) continue;
+    const int i = cell % DT_DEV_WARP_CELLS;
+    const int j = cell / DT_DEV_WARP_CELLS;
+    const float *p00 = f->nodes + 2 * ((size_t)j * (DT_DEV_WARP_CELLS + 1) + i);
+    const float *p10 = p00 + 2;
+    const float *p01 = p00 + 2 * (DT_DEV_WARP_CELLS + 1);
+    const float *p11 = p01 + 2;
+    for(int c = 0; c < 2; c++)
+    {
+      const float top = p00[c] + fx * (p10[c] - p00[c]);
+      const float bottom = p01[c] + fx * (p11[c] - p01[c]);
+      points[2 * k + c] = top + fy * (bottom - top);
+    }
+  }
+
+  *success = TRUE;
+  if(exact_count)
+  {
+    *success = _dev_distort_transform_locked(dev, pipe, back, iop_order, transf_direction,
+                                             exact_pts, exact_count);
+    for(size_t e = 0; e < exact_count; e++)
+    {
+      points[2 * exact_idx[e]] = exact_pts[2 * e];
+      points[2 * exact_idx[e] + 1] = exact_pts[2 * e + 1];
+    }
+    g_free(exact_idx);
+    dt_free_align(exact_pts);
+  }
+  return TRUE;
+}
+
+// running with the history locked
+static gboolean _dev_distort_transform_any(dt_develop_t *dev,
+                                           dt_dev_pixelpipe_t *pipe,
+                                           const gboolean back,
+                                           const double iop_order,
+                                           const dt_dev_transform_direction_t transf_direction,
+                                           float *points,
+                                           const size_t points_count)
+{
+  gboolean success = FALSE;
+  if(_dev_distort_transform_warp(dev, pipe, back, iop_order, transf_direction,
+                                 points, points_count, &success))
+    return success;
+  return _dev_distort_transform_locked(dev, pipe, back, iop_order, transf_direction,
+                                       points, points_count);
+}
+
 // Compute the bounding box of the mask overlay currently being edited
 // (all displayed points, borders and clone sources), expressed in
 // normalised image coordinates where the image spans [-0.5, 0.5]. The
@@ -3961,8 +4395,8 @@ gboolean dt_dev_distort_transform_plus(dt_develop_t *dev,
                                        const size_t points_count)
 {
   dt_pthread_mutex_lock(&dev->history_mutex);
-  const gboolean success = _dev_distort_transform_locked(dev, pipe, FALSE, iop_order,
-                                                         transf_direction, points, points_count);
+  const gboolean success = _dev_distort_transform_any(dev, pipe, FALSE, iop_order,
+                                                      transf_direction, points, points_count);
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return success;
 }
@@ -3976,8 +4410,8 @@ gboolean dt_dev_distort_backtransform_plus(dt_develop_t *dev,
                                            const size_t points_count)
 {
   dt_pthread_mutex_lock(&dev->history_mutex);
-  const gboolean success = _dev_distort_transform_locked(dev, pipe, TRUE, iop_order,
-                                                         transf_direction, points, points_count);
+  const gboolean success = _dev_distort_transform_any(dev, pipe, TRUE, iop_order,
+                                                      transf_direction, points, points_count);
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return success;
 }
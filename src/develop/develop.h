@@ -638,6 +638,8 @@ dt_hash_t dt_dev_hash_distort_plus(dt_develop_t *dev,
                                   struct dt_dev_pixelpipe_t *pipe,
                                   const double iop_order,
                                   const dt_dev_transform_direction_t transf_direction);
+/** free the warp fields the pipe keeps for transforming large point lists */
+void dt_dev_distort_cache_cleanup(struct dt_dev_pixelpipe_t *pipe);
 /*
  *   history undo support helpers for darkroom
  */
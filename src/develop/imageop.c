@@ -2397,6 +2397,7 @@ void dt_iop_commit_params(dt_iop_module_t *module,
   module->commit_params(module, params, pipe, piece);
 
   dt_hash_t phash = DT_INVALID_HASH;
+  dt_hash_t params_hash = DT_INVALID_HASH;
   // 2. compute the hash only if piece is enabled
   if(piece->enabled)
   {
@@ -2407,6 +2408,7 @@ void dt_iop_commit_params(dt_iop_module_t *module,
     if(is_blending)
     {
       phash = dt_hash(phash, blendop_params, sizeof(dt_develop_blend_params_t));
+      params_hash = phash;
 
       dt_masks_form_t *grp = dt_masks_get_from_id(darktable.develop, blendop_params->mask_id);
       if(grp)
@@ -2414,8 +2416,12 @@ void dt_iop_commit_params(dt_iop_module_t *module,
         phash = dt_masks_group_hash(phash, grp);
       }
     }
+    else
+      params_hash = phash;
   }
   piece->hash = phash;
+  // tells the pipe if only drawn shapes changed
+  piece->params_hash = params_hash;
 }
 
 void dt_iop_gui_cleanup_module(dt_iop_module_t *module)
@@ -107,6 +107,10 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_WRITE_RASTER = 1 << 19,      // modules not supporting blending might still advertise a raster mask
   IOP_FLAGS_WRITE_PIPECACHE = 1 << 20,   // enforce pipecache writing
   IOP_FLAGS_WRITE_PIPECACHE_IN = 1 << 21, // makes input cacheline important, also ensure input pipecache writing for OpenCL code
+  IOP_FLAGS_TILING_PARALLEL = 1 << 22,   // process() may run on independent tiles concurrently, used for speed on CPU
+  IOP_FLAGS_FUSED_WARP = 1 << 23,        // process() only resamples along distort_backtransform(), may be fused with neighbouring warps
+  IOP_FLAGS_WHOLE_IMAGE = 1 << 24,       // process() derives statistics from its whole input, an export must not feed it strips
+  IOP_FLAGS_POINTWISE = 1 << 25,         // process() computes each output pixel from the input pixel at the same position only
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -26,6 +26,7 @@
 #include <assert.h> // for assert
 #include <glib.h> // for MIN, MAX, CLAMP, inline
 #include <math.h> // for round, floorf, fmaxf
+#include <string.h> // for memset
 
 void dt_iop_flip_and_zoom_8(const uint8_t *in,
                             const int32_t iw,
@@ -95,6 +96,71 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in,
   }
 }
 
+void dt_iop_downsample_8(const uint8_t *in,
+                         const int32_t iw,
+                         const int32_t ih,
+                         uint8_t *out,
+                         const int32_t ow,
+                         const int32_t oh,
+                         uint32_t *width,
+                         uint32_t *height)
+{
+  // same output size as dt_iop_flip_and_zoom_8(), never upscale
+  const float scale = fmaxf(1.0f, fmaxf(iw / (float)ow, ih / (float)oh));
+  const uint32_t wd = *width = MIN(ow, iw / scale);
+  const uint32_t ht = *height = MIN(oh, ih / scale);
+  if(wd == 0 || ht == 0) return;
+
+  size_t padded_size;
+  float *const rows = dt_alloc_perthread_float((size_t)4 * iw, &padded_size);
+  if(!rows)
+  {
+    dt_iop_flip_and_zoom_8(in, iw, ih, out, ow, oh, ORIENTATION_NONE, width, height);
+    return;
+  }
+
+  // each output pixel is the mean of the input area it covers, with the
+  // input pixels on its border weighted by how much of them is covered
+  const float sx = iw / (float)wd;
+  const float sy = ih / (float)ht;
+  DT_OMP_FOR()
+  for(uint32_t j = 0; j < ht; j++)
+  {
+    float *const restrict acc = dt_get_perthread(rows, padded_size);
+    const float y0 = j * sy;
+    const float y1 = fminf((j + 1) * sy, ih);
+    const int r1 = MIN((int)ceilf(y1), ih);
+    memset(acc, 0, sizeof(float) * 4 * iw);
+    for(int r = (int)y0; r < r1; r++)
+    {
+      const float w = fminf(r + 1.0f, y1) - fmaxf(r, y0);
+      const uint8_t *const restrict row = in + (size_t)4 * iw * r;
+      DT_OMP_SIMD()
+      for(size_t k = 0; k < (size_t)4 * iw; k++)
+        acc[k] += w * row[k];
+    }
+
+    uint8_t *const out2 = out + (size_t)4 * wd * j;
+    for(uint32_t i = 0; i < wd; i++)
+    {
+      const float x0 = i * sx;
+      const float x1 = fminf((i + 1) * sx, iw);
+      const int c1 = MIN((int)ceilf(x1), iw);
+      dt_aligned_pixel_t sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for(int c = (int)x0; c < c1; c++)
+      {
+        const float w = fminf(c + 1.0f, x1) - fmaxf(c, x0);
+        for_four_channels(k)
+          sum[k] += w * acc[4 * c + k];
+      }
+      const float norm = 1.0f / ((x1 - x0) * (y1 - y0));
+      for_four_channels(k)
+        out2[4 * i + k] = CLAMP((int)(sum[k] * norm + 0.5f), 0, 255);
+    }
+  }
+  dt_free_align(rows);
+}
+
 void dt_iop_clip_and_zoom_8(const uint8_t *i,
                             const int32_t ix,
                             const int32_t iy,
@@ -17,11 +17,17 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/file_location.h"
+#include "common/interpolation.h"
+#include "common/iop_profile.h"
+#include "control/conf.h"
 #include "develop/format.h"
 #include "develop/pixelpipe.h"
 #include "libs/lib.h"
 #include "libs/colorpicker.h"
+#include <glib/gstdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 gboolean dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_t *pipe,
                                      const int entries,
@@ -32,15 +38,22 @@ gboolean dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_t *pipe,
 
   cache->entries = entries;
   cache->allmem = cache->max_allmem = cache->hits = cache->calls = cache->tests = 0;
+  cache->evictions = 0;
+  cache->saved_time = cache->evicted_time = 0.0;
   cache->mem_fraction = fraction;
 
-  const size_t csize = sizeof(void *) + sizeof(size_t) + sizeof(dt_iop_buffer_dsc_t) + 2*sizeof(int32_t) + sizeof(uint64_t);
+  cache->disk_hits = cache->disk_writes = 0;
+  cache->disk_limit = (size_t)MAX(0, dt_conf_get_int("cache_pixelpipe_disk_size")) * DT_MEGA;
+  cache->disk_min_time = dt_conf_get_float("cache_pixelpipe_disk_min_time");
+
+  const size_t csize = sizeof(void *) + sizeof(size_t) + sizeof(dt_iop_buffer_dsc_t) + 2*sizeof(int32_t) + sizeof(uint64_t) + sizeof(float);
   cache->data = (void **) calloc(entries, csize);
   cache->size = (size_t *)((void *)cache->data + entries * sizeof(void *));
   cache->dsc = (dt_iop_buffer_dsc_t *)((void *)cache->size + entries * sizeof(size_t));
   cache->hash = (dt_hash_t *)((void *)cache->dsc + entries * sizeof(dt_iop_buffer_dsc_t));
   cache->used = (int32_t *)((void *)cache->hash + entries * sizeof(dt_hash_t));
   cache->ioporder = (int32_t *)((void *)cache->used + entries * sizeof(int32_t));
+  cache->cost = (float *)((void *)cache->ioporder + entries * sizeof(int32_t));
 
   for(int k = 0; k < entries; k++)
   {
@@ -86,6 +99,9 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_t *pipe)
       (double)(cache->hits) / fmax(1.0, pipe->runs),
       (double)(cache->hits) / fmax(1.0, cache->tests));
   }
+  if(cache->disk_limit)
+    dt_print_pipe(DT_DEBUG_PIPE, "disk cache report", pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
+      "hits=%" PRIu64 " writes=%" PRIu64, cache->disk_hits, cache->disk_writes);
 
   for(int k = 0; k < cache->entries; k++)
   {
@@ -96,9 +112,21 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_t *pipe)
   cache->data = NULL;
 }
 
+static dt_hash_t _profile_hash(dt_hash_t hash,
+                               const dt_iop_order_iccprofile_info_t *info)
+{
+  if(!info)
+    return dt_hash(hash, &info, sizeof(info));
+
+  hash = dt_hash(hash, &info->type, sizeof(info->type));
+  hash = dt_hash(hash, info->filename, strlen(info->filename));
+  return dt_hash(hash, &info->intent, sizeof(info->intent));
+}
+
 static dt_hash_t _dev_pixelpipe_cache_basichash(dt_dev_pixelpipe_t *pipe,
                                                 const int position,
-                                                const dt_iop_roi_t *roi)
+                                                const dt_iop_roi_t *roi,
+                                                const gboolean persistent)
 {
   /* What do we use for the basic hash
        1) imgid as all structures using the hash might possibly contain data from other images
@@ -113,15 +141,41 @@ static dt_hash_t _dev_pixelpipe_cache_basichash(dt_dev_pixelpipe_t *pipe,
        5) Please note that position is not the iop_order but the position in the pipe
        6) Please note that pipe->type, want_details and request_color_pick are only used if a roi is provided
           for better support of dt_dev_pixelpipe_piece_hash()
+       7) For a persistent hash the profiles are identified by content instead of their address,
+          the image by the path, modification time and size of its file (pipe->source_hash)
+          as ids differ between libraries and darktable-cli runs,
+          and the darktable version is included as processing might change between releases.
+          The preferences changing the processing without being part of any module's params
+          (interpolators, fused warping and parallel tiling) are included as well, as they
+          differ between configurations sharing a cache directory.
   */
-  const uint32_t hashing_pipemode[3] = {(uint32_t)pipe->image.id,
+  const uint32_t hashing_pipemode[3] = {persistent ? 0u : (uint32_t)pipe->image.id,
                                         (uint32_t)pipe->type,
                                         (uint32_t)pipe->want_detail_mask };
   dt_hash_t hash = dt_hash(DT_INITHASH, &hashing_pipemode, sizeof(uint32_t) * (roi ? 3 : 1));
-  hash = dt_hash(hash, &pipe->input_profile_info, sizeof(pipe->input_profile_info));
-  hash = dt_hash(hash, &pipe->work_profile_info, sizeof(pipe->work_profile_info));
-  hash = dt_hash(hash, &pipe->output_profile_info, sizeof(pipe->output_profile_info));
-  hash = dt_hash(hash, &pipe->export_profile_info, sizeof(pipe->export_profile_info));
+  if(persistent)
+  {
+    hash = dt_hash(hash, darktable_package_version, strlen(darktable_package_version));
+    hash = dt_hash(hash, &pipe->source_hash, sizeof(pipe->source_hash));
+    hash = _profile_hash(hash, pipe->input_profile_info);
+    hash = _profile_hash(hash, pipe->work_profile_info);
+    hash = _profile_hash(hash, pipe->output_profile_info);
+    hash = _profile_hash(hash, pipe->export_profile_info);
+
+    const uint32_t processing[4] =
+      { (uint32_t)dt_interpolation_new(DT_INTERPOLATION_USERPREF)->id,
+        (uint32_t)dt_interpolation_new(DT_INTERPOLATION_USERPREF_WARP)->id,
+        (uint32_t)dt_conf_get_bool("pixelpipe_fused_warp"),
+        (uint32_t)dt_conf_get_bool("tiling_parallel") };
+    hash = dt_hash(hash, processing, sizeof(processing));
+  }
+  else
+  {
+    hash = dt_hash(hash, &pipe->input_profile_info, sizeof(pipe->input_profile_info));
+    hash = dt_hash(hash, &pipe->work_profile_info, sizeof(pipe->work_profile_info));
+    hash = dt_hash(hash, &pipe->output_profile_info, sizeof(pipe->output_profile_info));
+    hash = dt_hash(hash, &pipe->export_profile_info, sizeof(pipe->export_profile_info));
+  }
 
   // go through all modules up to position and compute a hash using the operation and params.
   GList *pieces = pipe->nodes;
@@ -161,7 +215,7 @@ dt_hash_t dt_dev_pixelpipe_cache_hash(const dt_iop_roi_t *roi,
                                       dt_dev_pixelpipe_t *pipe,
                                       const int position)
 {
-  dt_hash_t hash = _dev_pixelpipe_cache_basichash(pipe, position, roi);
+  dt_hash_t hash = _dev_pixelpipe_cache_basichash(pipe, position, roi, FALSE);
   // also include roi data if provided
   if(roi)
   {
@@ -171,6 +225,259 @@ dt_hash_t dt_dev_pixelpipe_cache_hash(const dt_iop_roi_t *roi,
   return hash;
 }
 
+dt_hash_t dt_dev_pixelpipe_cache_persistent_hash(const dt_iop_roi_t *roi,
+                                                 dt_dev_pixelpipe_t *pipe,
+                                                 const int position)
+{
+  dt_hash_t hash = _dev_pixelpipe_cache_basichash(pipe, position, roi, TRUE);
+  if(roi)
+  {
+    hash = dt_hash(hash, roi, sizeof(dt_iop_roi_t));
+    hash = dt_hash(hash, &pipe->scharr.hash, sizeof(pipe->scharr.hash));
+  }
+  return hash;
+}
+
+/* The disk tier keeps expensive module outputs across sessions and darktable-cli runs.
+   Every cacheline is stored in its own file named by the persistent hash, holding a
+   small header followed by the raw buffer. Files are written to a temporary name and
+   renamed so concurrent processes never see partial data, the file modification time
+   is used for lru eviction once the configured size is exceeded.
+*/
+#define DT_PIPECACHE_DISK_MAGIC "dtppc001"
+
+typedef struct _disk_header_t
+{
+  char magic[8];
+  dt_hash_t hash;
+  uint64_t size;
+  dt_iop_buffer_dsc_t dsc;
+} _disk_header_t;
+
+static gchar *_disk_dir(void)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  return g_build_filename(cachedir, "pixelpipe", NULL);
+}
+
+static gchar *_disk_filename(const dt_hash_t hash)
+{
+  gchar *dir = _disk_dir();
+  gchar *name = g_strdup_printf("%016" PRIx64 ".ppc", hash);
+  gchar *filename = g_build_filename(dir, name, NULL);
+  g_free(name);
+  g_free(dir);
+  return filename;
+}
+
+static inline gboolean _disk_usable(const dt_dev_pixelpipe_t *pipe,
+                                    const dt_iop_module_t *module)
+{
+  // the disk tier is only used by pipes processing the image at full
+  // quality, previews and thumbnails are cheap enough to recompute.
+  return pipe->cache.disk_limit
+    && (pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_EXPORT))
+    && module
+    && !pipe->nocache
+    && dt_pipe_no_mask_display(pipe);
+}
+
+typedef struct _disk_file_t
+{
+  gchar *filename;
+  GTimeSpan mtime;
+  size_t size;
+} _disk_file_t;
+
+static gint _disk_file_older(gconstpointer a, gconstpointer b)
+{
+  const GTimeSpan ta = ((const _disk_file_t *)a)->mtime;
+  const GTimeSpan tb = ((const _disk_file_t *)b)->mtime;
+  return ta < tb ? -1 : ta > tb;
+}
+
+static void _disk_file_free(gpointer data)
+{
+  _disk_file_t *file = data;
+  g_free(file->filename);
+  g_free(file);
+}
+
+// running size of the disk tier, only rescanned when it exceeds the limit.
+// files written by other processes are found by that rescan.
+static GMutex _disk_lock;
+static size_t _disk_total = 0;
+static gboolean _disk_scanned = FALSE;
+
+// remove least recently used files until the tier fits into its limit,
+// returns the size left
+static size_t _disk_evict(const size_t limit)
+{
+  gchar *dir = _disk_dir();
+  GDir *gdir = g_dir_open(dir, 0, NULL);
+  if(!gdir)
+  {
+    g_free(dir);
+    return 0;
+  }
+
+  GList *files = NULL;
+  size_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(gdir)))
+  {
+    if(!g_str_has_suffix(name, ".ppc")) continue;
+    _disk_file_t *file = g_malloc(sizeof(_disk_file_t));
+    file->filename = g_build_filename(dir, name, NULL);
+    GStatBuf st;
+    if(g_stat(file->filename, &st))
+    {
+      _disk_file_free(file);
+      continue;
+    }
+    file->mtime = st.st_mtime;
+    file->size = st.st_size;
+    total += file->size;
+    files = g_list_prepend(files, file);
+  }
+  g_dir_close(gdir);
+
+  files = g_list_sort(files, _disk_file_older);
+  for(GList *f = files; f && total > limit; f = g_list_next(f))
+  {
+    const _disk_file_t *file = f->data;
+    if(!g_unlink(file->filename))
+      total -= file->size;
+  }
+  g_list_free_full(files, _disk_file_free);
+  g_free(dir);
+  return total;
+}
+
+gboolean dt_dev_pixelpipe_cache_disk_load(dt_dev_pixelpipe_t *pipe,
+                                          const dt_iop_roi_t *roi,
+                                          const int position,
+                                          const dt_hash_t hash,
+                                          const size_t size,
+                                          void **data,
+                                          dt_iop_buffer_dsc_t **dsc,
+                                          const dt_iop_module_t *module)
+{
+  if(!_disk_usable(pipe, module) || hash == DT_INVALID_HASH)
+    return FALSE;
+
+  const dt_hash_t phash = dt_dev_pixelpipe_cache_persistent_hash(roi, pipe, position);
+  gchar *filename = _disk_filename(phash);
+  GMappedFile *map = g_mapped_file_new(filename, FALSE, NULL);
+  if(!map)
+  {
+    g_free(filename);
+    return FALSE;
+  }
+
+  const _disk_header_t *header = (const _disk_header_t *)g_mapped_file_get_contents(map);
+  const gboolean valid = g_mapped_file_get_length(map) == sizeof(_disk_header_t) + size
+    && !memcmp(header->magic, DT_PIPECACHE_DISK_MAGIC, sizeof(header->magic))
+    && header->hash == phash
+    && header->size == size;
+
+  if(valid)
+  {
+    // the stored descriptor has to be copied before the cacheline gets it
+    dt_iop_buffer_dsc_t stored = header->dsc;
+    dt_iop_buffer_dsc_t *stored_dsc = &stored;
+    dt_dev_pixelpipe_cache_get(pipe, hash, size, data, &stored_dsc, module, TRUE);
+    if(*data)
+    {
+      memcpy(*data, (const char *)header + sizeof(_disk_header_t), size);
+      *dsc = stored_dsc;
+      pipe->cache.disk_hits++;
+      // mark as recently used
+      g_utime(filename, NULL);
+    }
+    else
+      dt_dev_pixelpipe_invalidate_cacheline(pipe, *data, NULL);
+  }
+  else
+    dt_print_pipe(DT_DEBUG_PIPE, "disk cache mismatch",
+                  pipe, module, DT_DEVICE_NONE, roi, NULL, "%s", filename);
+
+  g_mapped_file_unref(map);
+  if(!valid) g_unlink(filename);
+  g_free(filename);
+  return valid && *data;
+}
+
+void dt_dev_pixelpipe_cache_disk_store(dt_dev_pixelpipe_t *pipe,
+                                       const dt_iop_roi_t *roi,
+                                       const int position,
+                                       const void *data,
+                                       const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc,
+                                       const dt_iop_module_t *module,
+                                       const double runtime)
+{
+  dt_dev_pixelpipe_cache_t *cache = &pipe->cache;
+  if(!_disk_usable(pipe, module)
+     || !data
+     || runtime < cache->disk_min_time
+     || size + sizeof(_disk_header_t) > cache->disk_limit)
+    return;
+
+  const dt_hash_t phash = dt_dev_pixelpipe_cache_persistent_hash(roi, pipe, position);
+  gchar *filename = _disk_filename(phash);
+  if(g_file_test(filename, G_FILE_TEST_EXISTS))
+  {
+    g_free(filename);
+    return;
+  }
+
+  gchar *dir = _disk_dir();
+  g_mkdir_with_parents(dir, 0750);
+  g_free(dir);
+
+  _disk_header_t header = { .hash = phash, .size = size, .dsc = *dsc };
+  memcpy(header.magic, DT_PIPECACHE_DISK_MAGIC, sizeof(header.magic));
+
+  // unique per writer, several pipes or processes may store the same line
+  gchar *tmpname = g_strconcat(filename, ".XXXXXX", NULL);
+  const int fd = g_mkstemp(tmpname);
+  FILE *f = fd != -1 ? fdopen(fd, "wb") : NULL;
+  if(fd != -1 && !f) g_close(fd, NULL);
+  gboolean ok = f != NULL;
+  if(f)
+  {
+    ok = fwrite(&header, sizeof(header), 1, f) == 1
+      && fwrite(data, size, 1, f) == 1;
+    ok = !fclose(f) && ok;
+  }
+  if(ok)
+    ok = !g_rename(tmpname, filename);
+  if(!ok && fd != -1)
+    g_unlink(tmpname);
+
+  if(ok)
+  {
+    cache->disk_writes++;
+    dt_print_pipe(DT_DEBUG_PIPE, "disk cache store",
+                  pipe, module, DT_DEVICE_NONE, roi, NULL, "%zuMB, took %.3fs to compute",
+                  size / DT_MEGA, runtime);
+
+    g_mutex_lock(&_disk_lock);
+    _disk_total += sizeof(_disk_header_t) + size;
+    if(!_disk_scanned || _disk_total > cache->disk_limit)
+    {
+      _disk_total = _disk_evict(cache->disk_limit);
+      _disk_scanned = TRUE;
+    }
+    g_mutex_unlock(&_disk_lock);
+  }
+
+  g_free(tmpname);
+  g_free(filename);
+}
+
 gboolean dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_t *pipe,
                                           const dt_hash_t hash,
                                           const size_t size)
@@ -188,31 +495,50 @@ gboolean dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_t *pipe,
     if((cache->size[k] == size) && (cache->hash[k] == hash))
     {
       cache->hits++;
+      cache->saved_time += cache->cost[k];
       return TRUE;
     }
   }
   return FALSE;
 }
 
+// recomputation cost per MB of cacheline at which a line ages half as fast.
+// 1ms/MB is a cheap module like exposure on a large image, a slow denoise is
+// a thousand times more expensive.
+#define DT_PIPECACHE_COST_REF 0.001f
+
+// The age of a cacheline weighted by what it would cost to recompute it relative to its size,
+// so expensive lines survive longer than cheap ones of the same size.
+static inline float _weighted_age(const dt_dev_pixelpipe_cache_t *cache,
+                                  const int k)
+{
+  const float mb = MAX(1.0f, (float)cache->size[k] / DT_MEGA);
+  return (float)cache->used[k] / (1.0f + cache->cost[k] / mb / DT_PIPECACHE_COST_REF);
+}
+
 // While looking for the oldest cacheline we always ignore the first two lines as they are used
 // for swapping buffers while in entries==DT_PIPECACHE_MIN or masking mode
 static int _get_oldest_cacheline(dt_dev_pixelpipe_cache_t *cache,
                                  const dt_dev_pixelpipe_cache_test_t mode)
 {
   // we never want the latest used cacheline! It was <= 0 and the weight has increased just now
-  int age = 1;
+  float age = 0.0f;
   int id = 0;
   for(int k = DT_PIPECACHE_MIN; k < cache->entries; k++)
   {
-    gboolean older = (cache->used[k] > age) && (k != cache->lastline);
+    gboolean older = (cache->used[k] > 1) && (k != cache->lastline);
     if(older)
     {
       if(mode == DT_CACHETEST_USED)         older = cache->data[k] != NULL;
       else if(mode == DT_CACHETEST_FREE)    older = cache->data[k] == NULL;
       else if(mode == DT_CACHETEST_INVALID) older = cache->hash[k] == DT_INVALID_HASH;
-      if(older)
+      // free and invalid lines hold nothing worth keeping so plain age is fine
+      const float weighted = (mode == DT_CACHETEST_USED || mode == DT_CACHETEST_PLAIN)
+                             ? _weighted_age(cache, k)
+                             : (float)cache->used[k];
+      if(older && weighted > age)
       {
-        age = cache->used[k];
+        age = weighted;
         id = k;
       }
     }
@@ -220,6 +546,16 @@ static int _get_oldest_cacheline(dt_dev_pixelpipe_cache_t *cache,
   return id;
 }
 
+static inline void _count_eviction(dt_dev_pixelpipe_cache_t *cache,
+                                   const int k)
+{
+  if(cache->data[k] && cache->hash[k] != DT_INVALID_HASH)
+  {
+    cache->evictions++;
+    cache->evicted_time += cache->cost[k];
+  }
+}
+
 static int _get_c_cacheline(dt_dev_pixelpipe_cache_t *cache)
 {
   int oldest = _get_oldest_cacheline(cache, DT_CACHETEST_INVALID);
@@ -242,6 +578,7 @@ static int _get_cacheline(dt_dev_pixelpipe_t *pipe)
     return cache->calls & 1;
 
   cache->lastline = _get_c_cacheline(cache);
+  _count_eviction(cache, cache->lastline);
   return cache->lastline;
 }
 
@@ -360,6 +697,7 @@ gboolean dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_t *pipe,
 
   cache->used[cline]      = !masking && important ? -cache->entries : 0;
   cache->ioporder[cline]  = module ? module->iop_order : 0;
+  cache->cost[cline]      = 0.0f;
 
   return TRUE;
 }
@@ -397,6 +735,18 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cache_invalidate_later(pipe, 0, "flush: ");
 }
 
+void dt_dev_pixelpipe_cache_set_cost(const dt_dev_pixelpipe_t *pipe,
+                                     const void *data,
+                                     const float cost)
+{
+  const dt_dev_pixelpipe_cache_t *cache = &pipe->cache;
+  for(int k = DT_PIPECACHE_MIN; k < cache->entries; k++)
+  {
+    if(cache->data[k] == data && cache->hash[k] != DT_INVALID_HASH)
+      cache->cost[k] = cost;
+  }
+}
+
 void dt_dev_pixelpipe_important_cacheline(const dt_dev_pixelpipe_t *pipe,
                                           const void *data,
                                           const size_t size)
@@ -438,6 +788,7 @@ static size_t _free_cacheline(dt_dev_pixelpipe_cache_t *cache, const int k)
   cache->data[k] = NULL;
   cache->hash[k] = DT_INVALID_HASH;
   cache->ioporder[k] = 0;
+  cache->cost[k] = 0.0f;
   return removed;
 }
 
@@ -513,6 +864,7 @@ void dt_dev_pixelpipe_cache_checkmem(dt_dev_pixelpipe_t *pipe, const gboolean tr
     const int k = _get_oldest_cacheline(cache, DT_CACHETEST_USED);
     if(k == 0) break;
 
+    _count_eviction(cache, k);
     freed += _free_cacheline(cache, k);
     free_cnt++;
   }
@@ -537,6 +889,22 @@ void dt_dev_pixelpipe_cache_report(dt_dev_pixelpipe_t *pipe)
     cache->allmem / DT_MEGA, limit / DT_MEGA, cache->max_allmem / DT_MEGA,
     (double)(cache->hits) / fmax(1.0, pipe->runs),
     (double)(cache->hits) / fmax(1.0, cache->tests));
+  dt_print_pipe(DT_DEBUG_PIPE | DT_DEBUG_MEMORY, "cache report", pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
+    "Hits=%" PRIu64 " misses=%" PRIu64 " evictions=%" PRIu64 ". Saved %.3fs by hits, evicted lines took %.3fs",
+    cache->hits, cache->tests - cache->hits, cache->evictions,
+    cache->saved_time, cache->evicted_time);
+
+  if(darktable.unmuted & DT_DEBUG_VERBOSE)
+  {
+    for(int k = DT_PIPECACHE_MIN; k < cache->entries; k++)
+    {
+      if(cache->data[k] && cache->hash[k] != DT_INVALID_HASH)
+        dt_print_pipe(DT_DEBUG_PIPE | DT_DEBUG_MEMORY, "cache line", pipe, NULL, DT_DEVICE_NONE, NULL, NULL,
+          "%3i iop_order=%4i %6zuMB used=%4i cost=%.3fs weighted age=%.2f",
+          k, cache->ioporder[k], cache->size[k] / DT_MEGA, cache->used[k], cache->cost[k],
+          _weighted_age(cache, k));
+    }
+  }
 }
 
 // clang-format off
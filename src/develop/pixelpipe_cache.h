@@ -42,11 +42,20 @@ typedef struct dt_dev_pixelpipe_cache_t
   dt_hash_t *hash;
   int32_t *used;
   int32_t *ioporder;
+  float *cost;       // measured time in seconds to compute the cacheline
   uint64_t calls;
   int32_t lastline;
   // profiling
   uint64_t tests;
   uint64_t hits;
+  uint64_t evictions;
+  double saved_time;   // recomputation time saved by cache hits
+  double evicted_time; // recomputation time thrown away by evictions
+  // persistent disk tier, disabled if disk_limit is 0
+  size_t disk_limit;
+  double disk_min_time;
+  uint64_t disk_hits;
+  uint64_t disk_writes;
 } dt_dev_pixelpipe_cache_t;
 
 typedef enum dt_dev_pixelpipe_cache_test_t
@@ -67,6 +76,25 @@ void dt_dev_pixelpipe_cache_cleanup(struct dt_dev_pixelpipe_t *pipe);
 dt_hash_t dt_dev_pixelpipe_cache_hash(const struct dt_iop_roi_t *roi,
                                      struct dt_dev_pixelpipe_t *pipe, const int position);
 
+/** same as dt_dev_pixelpipe_cache_hash() but stable across sessions and processes,
+    used as key for the disk tier. */
+dt_hash_t dt_dev_pixelpipe_cache_persistent_hash(const struct dt_iop_roi_t *roi,
+                                                 struct dt_dev_pixelpipe_t *pipe, const int position);
+
+/** look for the output of the module at position in the disk tier. On success a cacheline
+    for hash is filled with the stored data and returned in 'data' and 'dsc' like a cache hit.
+*/
+gboolean dt_dev_pixelpipe_cache_disk_load(struct dt_dev_pixelpipe_t *pipe, const struct dt_iop_roi_t *roi,
+                                          const int position, const dt_hash_t hash, const size_t size,
+                                          void **data, struct dt_iop_buffer_dsc_t **dsc,
+                                          const struct dt_iop_module_t *module);
+
+/** write a freshly processed module output to the disk tier if it was expensive enough to compute. */
+void dt_dev_pixelpipe_cache_disk_store(struct dt_dev_pixelpipe_t *pipe, const struct dt_iop_roi_t *roi,
+                                       const int position, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc,
+                                       const struct dt_iop_module_t *module, const double runtime);
+
 /** returns a float data buffer in 'data' for the given hash from the cache, dsc is updated too.
   If the hash does not match any cache line, use an old buffer or allocate a fresh one.
   The size of the buffer in 'data' will be at least of size bytes.
@@ -84,6 +112,9 @@ void dt_dev_pixelpipe_cache_flush(struct dt_dev_pixelpipe_t *pipe);
 /** invalidates all cachelines for modules with at least the same iop_order */
 void dt_dev_pixelpipe_cache_invalidate_later(struct dt_dev_pixelpipe_t *pipe, const int32_t order, const char *info);
 
+/** record how long it took to compute this buffer, used to keep expensive cachelines longer. */
+void dt_dev_pixelpipe_cache_set_cost(const struct dt_dev_pixelpipe_t *pipe, const void *data, const float cost);
+
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_important_cacheline(const struct dt_dev_pixelpipe_t *pipe, const void *data, const size_t size);
 
@@ -18,11 +18,15 @@
 
 #include "common/color_picker.h"
 #include "common/colorspaces.h"
+#include "common/export_timing.h"
 #include "common/histogram.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
 #include "common/imagebuf.h"
+#include "common/interpolation.h"
+#include "common/trace.h"
 #include "control/control.h"
+#include "control/conf.h"
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/format.h"
@@ -69,6 +73,7 @@ static inline gboolean _is_debug_pipe(dt_dev_pixelpipe_t *pipe)
 // forward declarations for mask cache helpers
 static void _clear_piece_mask_caches(dt_dev_pixelpipe_iop_t *piece);
 static void _free_distort_bufs(dt_dev_pixelpipe_t *pipe);
+static inline gboolean _skip_piece_on_tags(const dt_dev_pixelpipe_iop_t *piece);
 
 typedef enum dt_pixelpipe_flow_t
 {
@@ -313,9 +318,11 @@ gboolean dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe,
   pipe->bcache_data = NULL;
   pipe->bcache_size = 0;
   pipe->bcache_hash = DT_INVALID_HASH;
+  pipe->source_hash = DT_INVALID_HASH;
   memset(pipe->mask_distort_buf, 0, sizeof(pipe->mask_distort_buf));
   memset(pipe->mask_distort_buf_size, 0, sizeof(pipe->mask_distort_buf_size));
   pipe->mask_cache_size = 0;
+  pipe->warp_cache = NULL;
   return dt_dev_pixelpipe_cache_init(pipe, entries, size, fraction);
 }
 
@@ -371,6 +378,24 @@ static void get_output_format(dt_iop_module_t *module,
   }
 }
 
+// identifies the source file across libraries and darktable-cli runs,
+// unlike the image id or the import time
+static dt_hash_t _source_hash(const dt_imgid_t imgid)
+{
+  char path[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(imgid, path, sizeof(path), &from_cache);
+  dt_hash_t hash = dt_hash(DT_INITHASH, path, strlen(path));
+
+  GStatBuf st;
+  if(g_stat(path, &st) == 0)
+  {
+    const int64_t stamp[2] = { (int64_t)st.st_mtime, (int64_t)st.st_size };
+    hash = dt_hash(hash, stamp, sizeof(stamp));
+  }
+  return hash;
+}
+
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe,
                                 dt_develop_t *dev,
                                 float *input,
@@ -383,6 +408,11 @@ void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe,
   pipe->iscale = iscale;
   pipe->input = input;
   pipe->image = dev->image_storage;
+  // only the persistent disk tier needs the source file, spare the
+  // database query and stat otherwise
+  pipe->source_hash = pipe->cache.disk_limit
+    ? _source_hash(pipe->image.id)
+    : DT_INVALID_HASH;
   get_output_format(NULL, pipe, NULL, &pipe->dsc);
 }
 
@@ -425,6 +455,7 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_free_align(pipe->bcache_data);
   pipe->bcache_size = 0;
   _free_distort_bufs(pipe);
+  dt_dev_distort_cache_cleanup(pipe);
 
   pipe->icc_type = DT_COLORSPACE_NONE;
   g_free(pipe->icc_filename);
@@ -445,6 +476,12 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
     g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
     pipe->forms = NULL;
   }
+  if(pipe->patch.forms)
+  {
+    g_list_free_full(pipe->patch.forms, (void (*)(void *))dt_masks_free_form);
+    pipe->patch.forms = NULL;
+  }
+  pipe->patch.valid = FALSE;
   dt_pthread_mutex_destroy(&pipe->busy_mutex);
   dt_pthread_mutex_destroy(&pipe->mutex);
 }
@@ -519,6 +556,8 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe,
   pipe->iop_order_list = dt_ioppr_iop_order_copy_deep(dev->iop_order_list);
   // for all modules in dev:
   pipe->iop = g_list_copy(dev->iop);
+  // the new pieces can't be compared to the last output
+  pipe->patch.valid = FALSE;
 
   for(GList *modules = pipe->iop; modules; modules = g_list_next(modules))
   {
@@ -544,6 +583,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe,
                                                 g_direct_equal, NULL, dt_free_align_ptr);
     memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
     memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
+    piece->fused_warp = NULL;
     dt_iop_init_pipe(piece->module, pipe, piece);
     pipe->nodes = g_list_append(pipe->nodes, piece);
   }
@@ -1538,6 +1578,105 @@ static void _cpu_benchmark(dt_dev_pixelpipe_t *pipe,
   darktable.unmuted = old_muted;
 }
 
+/* Fused warps.
+
+   Each geometric module resamples its input on its own, so an export
+   with perspective correction, rotation and crop interpolates the image
+   several times. In export and thumbnail pipes a run of consecutive
+   modules flagged IOP_FLAGS_FUSED_WARP, with nothing but disabled
+   modules in between, is processed by its last piece in one pass:
+   every output pixel is mapped through the distort_backtransform() of
+   all pieces of the run and interpolated once from the input of the
+   first one. Pieces that blend can't be part of a run as they need
+   their own input and output.
+*/
+static inline gboolean _fused_warp_pipe(const dt_dev_pixelpipe_t *pipe)
+{
+  return (dt_pipe_is_export(pipe) || dt_pipe_is_thumb(pipe))
+    && dt_pipe_no_mask_display(pipe)
+    && dt_conf_get_bool("pixelpipe_fused_warp");
+}
+
+static inline gboolean _fused_warp_member(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  return (module->flags() & IOP_FLAGS_FUSED_WARP)
+    && module->distort_backtransform
+    && !_skip_piece_on_tags(piece)
+    && !_transform_for_blend(module, piece)
+    && !_piece_wants_blending(piece)
+    && module->input_colorspace(module, piece->pipe, piece) == IOP_CS_RGB;
+}
+
+// TRUE if piece ends a run of at least two warps resampled in one pass
+static gboolean _fused_warp_run_end(const dt_dev_pixelpipe_t *pipe,
+                                    GList *pieces)
+{
+  if(!pieces || !_fused_warp_pipe(pipe) || !_fused_warp_member(pieces->data))
+    return FALSE;
+  for(GList *p = g_list_previous(pieces); p; p = g_list_previous(p))
+  {
+    dt_dev_pixelpipe_iop_t *prev = p->data;
+    if(!_skip_piece_on_tags(prev)) return _fused_warp_member(prev);
+  }
+  return FALSE;
+}
+
+static void _fused_warp_process(dt_dev_pixelpipe_t *pipe,
+                                dt_dev_pixelpipe_iop_t *piece,
+                                const float *const input,
+                                float *const output,
+                                const dt_iop_roi_t *const roi_in,
+                                const dt_iop_roi_t *const roi_out)
+{
+  const int ch = 4;
+  const int ch_width = ch * roi_in->width;
+  const int width = roi_out->width;
+  GList *first = piece->fused_warp;
+  GList *last = g_list_find(pipe->nodes, piece);
+
+  size_t padded_size;
+  float *rows = dt_alloc_perthread_float(2 * width, &padded_size);
+  if(!rows)
+  {
+    dt_print_pipe(DT_DEBUG_ALWAYS, "fused warp", pipe, piece->module, DT_DEVICE_CPU,
+                  roi_in, roi_out, "can't allocate row buffers");
+    dt_iop_image_fill(output, 0.0f, roi_out->width, roi_out->height, ch);
+    return;
+  }
+
+  const dt_interpolation_t *interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF_WARP);
+
+  DT_OMP_FOR()
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    float *const restrict pts = dt_get_perthread(rows, padded_size);
+    // pixel centres of the output row in full image coordinates
+    for(int i = 0; i < width; i++)
+    {
+      pts[2 * i] = (roi_out->x + i + 0.5f) / roi_out->scale;
+      pts[2 * i + 1] = (roi_out->y + j + 0.5f) / roi_out->scale;
+    }
+    for(GList *p = last; p; p = g_list_previous(p))
+    {
+      dt_dev_pixelpipe_iop_t *member = p->data;
+      if(!_skip_piece_on_tags(member))
+        member->module->distort_backtransform(member->module, member, pts, width);
+      if(p == first) break;
+    }
+
+    float *const restrict out = output + (size_t)ch * j * width;
+    for(int i = 0; i < width; i++)
+    {
+      const float x = pts[2 * i] * roi_in->scale - roi_in->x - 0.5f;
+      const float y = pts[2 * i + 1] * roi_in->scale - roi_in->y - 0.5f;
+      dt_interpolation_compute_pixel4c(interpolation, input, out + ch * i, x, y,
+                                       roi_in->width, roi_in->height, ch_width);
+    }
+  }
+  dt_free_align(rows);
+}
+
 static gboolean _pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe,
                                           dt_develop_t *dev,
                                           float *input,
@@ -1643,7 +1782,7 @@ static gboolean _pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe,
     ? pipe->bcache_data && phash == pipe->bcache_hash && phash != DT_INVALID_HASH
     : FALSE;
 
-  if(!fitting && _piece_may_tile(piece))
+  if(!fitting && !piece->fused_warp && _piece_may_tile(piece))
   {
     dt_print_pipe(DT_DEBUG_PIPE,
                   bcaching ? "from blend cache tile" : "process tiles",
@@ -1696,7 +1835,11 @@ static gboolean _pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe,
       if(darktable.bench_module && _is_debug_pipe(pipe) && dt_str_commasubstring(darktable.bench_module, module->op))
         _cpu_benchmark(pipe, module, piece, tmp, *output, roi_out, roi_in);
 
-      module->process(module, piece, tmp, *output, roi_in, roi_out);
+      if(piece->fused_warp)
+        _fused_warp_process(pipe, piece, tmp, *output, roi_in, roi_out);
+      else if(!_piece_may_tile(piece)
+              || !dt_tiling_process_parallel(module, piece, tmp, *output, roi_in, roi_out, in_bpp))
+        module->process(module, piece, tmp, *output, roi_in, roi_out);
       if(want_bcache)
       {
         if(dt_pipe_no_mask_display(pipe))
@@ -1794,7 +1937,9 @@ static gboolean _pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe,
   /* process blending on CPU */
   if(_piece_wants_blending(piece))
   {
+    const double blend_start = dt_get_wtime();
     dt_develop_blend_process(module, piece, tmp, *output, roi_in, roi_out);
+    piece->blend_time += dt_get_wtime() - blend_start;
     *pixelpipe_flow |= PIXELPIPE_FLOW_BLENDED_ON_CPU;
     *pixelpipe_flow &= ~PIXELPIPE_FLOW_BLENDED_ON_GPU;
   }
@@ -1933,6 +2078,434 @@ static inline gboolean _dev_pixelpipe_early_exit(const dt_develop_t *dev,
       || (pipe->changed != DT_DEV_PIPE_UNCHANGED && pipe->changed != DT_DEV_PIPE_ZOOMED);
 }
 
+static void _trace_cache_hit(const dt_dev_pixelpipe_t *pipe,
+                             const dt_iop_module_t *module,
+                             const dt_iop_roi_t *roi_out,
+                             const double start,
+                             const char *cache)
+{
+  if(!dt_trace_enabled()) return;
+  dt_trace_span(dt_dev_pixelpipe_type_to_str(pipe->type),
+                module ? module->op : "input", start, dt_get_wtime(),
+                "\"instance\":\"%s\",\"roi_out\":[%d,%d,%d,%d],\"cache\":\"%s\"",
+                module ? dt_iop_get_instance_id(module) : "",
+                roi_out->x, roi_out->y, roi_out->width, roi_out->height, cache);
+}
+
+// dt_dev_image(want_float) keeps gamma terminal but lets it pass the
+// 4-channel linear float working RGB through unpacked. In that case the
+// backbuf is 16 B/px (4 floats) rather than the usual 8-bit ARGB.
+static inline size_t _backbuf_bpp(const dt_dev_pixelpipe_t *pipe)
+{
+  return (pipe->type & DT_DEV_PIXELPIPE_IMAGE_FLOAT) ? 4 * sizeof(float) : 4 * sizeof(uint8_t);
+}
+
+// extra pixels processed around a patch so that no border effects show up in it
+#define DT_PIPE_PATCH_PADDING 16
+
+// grow box {x0, y0, x1, y1} by the area of a shape in full resolution output
+// coordinates of the module
+static gboolean _patch_add_form_area(dt_dev_pixelpipe_iop_t *piece,
+                                     dt_masks_form_t *form,
+                                     int *box)
+{
+  int width, height, posx, posy;
+  if(!dt_masks_get_area(piece->module, piece, form, &width, &height, &posx, &posy))
+    return FALSE;
+
+  box[0] = MIN(box[0], posx);
+  box[1] = MIN(box[1], posy);
+  box[2] = MAX(box[2], posx + width);
+  box[3] = MAX(box[3], posy + height);
+  return TRUE;
+}
+
+static inline gboolean _patch_box_overlaps(const int *box,
+                                           const int x,
+                                           const int y,
+                                           const int width,
+                                           const int height)
+{
+  return x < box[2] && x + width > box[0] && y < box[3] && y + height > box[1];
+}
+
+/* The part of the module output that might differ between the old and
+   new version of its mask group. That is the area of all changed shapes
+   and the areas of clone shapes taking their source from there.
+   Adding, removing or recombining shapes may change the mask anywhere.
+*/
+static gboolean _patch_changed_area(dt_dev_pixelpipe_iop_t *piece,
+                                    GList *old_forms,
+                                    GList *new_forms,
+                                    int *box)
+{
+  const dt_develop_blend_params_t *bp = piece->blendop_data;
+  if(!bp) return FALSE;
+
+  dt_masks_form_t *old_grp = dt_masks_get_from_id_ext(old_forms, bp->mask_id);
+  dt_masks_form_t *new_grp = dt_masks_get_from_id_ext(new_forms, bp->mask_id);
+  if(!old_grp || !new_grp
+     || !(old_grp->type & DT_MASKS_GROUP) || !(new_grp->type & DT_MASKS_GROUP)
+     || g_list_length(old_grp->points) != g_list_length(new_grp->points))
+    return FALSE;
+
+  box[0] = box[1] = INT_MAX;
+  box[2] = box[3] = INT_MIN;
+
+  for(GList *o = old_grp->points, *n = new_grp->points;
+      o && n;
+      o = g_list_next(o), n = g_list_next(n))
+  {
+    if(memcmp(o->data, n->data, sizeof(dt_masks_point_group_t)))
+      return FALSE;
+
+    const dt_masks_point_group_t *pt = n->data;
+    dt_masks_form_t *old_form = dt_masks_get_from_id_ext(old_forms, pt->formid);
+    dt_masks_form_t *new_form = dt_masks_get_from_id_ext(new_forms, pt->formid);
+    if(!old_form || !new_form
+       || (old_form->type & DT_MASKS_GROUP) || (new_form->type & DT_MASKS_GROUP))
+      return FALSE;
+
+    if(dt_masks_group_hash(DT_INITHASH, old_form) == dt_masks_group_hash(DT_INITHASH, new_form))
+      continue;
+
+    if(!_patch_add_form_area(piece, old_form, box)
+       || !_patch_add_form_area(piece, new_form, box))
+      return FALSE;
+  }
+
+  // something else than the shapes changed
+  if(box[0] >= box[2] || box[1] >= box[3])
+    return FALSE;
+
+  // a clone copying from the changed area changes its own area too
+  gboolean grown = TRUE;
+  for(int pass = 0; grown && pass < 8; pass++)
+  {
+    grown = FALSE;
+    for(GList *n = new_grp->points; n; n = g_list_next(n))
+    {
+      const dt_masks_point_group_t *pt = n->data;
+      dt_masks_form_t *form = dt_masks_get_from_id_ext(new_forms, pt->formid);
+      if(!(form->type & DT_MASKS_CLONE)) continue;
+
+      int width, height, posx, posy;
+      if(!dt_masks_get_source_area(piece->module, piece, form, &width, &height, &posx, &posy))
+        return FALSE;
+      if(!_patch_box_overlaps(box, posx, posy, width, height)) continue;
+
+      const int old_box[4] = { box[0], box[1], box[2], box[3] };
+      if(!_patch_add_form_area(piece, form, box))
+        return FALSE;
+      grown |= memcmp(old_box, box, sizeof(old_box)) != 0;
+    }
+  }
+  return !grown;
+}
+
+// mask feathering and blurring reach that many pixels beyond the changed area
+static int _patch_blend_margin(const dt_dev_pixelpipe_iop_t *piece,
+                               const float scale)
+{
+  const dt_develop_blend_params_t *bp = piece->blendop_data;
+  if(!bp || bp->mask_mode == DEVELOP_MASK_DISABLED)
+    return 0;
+
+  const float s = scale / piece->iscale;
+  return (int)ceilf(bp->feathering_radius * s + 3.0f * bp->blur_radius * s);
+}
+
+// the number of pixels a changed input pixel of the piece spreads out in its output
+static int _patch_footprint(dt_dev_pixelpipe_iop_t *piece,
+                            const float scale)
+{
+  dt_develop_tiling_t tiling = { 0 };
+  tiling.factor_cl = tiling.maxbuf_cl = -1.0f;
+  piece->module->tiling_callback(piece->module, piece,
+                                 &piece->processed_roi_in, &piece->processed_roi_out, &tiling);
+  return tiling.overlap + _patch_blend_margin(piece, scale);
+}
+
+// following modules must either work on tiles, their footprint being
+// the tiling overlap, or process pixels on their own like gamma does
+static gboolean _patch_piece_safe(const dt_dev_pixelpipe_iop_t *piece)
+{
+  return _piece_may_tile(piece)
+    || (piece->module->flags() & IOP_FLAGS_POINTWISE);
+}
+
+static int _patch_piece_footprint(dt_dev_pixelpipe_iop_t *piece,
+                                  const float scale)
+{
+  return _piece_may_tile(piece)
+    ? _patch_footprint(piece, scale)
+    : _patch_blend_margin(piece, scale);
+}
+
+static void _patch_clamp(dt_iop_roi_t *area,
+                         const dt_iop_roi_t *roi)
+{
+  const int x1 = MIN(area->x + area->width, roi->width);
+  const int y1 = MIN(area->y + area->height, roi->height);
+  area->x = MAX(area->x, 0);
+  area->y = MAX(area->y, 0);
+  area->width = x1 - area->x;
+  area->height = y1 - area->y;
+}
+
+/* Check whether the last complete output can be patched instead of processing
+   the whole roi. This is the case in the darkroom if since then only the drawn
+   shapes of a single module have changed, the changed area is small and all
+   following modules have a bounded footprint, i.e. they support tiling or
+   are flagged IOP_FLAGS_POINTWISE.
+   The input of the changed module is not processed again but cropped from its
+   complete version which is kept in the cache as the module has the focus.
+*/
+static gboolean _dev_pixelpipe_patch_prepare(dt_dev_pixelpipe_t *pipe,
+                                             dt_develop_t *dev,
+                                             const dt_iop_roi_t *roi)
+{
+  dt_dev_pixelpipe_patch_t *patch = &pipe->patch;
+  patch->active = patch->failed = FALSE;
+
+  const dt_iop_module_t *gui_module = dt_dev_gui_module();
+  if(!patch->valid
+     || !dt_pipe_is_full(pipe)
+     || !dt_pipe_is_screen(pipe)
+     || !dev->gui_attached
+     || pipe->want_detail_mask
+     || pipe->cache.entries <= DT_PIPECACHE_MIN
+     || pipe->output_imgid != pipe->image.id
+     || pipe->backbuf == NULL
+     || pipe->backbuf_width != roi->width
+     || pipe->backbuf_height != roi->height
+     || pipe->backbuf_size != _backbuf_bpp(pipe) * roi->width * roi->height
+     || memcmp(&patch->roi, roi, sizeof(dt_iop_roi_t))
+     || (gui_module && (gui_module->flags() & IOP_FLAGS_ALLOW_FAST_PIPE))
+     || (gui_module && gui_module->request_mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE)
+     || !dt_conf_get_bool("pixelpipe_dirty_rect"))
+    return FALSE;
+
+  // exactly one module must have changed and only in its drawn shapes
+  dt_dev_pixelpipe_iop_t *changed = NULL;
+  GList *changed_node = NULL;
+  int pos = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    if(!changed) pos++;
+    if(piece->enabled
+       && ((piece->request_histogram & DT_REQUEST_ON)
+           || (piece->module->raster_mask.source.users
+               && g_hash_table_size(piece->module->raster_mask.source.users))))
+      return FALSE;
+    if(piece->hash == piece->patch_hash) continue;
+    if(changed || !piece->enabled || piece->params_hash != piece->patch_params_hash)
+      return FALSE;
+    changed = piece;
+    changed_node = nodes;
+  }
+  if(!changed) return FALSE;
+
+  // retouch and spots only work on their shapes and ask for all input they need,
+  // other modules must be able to work on tiles or on single pixels. The footprint of all of them
+  // is taken from their tiling overlap, retouch reports its wavelet scales there.
+  dt_iop_module_t *module = changed->module;
+  const gboolean shape_module = module->flags() & IOP_FLAGS_NO_MASKS;
+  if(!shape_module && !_patch_piece_safe(changed))
+    return FALSE;
+
+  int box[4];
+  if(!_patch_changed_area(changed, patch->forms, pipe->forms, box))
+    return FALSE;
+
+  int margin = _patch_footprint(changed, roi->scale);
+  for(GList *nodes = g_list_next(changed_node); nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    if(_skip_piece_on_tags(piece)) continue;
+    if(!_patch_piece_safe(piece))
+    {
+      dt_print_pipe(DT_DEBUG_PIPE, "pipe patch",
+                    pipe, piece->module, DT_DEVICE_NONE, roi, NULL,
+                    "not possible, unknown footprint, processing all");
+      return FALSE;
+    }
+    margin += _patch_piece_footprint(piece, roi->scale);
+  }
+
+  // map the changed area through all following distortions into the output,
+  // the edge centers catch most of the bending by lens corrections
+  const float x0 = box[0], y0 = box[1], x1 = box[2], y1 = box[3];
+  const float xm = 0.5f * (x0 + x1), ym = 0.5f * (y0 + y1);
+  float pts[16] = { x0, y0, x1, y0, x0, y1, x1, y1,
+                    xm, y0, xm, y1, x0, ym, x1, ym };
+  if(!dt_dev_distort_transform_plus(dev, pipe, module->iop_order,
+                                    DT_DEV_TRANSFORM_DIR_FORW_EXCL, pts, 8))
+    return FALSE;
+
+  float bx0 = FLT_MAX, by0 = FLT_MAX, bx1 = -FLT_MAX, by1 = -FLT_MAX;
+  for(int k = 0; k < 8; k++)
+  {
+    bx0 = fminf(bx0, pts[2 * k]);
+    bx1 = fmaxf(bx1, pts[2 * k]);
+    by0 = fminf(by0, pts[2 * k + 1]);
+    by1 = fmaxf(by1, pts[2 * k + 1]);
+  }
+
+  margin += 2;
+  dt_iop_roi_t paste = { .x = (int)floorf(bx0 * roi->scale) - roi->x - margin,
+                         .y = (int)floorf(by0 * roi->scale) - roi->y - margin,
+                         .scale = roi->scale };
+  paste.width = (int)ceilf(bx1 * roi->scale) - roi->x + margin - paste.x;
+  paste.height = (int)ceilf(by1 * roi->scale) - roi->y + margin - paste.y;
+  _patch_clamp(&paste, roi);
+
+  // pixels near the border of the processed area might be wrong for modules
+  // with a footprint, so we process more than we paste
+  const int border = margin + DT_PIPE_PATCH_PADDING;
+  dt_iop_roi_t area = { paste.x - border, paste.y - border,
+                        paste.width + 2 * border, paste.height + 2 * border, roi->scale };
+  _patch_clamp(&area, roi);
+
+  // clamped at the roi, the area might be too small for the footprint of a
+  // module, as for wavelet scales limited by the buffer size
+  if(paste.width <= 0 || paste.height <= 0
+     || area.width < 2 * margin || area.height < 2 * margin
+     || (size_t)area.width * area.height > (size_t)roi->width * roi->height / 2)
+    return FALSE;
+
+  // find the position providing the input of the changed module
+  int in_pos = pos - 1;
+  for(GList *nodes = g_list_previous(changed_node);
+      nodes && _skip_piece_on_tags(nodes->data);
+      nodes = g_list_previous(nodes))
+    in_pos--;
+
+  patch->roi_in = changed->processed_roi_in;
+  patch->in_size = dt_iop_buffer_dsc_to_bpp(&changed->dsc_in)
+    * patch->roi_in.width * patch->roi_in.height;
+  patch->in_hash = dt_dev_pixelpipe_cache_hash(&patch->roi_in, pipe, in_pos);
+  if(!dt_dev_pixelpipe_cache_available(pipe, patch->in_hash, patch->in_size))
+    return FALSE;
+
+  // processing the patch overwrites the processed rois of the pieces
+  patch->saved_rois = g_new(dt_iop_roi_t, 2 * g_list_length(pipe->nodes));
+  int k = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    patch->saved_rois[k++] = piece->processed_roi_in;
+    patch->saved_rois[k++] = piece->processed_roi_out;
+  }
+
+  patch->pos = pos;
+  patch->area = area;
+  patch->paste = paste;
+  patch->active = TRUE;
+
+  dt_print_pipe(DT_DEBUG_PIPE, "pipe patch",
+                pipe, module, DT_DEVICE_NONE, roi, &paste,
+                "processing %dx%d at %d/%d, margin %d",
+                area.width, area.height, area.x, area.y, margin);
+  return TRUE;
+}
+
+static void _dev_pixelpipe_patch_finish(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_patch_t *patch = &pipe->patch;
+  int k = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    piece->processed_roi_in = patch->saved_rois[k++];
+    piece->processed_roi_out = patch->saved_rois[k++];
+  }
+  g_free(patch->saved_rois);
+  patch->saved_rois = NULL;
+  patch->active = FALSE;
+}
+
+// crop the input of the changed module from its complete version in the cache
+static gboolean _dev_pixelpipe_patch_input(dt_dev_pixelpipe_t *pipe,
+                                           const dt_iop_module_t *module,
+                                           const dt_iop_roi_t *roi_out,
+                                           const dt_hash_t hash,
+                                           const size_t bpp,
+                                           void **output,
+                                           dt_iop_buffer_dsc_t **out_format)
+{
+  const dt_iop_roi_t *full = &pipe->patch.roi_in;
+  void *data = NULL;
+  dt_iop_buffer_dsc_t *dsc = NULL;
+
+  if(!feqf(roi_out->scale, full->scale, 1e-6f)
+     || roi_out->x < full->x
+     || roi_out->y < full->y
+     || roi_out->x + roi_out->width > full->x + full->width
+     || roi_out->y + roi_out->height > full->y + full->height
+     || !_get_by_hash(pipe, module, pipe->patch.in_hash, pipe->patch.in_size, &data, &dsc))
+  {
+    dt_print_pipe(DT_DEBUG_PIPE, "pipe patch failed",
+                  pipe, module, DT_DEVICE_NONE, full, roi_out, "input not available");
+    pipe->patch.failed = TRUE;
+    return TRUE;
+  }
+
+  **out_format = *dsc;
+  dt_dev_pixelpipe_cache_get(pipe, hash, bpp * roi_out->width * roi_out->height,
+                             output, out_format, module, FALSE);
+
+  const size_t rowsize = bpp * roi_out->width;
+  const char *in = (const char *)data
+    + ((size_t)(roi_out->y - full->y) * full->width + roi_out->x - full->x) * bpp;
+  char *out = *output;
+  DT_OMP_FOR()
+  for(int row = 0; row < roi_out->height; row++)
+    memcpy(out + row * rowsize, in + (size_t)row * full->width * bpp, rowsize);
+
+  return FALSE;
+}
+
+static void _dev_pixelpipe_patch_paste(const dt_dev_pixelpipe_t *pipe,
+                                       const void *buf,
+                                       const size_t bpp)
+{
+  const dt_dev_pixelpipe_patch_t *patch = &pipe->patch;
+  const size_t rowsize = bpp * patch->paste.width;
+  const char *in = (const char *)buf
+    + ((size_t)(patch->paste.y - patch->area.y) * patch->area.width
+       + patch->paste.x - patch->area.x) * bpp;
+  char *out = (char *)pipe->backbuf
+    + ((size_t)patch->paste.y * patch->roi.width + patch->paste.x) * bpp;
+
+  for(int row = 0; row < patch->paste.height; row++)
+    memcpy(out + (size_t)row * patch->roi.width * bpp,
+           in + (size_t)row * patch->area.width * bpp, rowsize);
+}
+
+// remember the state of a complete output to patch it later
+static void _dev_pixelpipe_patch_store(dt_dev_pixelpipe_t *pipe,
+                                       const dt_iop_roi_t *roi)
+{
+  dt_dev_pixelpipe_patch_t *patch = &pipe->patch;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    piece->patch_hash = piece->hash;
+    piece->patch_params_hash = piece->params_hash;
+  }
+
+  // the snapshot of masks isn't needed by the pipe any longer
+  if(patch->forms)
+    g_list_free_full(patch->forms, (void (*)(void *))dt_masks_free_form);
+  patch->forms = pipe->forms;
+  pipe->forms = NULL;
+
+  patch->roi = *roi;
+  patch->valid = TRUE;
+}
+
 // recursive helper for process, returns TRUE in case of unfinished work or error
 static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
                                            dt_develop_t *dev,
@@ -1991,6 +2564,12 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
   // 1) if cached buffer is still available, return data
   dt_hash_t hash = dt_dev_pixelpipe_cache_hash(roi_out, pipe, pos);
 
+  // resampling a run of warps in one pass gives a different output than
+  // resampling in every module, don't mix them up in the cache
+  const gboolean fused_run = module && _fused_warp_run_end(pipe, pieces);
+  if(fused_run)
+    hash = dt_hash(hash, &fused_run, sizeof(fused_run));
+
   // we do not want data from the preview pixelpipe cache
   // for gamma so we can compute the final scope
   const gboolean gamma_preview =
@@ -2006,10 +2585,12 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
       && !pipe->nocache
       && dt_dev_pixelpipe_cache_available(pipe, hash, bufsize);
 
+  const double lookup_start = dt_trace_enabled() ? dt_get_wtime() : 0.0;
   if(cache_available)
   {
     dt_dev_pixelpipe_cache_get(pipe, hash, bufsize,
                                output, out_format, module, TRUE);
+    _trace_cache_hit(pipe, module, roi_out, lookup_start, "hit");
     dt_print_pipe(DT_DEBUG_PIPE,
                   "pipe data: cache HIT",
                   pipe, module, DT_DEVICE_NONE, &roi_in, NULL);
@@ -2019,10 +2600,26 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
     return FALSE;
   }
 
+  // 2) expensive outputs might have been kept on disk by an earlier session
+  if(!gamma_preview
+     && dt_dev_pixelpipe_cache_disk_load(pipe, roi_out, pos, hash, bufsize,
+                                         output, out_format, module))
+  {
+    _trace_cache_hit(pipe, module, roi_out, lookup_start, "disk");
+    dt_print_pipe(DT_DEBUG_PIPE,
+                  "pipe data: disk cache HIT",
+                  pipe, module, DT_DEVICE_NONE, &roi_in, NULL);
+    return FALSE;
+  }
+
   // if history changed, zoomed ... stop pipe processing, reasons will be handled in dt_dev_process_image_job()
   if(_dev_pixelpipe_early_exit(dev, pipe))
     return TRUE;
 
+  // while patching the output the input of the changed module is taken from the cache
+  if(pipe->patch.active && pos < pipe->patch.pos)
+    return _dev_pixelpipe_patch_input(pipe, module, roi_out, hash, bpp, output, out_format);
+
   /* The modules list is empty now after the list of unskipped modules has been traversed
      and we did not get input from the pipe cache so we need pipe input
   */
@@ -2200,9 +2797,46 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
   piece->processed_roi_in = roi_in;
   piece->processed_roi_out = *roi_out;
 
+  // a run of warps ending here is resampled in one pass from the input of its first piece
+  GList *in_modules = g_list_previous(modules);
+  GList *in_pieces = g_list_previous(pieces);
+  int in_pos = pos - 1;
+  piece->fused_warp = NULL;
+  if(fused_run)
+  {
+    dt_iop_roi_t roi_run = roi_in;
+    int steps = 1;
+    for(GList *m = in_modules, *p = in_pieces;
+        m && p;
+        m = g_list_previous(m), p = g_list_previous(p), steps++)
+    {
+      dt_dev_pixelpipe_iop_t *prev = p->data;
+      if(_skip_piece_on_tags(prev)) continue;
+      if(!_fused_warp_member(prev)) break;
+
+      dt_iop_roi_t roi_prev = roi_run;
+      prev->module->modify_roi_in(prev->module, prev, &roi_run, &roi_prev);
+      prev->processed_roi_in = roi_prev;
+      prev->processed_roi_out = roi_run;
+      roi_run = roi_prev;
+
+      piece->fused_warp = p;
+      in_modules = g_list_previous(m);
+      in_pieces = g_list_previous(p);
+      in_pos = pos - steps - 1;
+    }
+    if(piece->fused_warp)
+    {
+      roi_in = roi_run;
+      dt_print_pipe(DT_DEBUG_PIPE,
+                    "fused warp",
+                    pipe, module, DT_DEVICE_NONE, &roi_in, roi_out, "from %s",
+                    ((dt_dev_pixelpipe_iop_t *)piece->fused_warp->data)->module->op);
+    }
+  }
+
   if(_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &roi_in,
-                                g_list_previous(modules),
-                                g_list_previous(pieces), pos - 1))
+                                in_modules, in_pieces, in_pos))
     return TRUE;
 
   /*  finally we don't recurse any longer but process modules in correct iop_order.
@@ -2225,6 +2859,11 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
   const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
   piece->dsc_out = piece->dsc_in = *input_format;
   module->output_format(module, pipe, piece, &piece->dsc_out);
+  for(GList *p = piece->fused_warp; p && p != pieces; p = g_list_next(p))
+  {
+    dt_dev_pixelpipe_iop_t *member = p->data;
+    member->dsc_out = member->dsc_in = *input_format;
+  }
 
   **out_format = pipe->dsc = piece->dsc_out;
   const size_t out_bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
@@ -2253,6 +2892,8 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
 
   dt_times_t start;
   dt_get_perf_times(&start);
+  const double process_start = dt_get_wtime();
+  piece->blend_time = 0.0;
 
   dt_pixelpipe_flow_t pixelpipe_flow =
     (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
@@ -2373,7 +3014,8 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
         module->process_cl
         && piece->process_cl_ready
         && !(dt_pipe_is_preview(pipe) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL))
-        && !_avoid_cl_module(piece);
+        && !_avoid_cl_module(piece)
+        && !piece->fused_warp;
 
     /* A colorspace conversion of the input is done before the module runs, into a second
        image that replaces the original, so one extra full-size buffer is live while it
@@ -2741,8 +3383,10 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
         /* process blending */
         if(success_opencl && _piece_wants_blending(piece))
         {
+          const double blend_start = dt_get_wtime();
           success_opencl = dt_develop_blend_process_cl(module, piece, cl_mem_input,
                                                        *cl_mem_output, &roi_in, roi_out);
+          piece->blend_time += dt_get_wtime() - blend_start;
           pixelpipe_flow |= PIXELPIPE_FLOW_BLENDED_ON_GPU;
           pixelpipe_flow &= ~PIXELPIPE_FLOW_BLENDED_ON_CPU;
         }
@@ -2881,7 +3525,9 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
         /* do process blending on cpu (this is anyhow fast enough) */
         if(success_opencl && _piece_wants_blending(piece))
         {
+          const double blend_start = dt_get_wtime();
           dt_develop_blend_process(module, piece, tmp, *output, &roi_in, roi_out);
+          piece->blend_time += dt_get_wtime() - blend_start;
           pixelpipe_flow |= PIXELPIPE_FLOW_BLENDED_ON_CPU;
           pixelpipe_flow &= ~PIXELPIPE_FLOW_BLENDED_ON_GPU;
         }
@@ -3066,6 +3712,35 @@ static gboolean _dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe,
   // in case we get this buffer from the cache in the future, cache some stuff:
   **out_format = piece->dsc_out = pipe->dsc;
 
+  const double process_time = dt_get_wtime() - process_start;
+  dt_dev_pixelpipe_cache_set_cost(pipe, *output, process_time);
+
+  if((pipe->type & DT_DEV_PIXELPIPE_EXPORT) && dt_export_timing_current())
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "%s%s", module->op, dt_iop_get_instance_id(module));
+    dt_export_timing_add_module(module->op, name, process_time, piece->blend_time,
+                                (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING) != 0,
+                                (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU) != 0);
+  }
+
+  if(dt_trace_enabled())
+    dt_trace_span(dt_dev_pixelpipe_type_to_str(pipe->type),
+                  module->op, process_start, process_start + process_time,
+                  "\"instance\":\"%s\",\"roi_in\":[%d,%d,%d,%d],\"roi_out\":[%d,%d,%d,%d],"
+                  "\"device\":\"%s\",\"devid\":%d,\"tiling\":%s,\"cache\":\"miss\"",
+                  dt_iop_get_instance_id(module),
+                  roi_in.x, roi_in.y, roi_in.width, roi_in.height,
+                  roi_out->x, roi_out->y, roi_out->width, roi_out->height,
+                  pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? "GPU" : "CPU",
+                  pipe->devid,
+                  pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING ? "true" : "false");
+
+  // only host memory can be kept on disk
+  if(*cl_mem_output == NULL)
+    dt_dev_pixelpipe_cache_disk_store(pipe, roi_out, pos, *output, bufsize, *out_format,
+                                      module, process_time);
+
   // special cases for active modules with available gui
   if(module
       && darktable.develop->gui_attached
@@ -3308,6 +3983,7 @@ gboolean dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe,
   pipe->devid = pipe->opencl_enabled
     ? (claimed ? devid : dt_opencl_lock_device(pipe->type))
     : DT_DEVICE_CPU;
+  const double pipe_start = dt_get_wtime();
 
   if(!claimed)  // don't free cachelines as the caller is using them
     dt_dev_pixelpipe_cache_checkmem(pipe, FALSE);
@@ -3367,11 +4043,30 @@ restart:
                   pipe->image.filename, pipe->image.id, avail_mem / DT_MEGA);
   dt_print_mem_usage("before pixelpipe process");
 
+  // after shape edits we might only need to recompute a part of the last output
+  gboolean patched = _dev_pixelpipe_patch_prepare(pipe, dev, &roi);
+  const dt_iop_roi_t roi_patch = { roi.x + pipe->patch.area.x, roi.y + pipe->patch.area.y,
+                                   pipe->patch.area.width, pipe->patch.area.height, scale };
+
   // run pixelpipe recursively and get error status
-  const gboolean err = _dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf,
-                                                               &cl_mem_out, &out_format,
-                                                               &roi,
-                                                               modules, pieces, pos);
+  gboolean err = _dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf,
+                                                         &cl_mem_out, &out_format,
+                                                         patched ? &roi_patch : &roi,
+                                                         modules, pieces, pos);
+  if(patched)
+  {
+    _dev_pixelpipe_patch_finish(pipe);
+    if(err && pipe->patch.failed)
+    {
+      patched = FALSE;
+      buf = NULL;
+      out_format = &_out_format;
+      err = _dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf,
+                                                    &cl_mem_out, &out_format,
+                                                    &roi,
+                                                    modules, pieces, pos);
+    }
+  }
   // get status summary of opencl queue by checking the eventlist
   const gboolean oclerr = (pipe->devid > DT_DEVICE_CPU)
                           ? (dt_opencl_events_flush(pipe->devid, TRUE) != CL_SUCCESS)
@@ -3425,7 +4120,17 @@ restart:
     goto restart; // try again (this time without opencl)
   }
 
-  // release resources:
+  // release resources, the masks are kept if the output might be patched later
+  if(!err
+     && dt_pipe_is_full(pipe)
+     && dt_pipe_is_screen(pipe)
+     && !dt_pipe_is_fast(pipe)
+     && dt_pipe_no_mask_display(pipe)
+     && dev->gui_attached)
+    _dev_pixelpipe_patch_store(pipe, &roi);
+  else
+    pipe->patch.valid = FALSE;
+
   if(pipe->forms)
   {
     g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
@@ -3439,6 +4144,19 @@ restart:
     pipe->devid = DT_DEVICE_CPU;
   }
 
+  if(dt_trace_enabled())
+  {
+    // the file name is user controlled, unlike the module instance ids
+    gchar *filename = dt_trace_escape(pipe->image.filename);
+    dt_trace_span(dt_dev_pixelpipe_type_to_str(pipe->type), "pixelpipe",
+                  pipe_start, dt_get_wtime(),
+                  "\"imgid\":%d,\"filename\":\"%s\",\"roi\":[%d,%d,%d,%d],"
+                  "\"devid\":%d,\"error\":%s",
+                  pipe->image.id, filename, x, y, width, height, old_devid,
+                  err ? "true" : "false");
+    g_free(filename);
+  }
+
   // ... and in case of other errors ...
   if(err)
     return TRUE;
@@ -3450,11 +4168,7 @@ restart:
   //FIXME lock/release cache line instead of copying
   if(dt_pipe_is_screen(pipe))
   {
-    // dt_dev_image(want_float) keeps gamma terminal but lets it pass the
-    // 4-channel linear float working RGB through unpacked. In that case the
-    // backbuf is 16 B/px (4 floats) rather than the usual 8-bit ARGB.
-    const size_t bbpp =
-      (pipe->type & DT_DEV_PIXELPIPE_IMAGE_FLOAT) ? 4 * sizeof(float) : 4 * sizeof(uint8_t);
+    const size_t bbpp = _backbuf_bpp(pipe);
     if(pipe->backbuf == NULL || pipe->backbuf_width * pipe->backbuf_height != width * height ||
        pipe->backbuf_size != bbpp * width * height)
     {
@@ -3465,7 +4179,10 @@ restart:
 
     if(pipe->backbuf)
     {
-      memcpy(pipe->backbuf, buf, bbpp * width * height);
+      if(patched)
+        _dev_pixelpipe_patch_paste(pipe, buf, bbpp);
+      else
+        memcpy(pipe->backbuf, buf, bbpp * width * height);
       pipe->backbuf_scale = scale;
       for(int i = 0; i < 6; i++) pipe->backbuf_zoom_pos[i] = pts[i] * pipe->iscale;
       pipe->output_imgid = pipe->image.id;
@@ -60,6 +60,9 @@ typedef struct dt_dev_pixelpipe_iop_t
   float iscale;                   // input actually just downscaled buffer? iscale*iwidth = actual width
   int iwidth, iheight;            // width and height of input buffer
   dt_hash_t hash;                 // hash of params and enabled.
+  dt_hash_t params_hash;          // like hash but without the drawn shapes of the mask group
+  dt_hash_t patch_hash;           // hash and params_hash as used for the last complete
+  dt_hash_t patch_params_hash;    // output of the pipe, see dt_dev_pixelpipe_patch_t
   int bpc;                        // bits per channel, 32 means float
   int colors;                     // how many colors per pixel
   dt_iop_roi_t buf_in;            // theoretical full buffer regions of interest, as passed through modify_roi_out
@@ -68,6 +71,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t processed_roi_out;
   gboolean process_cl_ready;      // set this to FALSE in commit_params to temporarily disable the use of process_cl
   gboolean process_tiling_ready;  // set this to FALSE in commit_params to temporarily disable tiling
+  double blend_time;              // time spent blending in the last processing of the piece
+  GList *fused_warp;              // first node of the run of warps resampled by this piece in one pass
 
   // the following are used internally for caching:
   dt_iop_buffer_dsc_t dsc_in;
@@ -159,6 +164,31 @@ typedef struct dt_dev_detail_mask_t
   size_t size;
 } dt_dev_detail_mask_t;
 
+/* After editing the drawn shapes of a single module only the part of the
+   output covered by the old and new shapes, grown by the footprint of all
+   following modules, has to be recomputed. A screen pipe keeps what is needed
+   to patch its last complete output in place instead of processing the whole
+   roi again.
+*/
+typedef struct dt_dev_pixelpipe_patch_t
+{
+  // the last complete output held in backbuf
+  gboolean valid;
+  dt_iop_roi_t roi;
+  GList *forms;             // the masks it was processed with
+
+  // while patching
+  gboolean active;
+  gboolean failed;          // the patch couldn't be done, process the complete roi
+  int pos;                  // position of the module with changed shapes
+  dt_iop_roi_t roi_in;      // its complete input taken from the cache
+  dt_hash_t in_hash;
+  size_t in_size;
+  dt_iop_roi_t area;        // processed part of the output
+  dt_iop_roi_t paste;       // part of the output being replaced
+  dt_iop_roi_t *saved_rois; // processed rois of all pieces, restored after patching
+} dt_dev_pixelpipe_patch_t;
+
 /**
  * this encapsulates the pixelpipe.
  * a develop module will need several of these:
@@ -260,11 +290,15 @@ typedef struct dt_dev_pixelpipe_t
   GList *iop_order_list;
   // snapshot of mask list
   GList *forms;
+  // patching the last output after shape edits
+  dt_dev_pixelpipe_patch_t patch;
   // the masks generated in the pipe for later reusal are inside dt_dev_pixelpipe_iop_t
   gboolean store_all_raster_masks;
   // module blending cache
   float *bcache_data;
   dt_hash_t bcache_hash;
+  // the source file by path, modification time and size, for the disk tier of the cache
+  dt_hash_t source_hash;
   size_t bcache_size;
 
   // reusable ping-pong buffers for mask distortion walks
@@ -272,6 +306,8 @@ typedef struct dt_dev_pixelpipe_t
   size_t mask_distort_buf_size[2];
   // sum of all per-piece detail/raster mask caches currently allocated in this pipe
   size_t mask_cache_size;
+  // interpolated warp fields for transforming large point lists, see develop.c
+  struct dt_dev_warp_cache_t *warp_cache;
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
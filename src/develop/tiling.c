@@ -18,6 +18,7 @@
 
 #include "develop/tiling.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/pixelpipe.h"
@@ -1181,6 +1182,123 @@ void default_process_tiling(dt_iop_module_t *self,
   return;
 }
 
+/* horizontal strips processed concurrently have at least this many own rows */
+#define DT_TILING_PARALLEL_MIN_ROWS 64
+
+/* tiling as a throughput optimization for modules flagged IOP_FLAGS_TILING_PARALLEL:
+   the image is cut into horizontal strips, extended by the overlap the module asks
+   for, which are processed concurrently with one thread per strip. The module's own
+   parallel loops run single threaded within a strip, so this pays off for modules
+   with serial passes. process() of such a module must only read the piece and the
+   pipe, processed_maximum included.
+   returns FALSE if the image is not worth splitting, nothing has been done then. */
+gboolean dt_tiling_process_parallel(dt_iop_module_t *self,
+                                    dt_dev_pixelpipe_iop_t *piece,
+                                    const void *const ivoid,
+                                    void *const ovoid,
+                                    const dt_iop_roi_t *const roi_in,
+                                    const dt_iop_roi_t *const roi_out,
+                                    const int in_bpp)
+{
+#ifdef _OPENMP
+  const int flags = self->flags();
+  if(!(flags & IOP_FLAGS_TILING_PARALLEL)
+     || !(flags & IOP_FLAGS_ALLOW_TILING)
+     || (flags & IOP_FLAGS_TILING_FULL_ROI)
+     || memcmp(roi_in, roi_out, sizeof(struct dt_iop_roi_t))
+     || !dt_conf_get_bool("tiling_parallel"))
+    return FALSE;
+
+  // the cfa pattern depends on the position of a tile and is kept in the piece
+  if(self->input_colorspace(self, piece->pipe, piece) == IOP_CS_RAW)
+    return FALSE;
+
+  const int nthreads = dt_get_num_threads();
+  if(nthreads < 2) return FALSE;
+
+  dt_iop_buffer_dsc_t dsc;
+  self->output_format(self, piece->pipe, piece, &dsc);
+  const int out_bpp = dt_iop_buffer_dsc_to_bpp(&dsc);
+  const int max_bpp = MAX(in_bpp, out_bpp);
+  const size_t ipitch = (size_t)roi_in->width * in_bpp;
+  const size_t opitch = (size_t)roi_out->width * out_bpp;
+
+  dt_develop_tiling_t tiling = { 0 };
+  tiling.factor_cl = tiling.maxbuf_cl = -1;
+  self->tiling_callback(self, piece, roi_in, roi_out, &tiling);
+  const int align = MAX(1, tiling.align);
+  const int overlap = (tiling.overlap + align - 1) / align * align;
+
+  /* the overlap is processed twice, keep it small against the strips */
+  const int height = roi_in->height;
+  const int min_rows = MAX(DT_TILING_PARALLEL_MIN_ROWS, 4 * overlap);
+  int strips = MIN(nthreads, height / min_rows);
+  if(strips < 2) return FALSE;
+  const int strip_ht = ((height + strips - 1) / strips + align - 1) / align * align;
+  strips = (height + strip_ht - 1) / strip_ht;
+
+  /* each strip in flight needs what the module needs for its size */
+  const float strip_mem = tiling.factor * roi_in->width * (strip_ht + 2.0f * overlap) * max_bpp
+                          + tiling.overhead;
+  const float available = fmaxf(dt_get_available_pipe_mem(piece->pipe)
+                                - (float)roi_in->height * ipitch
+                                - (float)roi_out->height * opitch, 0.0f);
+  const int concurrent = MIN(strips, (int)(available / fmaxf(strip_mem, 1.0f)));
+  if(concurrent < 2) return FALSE;
+
+  piece->pipe->tiling = TRUE;
+  dt_print_pipe(DT_DEBUG_PIPE | DT_DEBUG_TILING,
+                "  *parallel tiles*", piece->pipe, piece->module, DT_DEVICE_CPU, roi_in, roi_out,
+                "%d strips of %d rows, overlap=%d, %d threads",
+                strips, strip_ht, overlap, concurrent);
+
+  gboolean failed = FALSE;
+  DT_OMP_PRAGMA(parallel for default(firstprivate) schedule(dynamic) num_threads(concurrent) shared(failed))
+  for(int k = 0; k < strips; k++)
+  {
+    const int y0 = k * strip_ht;
+    const int y1 = MIN(height, y0 + strip_ht);
+    const int iy0 = MAX(0, y0 - overlap);
+    const int ht = MIN(height, y1 + overlap) - iy0;
+
+    void *input = dt_alloc_aligned((size_t)ht * ipitch);
+    void *output = dt_alloc_aligned((size_t)ht * opitch);
+    if(input && output)
+    {
+      const dt_iop_roi_t iroi = { roi_in->x, roi_in->y + iy0, roi_in->width, ht, roi_in->scale };
+      const dt_iop_roi_t oroi = { roi_out->x, roi_out->y + iy0, roi_out->width, ht, roi_out->scale };
+
+      memcpy(input, (char *)ivoid + iy0 * ipitch, (size_t)ht * ipitch);
+      self->process(self, piece, input, output, &iroi, &oroi);
+      /* only the rows of the strip itself are good */
+      memcpy((char *)ovoid + y0 * opitch, (char *)output + (y0 - iy0) * opitch,
+             (size_t)(y1 - y0) * opitch);
+    }
+    else
+    {
+      DT_OMP_PRAGMA(atomic write)
+      failed = TRUE;
+    }
+    dt_free_align(input);
+    dt_free_align(output);
+  }
+
+  piece->pipe->tiling = FALSE;
+
+  if(failed)
+  {
+    dt_print(DT_DEBUG_TILING,
+             "[dt_tiling_process_parallel] [%s] could not alloc strip buffers for module '%s%s', "
+             "processing in one go",
+             dt_dev_pixelpipe_type_to_str(piece->pipe->type), self->op, dt_iop_get_instance_id(self));
+    self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
+  }
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
 #ifdef HAVE_OPENCL
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static int _default_process_tiling_cl_ptp(dt_iop_module_t *self,
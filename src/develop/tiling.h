@@ -59,6 +59,10 @@ void process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
                     const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                     const dt_iop_roi_t *const roi_out, const int bpp);
 
+gboolean dt_tiling_process_parallel(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                    const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
+                                    const dt_iop_roi_t *const roi_out, const int in_bpp);
+
 void default_tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                              struct dt_develop_tiling_t *tiling);
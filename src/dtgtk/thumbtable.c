@@ -29,6 +29,7 @@
 #include "common/selection.h"
 #include "common/undo.h"
 #include "control/control.h"
+#include "control/jobs/image_jobs.h"
 #include "gui/accelerators.h"
 #include "gui/drag_and_drop.h"
 #include "gui/gtk.h"
@@ -230,36 +231,14 @@ static dt_thumbnail_t *_thumb_get_under_mouse(dt_thumbtable_t *table)
 }
 
 // get imgid from rowid
-static dt_imgid_t _thumb_get_imgid(const int rowid)
+static inline dt_imgid_t _thumb_get_imgid(const int rowid)
 {
-  dt_imgid_t id = NO_IMGID;
-  sqlite3_stmt *stmt;
-  gchar *query = g_strdup_printf
-    ("SELECT imgid FROM memory.collected_images WHERE rowid=%d", rowid);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    id = sqlite3_column_int(stmt, 0);
-  }
-  g_free(query);
-  sqlite3_finalize(stmt);
-  return id;
+  return dt_collection_get_imgid_at_rowid(rowid);
 }
 // get rowid from imgid
-static int _thumb_get_rowid(const dt_imgid_t imgid)
+static inline int _thumb_get_rowid(const dt_imgid_t imgid)
 {
-  int id = -1;
-  sqlite3_stmt *stmt;
-  gchar *query = g_strdup_printf
-    ("SELECT rowid FROM memory.collected_images WHERE imgid=%d", imgid);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    id = sqlite3_column_int(stmt, 0);
-  }
-  g_free(query);
-  sqlite3_finalize(stmt);
-  return id;
+  return dt_collection_get_rowid(imgid);
 }
 
 // get the coordinate of the rectangular area used by all the loaded thumbs
@@ -705,6 +684,90 @@ static int _thumbs_load_needed(dt_thumbtable_t *table,
   return changed;
 }
 
+// queue the thumbnails the user is scrolling towards, so that they are
+// read from the disk cache before they get shown
+static void _thumbs_prefetch(dt_thumbtable_t *table,
+                             const int posx,
+                             const int posy)
+{
+  if(!table->list || table->thumb_size <= 0
+     || !dt_conf_get_bool("cache_disk_backend"))
+    return;
+
+  int moved;
+  if(table->mode == DT_THUMBTABLE_MODE_FILEMANAGER)
+    moved = posy;
+  else if(table->mode == DT_THUMBTABLE_MODE_FILMSTRIP)
+    moved = posx;
+  else
+    return;
+  if(moved == 0) return;
+
+  // the thumbs move up (or left) when going towards the end of the collection
+  const int dir = moved < 0 ? 1 : -1;
+  const double now = dt_get_wtime();
+  const double elapsed = now - table->prefetch_time;
+  table->prefetch_time = now;
+
+  if(dir != table->prefetch_dir || elapsed > 0.5)
+  {
+    // what was queued for the other direction is of no use any longer
+    if(dir != table->prefetch_dir)
+      dt_atomic_add_int(&table->prefetch_gen, 1);
+    table->prefetch_dir = dir;
+    table->prefetch_end = 0;
+    table->prefetch_speed = 0.0f;
+  }
+  else
+  {
+    const float rows = fabsf((float)moved / table->thumb_size);
+    table->prefetch_speed = 0.5f * table->prefetch_speed + 0.5f * rows / MAX(elapsed, 0.001);
+  }
+
+  // look one second ahead at the current speed, but at least one screen
+  const int ahead = CLAMP((int)ceilf(table->prefetch_speed), table->rows, 8 * table->rows);
+  const dt_thumbnail_t *first = table->list->data;
+  const dt_thumbnail_t *last = g_list_last(table->list)->data;
+  int from, to;
+  if(dir > 0)
+  {
+    from = MAX(last->rowid, table->prefetch_end) + 1;
+    to = MIN(last->rowid + ahead * table->thumbs_per_row,
+             (int)dt_collection_get_collected_count());
+    if(from > to) return;
+  }
+  else
+  {
+    from = (table->prefetch_end ? MIN(first->rowid, table->prefetch_end) : first->rowid) - 1;
+    to = MAX(first->rowid - ahead * table->thumbs_per_row, 1);
+    if(from < to) return;
+  }
+  table->prefetch_end = to;
+
+  GArray *imgids = g_array_sized_new(FALSE, FALSE, sizeof(dt_imgid_t), abs(to - from) + 1);
+  for(int rowid = from; ; rowid += dir)
+  {
+    const dt_imgid_t imgid = dt_collection_get_imgid_at_rowid(rowid);
+    if(dt_is_valid_imgid(imgid)) g_array_append_val(imgids, imgid);
+    if(rowid == to) break;
+  }
+  if(imgids->len == 0)
+  {
+    g_array_free(imgids, TRUE);
+    return;
+  }
+
+  // the same level the shown thumbnails are using
+  const int size = MAX(first->img_width, first->img_height) > 0
+    ? MAX(first->img_width, first->img_height)
+    : first->width;
+  const dt_mipmap_size_t mip =
+    dt_mipmap_cache_get_matching_size(size * darktable.gui->ppd, size * darktable.gui->ppd);
+
+  dt_control_add_job(DT_JOB_QUEUE_SYSTEM_BG,
+                     dt_image_prefetch_job_create(imgids, mip, &table->prefetch_gen));
+}
+
 // move all thumbs from the table.
 // if clamp, we verify that the move is allowed (collection bounds, etc...)
 static gboolean _move(dt_thumbtable_t *table,
@@ -853,6 +916,8 @@ static gboolean _move(dt_thumbtable_t *table,
   // update scrollbars
   _thumbtable_update_scrollbars(table);
 
+  _thumbs_prefetch(table, posx, posy);
+
   return TRUE;
 }
 
@@ -2901,6 +2966,8 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table,
 
     const double start = dt_get_debug_wtime();
     table->dragging = FALSE;
+    // rowids may not be the same any longer
+    table->prefetch_end = 0;
     sqlite3_stmt *stmt;
     dt_print(DT_DEBUG_LIGHTTABLE,
              "reload thumbs from db. force=%d w=%d h=%d zoom=%d rows=%d size=%d"
@@ -108,6 +108,13 @@ typedef struct dt_thumbtable_t
   guint scroll_timeout_id;
   float scroll_value;
 
+  // prefetching of the thumbnails ahead of scrolling
+  int prefetch_dir;           // 1 towards the end of the collection, -1 towards the start
+  int prefetch_end;           // last rowid queued in that direction, 0 if none
+  double prefetch_time;       // time of the last move
+  float prefetch_speed;       // smoothed scrolling speed in rows per second
+  dt_atomic_int prefetch_gen; // bumped to stop the queued prefetches
+
   // darkroom selection from filmstrip (support for single & double click)
   guint sel_single_cb;
   dt_imgid_t to_selid;
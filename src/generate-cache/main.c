@@ -44,11 +44,145 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const dt_imgid_t min_imgid, const int32_t max_imgid)
+typedef struct _generate_t
+{
+  dt_mipmap_size_t min_mip, max_mip;
+  GArray *imgids;        // in increasing order
+  GPtrArray *filenames;
+  dt_atomic_int next;    // index of the next image to be picked by a worker
+
+  dt_pthread_mutex_t lock; // protects everything below
+  uint8_t *done;
+  size_t watermark;      // all images before this index are done
+  size_t counter, skipped;
+  size_t generated[DT_MIPMAP_NONE], failed[DT_MIPMAP_NONE];
+  double start, saved;
+
+  char checkpoint[PATH_MAX];
+  dt_imgid_t min_imgid;
+  int32_t max_imgid;
+} _generate_t;
+
+// the checkpoint remembers up to which image id a run with the same
+// arguments has completed, so that an interrupted run can carry on from there
+static dt_imgid_t _checkpoint_read(const _generate_t *g)
+{
+  gchar *contents = NULL;
+  if(!g_file_get_contents(g->checkpoint, &contents, NULL, NULL)) return NO_IMGID;
+
+  int min_mip = 0, max_mip = 0, min_imgid = 0, max_imgid = 0, done = 0;
+  const gboolean match =
+    sscanf(contents, "%d %d %d %d %d", &min_mip, &max_mip, &min_imgid, &max_imgid, &done) == 5
+    && min_mip == g->min_mip && max_mip == g->max_mip
+    && min_imgid == g->min_imgid && max_imgid == g->max_imgid;
+  g_free(contents);
+  return match ? done : NO_IMGID;
+}
+
+static void _checkpoint_write(const _generate_t *g,
+                              const dt_imgid_t done)
+{
+  gchar *contents = g_strdup_printf("%d %d %d %d %d\n", g->min_mip, g->max_mip,
+                                    g->min_imgid, g->max_imgid, done);
+  if(!g_file_set_contents(g->checkpoint, contents, -1, NULL))
+    fprintf(stderr, _("warning: could not write checkpoint '%s'\n"), g->checkpoint);
+  g_free(contents);
+}
+
+static void _generate_image(_generate_t *g,
+                            const size_t index)
+{
+  const dt_imgid_t imgid = g_array_index(g->imgids, dt_imgid_t, index);
+
+  gboolean missing[DT_MIPMAP_NONE] = { FALSE };
+  gboolean any = FALSE;
+  for(int k = g->min_mip; k <= g->max_mip; k++)
+  {
+    // if a valid thumbnail is already on disc - do nothing
+    missing[k] = !dt_mipmap_cache_on_disk(imgid, k);
+    any |= missing[k];
+  }
+
+  if(any)
+  {
+    // the largest level is processed (or read from disc) first and held
+    // while the smaller ones are made, so that these are downsampled from
+    // it instead of running the pipe once more
+    dt_mipmap_buffer_t top;
+    dt_mipmap_cache_get(&top, imgid, g->max_mip, DT_MIPMAP_BLOCKING, 'r');
+    for(int k = g->max_mip - 1; k >= g->min_mip; k--)
+    {
+      if(!missing[k]) continue;
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(&buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+      dt_mipmap_cache_release(&buf);
+    }
+    dt_mipmap_cache_release(&top);
+  }
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mipmap_cache_evict(imgid);
+  // thumbnail in sync with image
+  dt_history_hash_set_mipmap(imgid);
+
+  dt_pthread_mutex_lock(&g->lock);
+  g->counter++;
+  if(!any) g->skipped++;
+  for(int k = g->min_mip; k <= g->max_mip; k++)
+  {
+    if(!missing[k]) continue;
+    // skulls are not written, so this tells what could not be processed
+    if(dt_mipmap_cache_on_disk(imgid, k))
+      g->generated[k]++;
+    else
+      g->failed[k]++;
+  }
+
+  const size_t count = g->imgids->len;
+  const double now = dt_get_wtime();
+  fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d, file=%s) %.2f images/s\n",
+          g->counter, count, 100.0 * g->counter / (float)count, imgid,
+          (const char *)g_ptr_array_index(g->filenames, index),
+          g->counter / MAX(now - g->start, 1e-3));
+
+  g->done[index] = 1;
+  const size_t watermark = g->watermark;
+  while(g->watermark < count && g->done[g->watermark]) g->watermark++;
+  if(g->watermark > watermark && now - g->saved > 10.0)
+  {
+    _checkpoint_write(g, g_array_index(g->imgids, dt_imgid_t, g->watermark - 1));
+    g->saved = now;
+  }
+  dt_pthread_mutex_unlock(&g->lock);
+}
+
+static void *_generate_worker(void *data)
+{
+  _generate_t *g = (_generate_t *)data;
+  dt_pthread_setname("generate-cache");
+
+  while(TRUE)
+  {
+    const size_t index = (size_t)dt_atomic_add_int(&g->next, 1);
+    if(index >= g->imgids->len) break;
+    _generate_image(g, index);
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip,
+                                    const dt_mipmap_size_t max_mip,
+                                    const dt_imgid_t min_imgid,
+                                    const int32_t max_imgid,
+                                    const int threads,
+                                    const gboolean restart)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
   {
+    // pack files are created by the mipmap cache itself
+    if(darktable.mipmap_cache->pack[k]) continue;
+
     char dirname[PATH_MAX] = { 0 };
     snprintf(dirname, sizeof(dirname), "%s.d/%d", darktable.mipmap_cache->cachedir, k);
 
@@ -60,66 +194,85 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // some progress counter
-  sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    image_count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
-  else
-  {
-    return 1;
-  }
+  _generate_t g = { 0 };
+  g.min_mip = min_mip;
+  g.max_mip = max_mip;
+  g.min_imgid = min_imgid;
+  g.max_imgid = max_imgid;
+  snprintf(g.checkpoint, sizeof(g.checkpoint), "%s.d/generate-cache.checkpoint",
+           darktable.mipmap_cache->cachedir);
 
-  if(!image_count)
+  dt_imgid_t first = min_imgid;
+  if(!restart)
   {
-    fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
-    if(min_imgid > max_imgid)
+    const dt_imgid_t done = _checkpoint_read(&g);
+    if(dt_is_valid_imgid(done) && done >= min_imgid)
     {
-      fprintf(stderr, _("warning: did you want to swap these boundaries?\n"));
+      fprintf(stderr, _("resuming after image id %d, use --restart to start over\n"), done);
+      first = done + 1;
     }
   }
 
   // go through all images:
+  sqlite3_stmt *stmt;
+  g.imgids = g_array_new(FALSE, FALSE, sizeof(dt_imgid_t));
+  g.filenames = g_ptr_array_new_with_free_func(g_free);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id, filename FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
+                              "SELECT id, filename FROM main.images"
+                              " WHERE id >= ?1 AND id <= ?2"
+                              " ORDER BY id", -1, &stmt, 0);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
     const dt_imgid_t imgid = sqlite3_column_int(stmt, 0);
-    const char *imgfilename = (const char*)sqlite3_column_text(stmt, 1);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d, file=%s)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid, imgfilename);
+    g_array_append_val(g.imgids, imgid);
+    g_ptr_array_add(g.filenames, g_strdup((const char *)sqlite3_column_text(stmt, 1)));
+  }
+  sqlite3_finalize(stmt);
 
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
+  const size_t image_count = g.imgids->len;
+  if(!image_count && first == min_imgid)
+  {
+    fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
+    if(min_imgid > max_imgid)
     {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if a valid thumbnail file is already on disc - do nothing
-      if(dt_util_test_image_file(filename)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(&buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(&buf);
+      fprintf(stderr, _("warning: did you want to swap these boundaries?\n"));
     }
-
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mipmap_cache_evict(imgid);
-    // thumbnail in sync with image
-    dt_history_hash_set_mipmap(imgid);
   }
 
-  sqlite3_finalize(stmt);
+  const int nthreads = MAX(1, MIN(threads, (int)image_count));
+  fprintf(stderr, _("generating thumbnails of %zu images using %d threads\n"),
+          image_count, nthreads);
+
+  g.done = calloc(MAX(1, image_count), sizeof(uint8_t));
+  dt_pthread_mutex_init(&g.lock, NULL);
+  g.start = g.saved = dt_get_wtime();
+
+  pthread_t *workers = calloc(nthreads, sizeof(pthread_t));
+  int started = 0;
+  for(; started < nthreads; started++)
+    if(dt_pthread_create(&workers[started], _generate_worker, &g)) break;
+  // if no thread could be started, do the work here
+  if(!started) _generate_worker(&g);
+  for(int k = 0; k < started; k++)
+    dt_pthread_join(workers[k]);
+  free(workers);
+
+  const double elapsed = dt_get_wtime() - g.start;
+  for(int k = min_mip; k <= max_mip; k++)
+    fprintf(stderr, _("level %d: %zu thumbnails generated, %zu failed\n"),
+            k, g.generated[k], g.failed[k]);
+  fprintf(stderr, _("%zu images (%zu already complete) in %.1f s, %.2f images/s\n"),
+          g.counter, g.skipped, elapsed, g.counter / MAX(elapsed, 1e-3));
+
+  // all done, the next run starts from scratch
+  g_unlink(g.checkpoint);
+
+  dt_pthread_mutex_destroy(&g.lock);
+  free(g.done);
+  g_array_free(g.imgids, TRUE);
+  g_ptr_array_free(g.filenames, TRUE);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -131,13 +284,18 @@ static void usage(const char *progname)
           "usage: %s [-h, --help; --version]\n"
           "  [--min-mip <0-8> (default = 0)] [-m, --max-mip <0-8> (default = 2)]\n"
           "  [--min-imgid <N>] [--max-imgid <N>]\n"
+          "  [-j, --threads <N>] [--restart]\n"
           "  [--core <darktable options>]\n"
           "\n"
           "When multiple mipmap sizes are requested, the biggest one is computed\n"
           "while the rest are quickly downsampled.\n"
           "\n"
           "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-          "numbers to work on.\n",
+          "numbers to work on.\n"
+          "\n"
+          "Images are processed by --threads workers, by default as many as darktable\n"
+          "uses for its background jobs. An interrupted run resumes where it stopped\n"
+          "when started again with the same arguments, unless --restart is given.\n",
           progname);
 }
 
@@ -163,6 +321,8 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   dt_imgid_t min_imgid = NO_IMGID;
   int32_t max_imgid = INT32_MAX;
+  int threads = 0;
+  gboolean restart = FALSE;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -198,6 +358,15 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--threads")) && argc > k + 1)
+    {
+      k++;
+      threads = MAX(atoi(arg[k]), 1);
+    }
+    else if(!strcmp(arg[k], "--restart"))
+    {
+      restart = TRUE;
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -251,7 +420,8 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid,
+                              threads ? threads : dt_worker_threads(), restart))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
@@ -125,31 +125,15 @@ void cleanup(dt_imageio_module_format_t *self)
 {
 }
 
-int write_image(dt_imageio_module_data_t *tmp,
-                const char *filename,
-                const void *in_tmp,
-                dt_colorspaces_color_profile_type_t over_type,
-                const char *over_filename,
-                void *exif,
-                int exif_len,
-                dt_imgid_t imgid,
-                int num,
-                int total,
-                struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+// everything but the pixels, with the r, g and b channels
+static void _exr_header(Imf::Header &header,
+                        const dt_imageio_exr_t *exr,
+                        dt_colorspaces_color_profile_type_t over_type,
+                        const char *over_filename,
+                        void *exif,
+                        int exif_len,
+                        dt_imgid_t imgid)
 {
-  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
-
-  Imf::setGlobalThreadCount(dt_get_num_threads());
-
-  Imf::Header header(exr->global.width,  // image width
-                     exr->global.height, // image height
-                     1,                  // pixel aspect ratio
-                     Imath::V2f(0, 0),   // screen window center
-                     1,                  // screen window width
-                     Imf::INCREASING_Y,  // line order
-                     (Imf::Compression)exr->compression);
-
   char comment[1024];
   snprintf(comment, sizeof(comment), "Created with %s", darktable_package_string);
 
@@ -249,11 +233,41 @@ icc_error:
            "might lead to wrong results when opening the image\n");
 icc_end:
 
-  Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
+  const Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
 
   header.channels().insert("R", Imf::Channel(pixel_type, 1, 1, true));
   header.channels().insert("G", Imf::Channel(pixel_type, 1, 1, true));
   header.channels().insert("B", Imf::Channel(pixel_type, 1, 1, true));
+}
+
+int write_image(dt_imageio_module_data_t *tmp,
+                const char *filename,
+                const void *in_tmp,
+                dt_colorspaces_color_profile_type_t over_type,
+                const char *over_filename,
+                void *exif,
+                int exif_len,
+                dt_imgid_t imgid,
+                int num,
+                int total,
+                struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+
+  Imf::setGlobalThreadCount(dt_get_num_threads());
+
+  Imf::Header header(exr->global.width,  // image width
+                     exr->global.height, // image height
+                     1,                  // pixel aspect ratio
+                     Imath::V2f(0, 0),   // screen window center
+                     1,                  // screen window width
+                     Imf::INCREASING_Y,  // line order
+                     (Imf::Compression)exr->compression);
+
+  _exr_header(header, exr, over_type, over_filename, exif, exif_len, imgid);
+
+  Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
 
   Imf::FrameBuffer data;
   size_t stride;
@@ -399,6 +413,136 @@ icc_end:
   return 0;
 }
 
+typedef struct _exr_stream_t
+{
+  Imf::OutputFile *file;
+  unsigned short *half; // conversion buffer for the rows of a strip
+  size_t half_rows;
+  int row;
+} _exr_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *tmp,
+                        const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type,
+                        const char *over_filename,
+                        void *exif,
+                        int exif_len,
+                        dt_imgid_t imgid)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+
+  Imf::setGlobalThreadCount(dt_get_num_threads());
+
+  Imf::Header header(exr->global.width,  // image width
+                     exr->global.height, // image height
+                     1,                  // pixel aspect ratio
+                     Imath::V2f(0, 0),   // screen window center
+                     1,                  // screen window width
+                     Imf::INCREASING_Y,  // line order
+                     (Imf::Compression)exr->compression);
+
+  _exr_header(header, exr, over_type, over_filename, exif, exif_len, imgid);
+
+  _exr_stream_t *st = (_exr_stream_t *)calloc(1, sizeof(_exr_stream_t));
+  try
+  {
+    st->file = new Imf::OutputFile(filename, header);
+  }
+  catch(const std::exception &e)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[exr export] can't write `%s': %s", filename, e.what());
+    free(st);
+    return NULL;
+  }
+  return st;
+}
+
+int write_image_rows(dt_imageio_module_data_t *tmp,
+                     void *handle,
+                     const void *in_tmp,
+                     const int rows)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  _exr_stream_t *st = (_exr_stream_t *)handle;
+  const size_t width = exr->global.width;
+  const int n = MIN(rows, exr->global.height - st->row);
+  const Imf::PixelType pixel_type = (Imf::PixelType)exr->pixel_type;
+
+  // the slices address pixels by their row in the whole image
+  Imf::FrameBuffer data;
+  if(pixel_type == Imf::PixelType::FLOAT)
+  {
+    const size_t stride = 4 * sizeof(float);
+    char *base = (char *)in_tmp - (ptrdiff_t)st->row * stride * width;
+    data.insert("R", Imf::Slice(pixel_type, base + 0 * sizeof(float), stride, stride * width));
+    data.insert("G", Imf::Slice(pixel_type, base + 1 * sizeof(float), stride, stride * width));
+    data.insert("B", Imf::Slice(pixel_type, base + 2 * sizeof(float), stride, stride * width));
+  }
+  else
+  {
+    if(st->half_rows < (size_t)n)
+    {
+      dt_free_align(st->half);
+      st->half = (unsigned short *)dt_alloc_aligned(3 * sizeof(unsigned short) * width * n);
+      st->half_rows = st->half ? n : 0;
+      if(!st->half)
+      {
+        dt_print(DT_DEBUG_ALWAYS, "[exr export] error allocating image conversion buffer");
+        return 1;
+      }
+    }
+
+    unsigned short *const half_buf = st->half;
+    const size_t height = n;
+    DT_OMP_FOR(collapse(2))
+    for(size_t y = 0; y < height; y++)
+    {
+      for(size_t x = 0; x < width; x++)
+      {
+        const float *in_pixel = (const float *)in_tmp + 4 * ((y * width) + x);
+        unsigned short *out_pixel = half_buf + 3 * ((y * width) + x);
+
+        out_pixel[0] = half(in_pixel[0]).bits();
+        out_pixel[1] = half(in_pixel[1]).bits();
+        out_pixel[2] = half(in_pixel[2]).bits();
+      }
+    }
+
+    const size_t stride = 3 * sizeof(unsigned short);
+    char *base = (char *)st->half - (ptrdiff_t)st->row * stride * width;
+    data.insert("R", Imf::Slice(pixel_type, base + 0 * sizeof(unsigned short), stride, stride * width));
+    data.insert("G", Imf::Slice(pixel_type, base + 1 * sizeof(unsigned short), stride, stride * width));
+    data.insert("B", Imf::Slice(pixel_type, base + 2 * sizeof(unsigned short), stride, stride * width));
+  }
+
+  try
+  {
+    st->file->setFrameBuffer(data);
+    st->file->writePixels(n);
+  }
+  catch(const std::exception &e)
+  {
+    dt_print(DT_DEBUG_ALWAYS, "[exr export] error writing rows: %s", e.what());
+    return 1;
+  }
+  st->row += n;
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *tmp,
+                    void *handle,
+                    const gboolean failed)
+{
+  const dt_imageio_exr_t *exr = (dt_imageio_exr_t *)tmp;
+  _exr_stream_t *st = (_exr_stream_t *)handle;
+  const int rc = failed || st->row != exr->global.height;
+
+  delete st->file;
+  dt_free_align(st->half);
+  free(st);
+  return rc;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_exr_t);
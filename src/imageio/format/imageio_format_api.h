@@ -82,6 +82,16 @@ REQUIRED(int, write_image, struct dt_imageio_module_data_t *data, const char *fi
                            dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                            void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
                            const gboolean export_masks);
+/* streaming writers take the image in strips of complete rows from top to bottom, with the same
+   layout as write_image(). data->width and height are set before. write_image_begin() returns NULL
+   if the image can't be streamed with these parameters, write_image() is used then. the handle is
+   freed by write_image_end(), which is also called after a failure. both others return != 0 on fail. */
+OPTIONAL(void *, write_image_begin, struct dt_imageio_module_data_t *data, const char *filename,
+                                    dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                                    void *exif, int exif_len, dt_imgid_t imgid);
+OPTIONAL(int, write_image_rows, struct dt_imageio_module_data_t *data, void *handle, const void *in,
+                                const int rows);
+OPTIONAL(int, write_image_end, struct dt_imageio_module_data_t *data, void *handle, const gboolean failed);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 OPTIONAL(int, levels, struct dt_imageio_module_data_t *data);
 
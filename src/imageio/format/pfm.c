@@ -28,51 +28,103 @@
 
 DT_MODULE(1)
 
-int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+typedef struct _pfm_stream_t
+{
+  FILE *f;
+  int64_t data; // offset of the pixels
+  int row;      // rows written so far
+  float *line;
+} _pfm_stream_t;
+
+static int _pfm_seek(FILE *f, const int64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(f, offset, SEEK_SET);
+#else
+  return fseeko(f, offset, SEEK_SET);
+#endif
+}
+
+void *write_image_begin(dt_imageio_module_data_t *data, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, dt_imgid_t imgid)
 {
   const dt_imageio_module_data_t *const pfm = data;
-  int status = 0;
   FILE *f = g_fopen(filename, "wb");
-  if(f)
+  if(!f) return NULL;
+
+  // align pfm header to sse, assuming the file will
+  // be mmapped to page boundaries.
+  char header[1024];
+  snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  size_t len = strlen(header);
+  fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
+  ssize_t off = 0;
+  while((len + 1 + off) & 0xf) off++;
+  len += off + 1;
+  while(off-- > 0) fprintf(f, "0");
+  fprintf(f, "\n");
+
+  _pfm_stream_t *st = calloc(1, sizeof(_pfm_stream_t));
+  st->f = f;
+  st->data = len;
+  st->line = dt_alloc_align_float((size_t)3 * pfm->width);
+  if(!st->line)
+  {
+    fclose(f);
+    free(st);
+    return NULL;
+  }
+  return st;
+}
+
+int write_image_rows(dt_imageio_module_data_t *data, void *handle, const void *in, const int rows)
+{
+  const dt_imageio_module_data_t *const pfm = data;
+  _pfm_stream_t *st = handle;
+
+  // NOTE: pfm has rows in reverse order, these go right before the ones written last
+  const int n = MIN(rows, pfm->height - st->row);
+  const size_t rowsize = sizeof(float) * 3 * pfm->width;
+  if(_pfm_seek(st->f, st->data + (int64_t)(pfm->height - st->row - n) * rowsize))
+    return 1;
+
+  for(int j = n - 1; j >= 0; j--)
   {
-    // align pfm header to sse, assuming the file will
-    // be mmapped to page boundaries.
-    char header[1024];
-    snprintf(header, 1024, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    size_t len = strlen(header);
-    fprintf(f, "PF\n%d %d\n-1.0", pfm->width, pfm->height);
-    ssize_t off = 0;
-    while((len + 1 + off) & 0xf) off++;
-    while(off-- > 0) fprintf(f, "0");
-    fprintf(f, "\n");
-    void *buf_line = dt_alloc_align_float((size_t)3 * pfm->width);
-    for(int j = 0; buf_line && j < pfm->height; j++)
+    const float *i = (const float *)in + 4 * (size_t)pfm->width * j;
+    float *out = st->line;
+    for(int k = 0; k < pfm->width; k++, i += 4, out += 3)
     {
-      // NOTE: pfm has rows in reverse order
-      const int row_in = pfm->height - 1 - j;
-      const float *in = (const float *)ivoid + 4 * (size_t)pfm->width * row_in;
-      float *out = (float *)buf_line;
-      for(int i = 0; i < pfm->width; i++, in += 4, out += 3)
-      {
-        memcpy(out, in, sizeof(float) * 3);
-      }
-      // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
-      int cnt = fwrite(buf_line, sizeof(float) * 3, pfm->width, f);
-      if(cnt != pfm->width)
-        status = 1;
-      else
-        status = 0;
+      memcpy(out, i, sizeof(float) * 3);
     }
-    dt_free_align(buf_line);
-    buf_line = NULL;
-    fclose(f);
+    // INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
+    if(fwrite(st->line, sizeof(float) * 3, pfm->width, st->f) != (size_t)pfm->width)
+      return 1;
   }
+  st->row += n;
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *data, void *handle, const gboolean failed)
+{
+  _pfm_stream_t *st = handle;
+  const int status = fclose(st->f) != 0 || failed || st->row != data->height;
+  dt_free_align(st->line);
+  free(st);
   return status;
 }
 
+int write_image(dt_imageio_module_data_t *data, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  void *st = write_image_begin(data, filename, over_type, over_filename, exif, exif_len, imgid);
+  if(!st) return 1;
+  const int failed = write_image_rows(data, st, ivoid, data->height);
+  return write_image_end(data, st, failed);
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_module_data_t);
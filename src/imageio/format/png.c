@@ -134,24 +134,27 @@ cleanup:
 }
 #endif
 
-int write_image(dt_imageio_module_data_t *p_tmp,
-                const char *filename,
-                const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type,
-                const char *over_filename,
-                void *exif,
-                int exif_len,
-                dt_imgid_t imgid,
-                int num,
-                int total,
-                struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+typedef struct _png_stream_t
+{
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  int row;
+} _png_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *p_tmp,
+                        const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type,
+                        const char *over_filename,
+                        void *exif,
+                        int exif_len,
+                        dt_imgid_t imgid)
 {
   dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width;
   const int height = p->global.height;
   FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f) return NULL;
 
   png_structp png_ptr;
   png_infop info_ptr;
@@ -160,7 +163,7 @@ int write_image(dt_imageio_module_data_t *p_tmp,
   if(!png_ptr)
   {
     fclose(f);
-    return 1;
+    return NULL;
   }
 
   info_ptr = png_create_info_struct(png_ptr);
@@ -168,14 +171,14 @@ int write_image(dt_imageio_module_data_t *p_tmp,
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    return NULL;
   }
 
   if(setjmp(png_jmpbuf(png_ptr)))
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
+    return NULL;
   }
 
   png_init_io(png_ptr, f);
@@ -314,35 +317,78 @@ int write_image(dt_imageio_module_data_t *p_tmp,
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = dt_alloc_align_type(png_bytep, height);
-  if(row_pointers)
+  /* swap bytes of 16 bit files to most significant bit first */
+  if(p->bpp > 8) png_set_swap(png_ptr);
+
+  _png_stream_t *st = calloc(1, sizeof(_png_stream_t));
+  st->f = f;
+  st->png_ptr = png_ptr;
+  st->info_ptr = info_ptr;
+  return st;
+}
+
+int write_image_rows(dt_imageio_module_data_t *p_tmp,
+                     void *handle,
+                     const void *in,
+                     const int rows)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  _png_stream_t *st = handle;
+  const int width = p->global.width;
+  const int n = MIN(rows, p->global.height - st->row);
+
+  if(setjmp(png_jmpbuf(st->png_ptr)))
+    return 1;
+
+  for(int i = 0; i < n; i++)
   {
     if(p->bpp > 8)
-    {
-      /* swap bytes of 16 bit files to most significant bit first */
-      png_set_swap(png_ptr);
-
-      for(unsigned i = 0; i < height; i++)
-        row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
-    }
+      png_write_row(st->png_ptr, (png_bytep)((uint16_t *)in + (size_t)4 * i * width));
     else
-    {
-      for(unsigned i = 0; i < height; i++)
-        row_pointers[i] = (uint8_t *)ivoid + (size_t)4 * i * width;
-    }
+      png_write_row(st->png_ptr, (png_bytep)((uint8_t *)in + (size_t)4 * i * width));
+  }
+  st->row += n;
+  return 0;
+}
 
-    png_write_image(png_ptr, row_pointers);
+int write_image_end(dt_imageio_module_data_t *p_tmp,
+                    void *handle,
+                    const gboolean failed)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  _png_stream_t *st = handle;
+  int rc = failed || st->row != p->global.height;
 
-    dt_free_align(row_pointers);
-  }
-  else
+  if(!rc)
   {
-    dt_print(DT_DEBUG_ALWAYS, "[png] out of memory writing %s", filename);
+    if(setjmp(png_jmpbuf(st->png_ptr)))
+      rc = 1;
+    else
+      png_write_end(st->png_ptr, st->info_ptr);
   }
-  png_write_end(png_ptr, info_ptr);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(f);
-  return 0;
+  png_destroy_write_struct(&st->png_ptr, &st->info_ptr);
+  fclose(st->f);
+  free(st);
+  return rc;
+}
+
+int write_image(dt_imageio_module_data_t *p_tmp,
+                const char *filename,
+                const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type,
+                const char *over_filename,
+                void *exif,
+                int exif_len,
+                dt_imgid_t imgid,
+                int num,
+                int total,
+                struct dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  void *st = write_image_begin(p_tmp, filename, over_type, over_filename, exif, exif_len, imgid);
+  if(!st) return 1;
+  const int failed = write_image_rows(p_tmp, st, ivoid, p_tmp->height);
+  return write_image_end(p_tmp, st, failed);
 }
 
 static int __attribute__((__unused__)) read_header(const char *filename,
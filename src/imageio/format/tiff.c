@@ -64,99 +64,18 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
-int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+static uint8_t *_tiff_profile(const dt_imgid_t imgid,
+                               const dt_colorspaces_color_profile_type_t over_type,
+                               const char *over_filename,
+                               uint32_t *profile_len)
 {
-  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
-
-  uint8_t *profile = NULL;
-  uint32_t profile_len = 0;
-
-  TIFF *tif = NULL;
-
-  void *rowdata = NULL;
-
-  gboolean free_mask = FALSE;
-  float *raster_mask = NULL;
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-#endif
-  int rc = 1; // default to error
-
   cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, over_type, over_filename)->profile;
-  cmsSaveProfileToMem(out_profile, NULL, &profile_len);
-  if(profile_len > 0)
-  {
-    profile = malloc(profile_len);
-    if(!profile)
-    {
-      rc = 1;
-      goto exit;
-    }
-    cmsSaveProfileToMem(out_profile, profile, &profile_len);
-  }
-
-  uint16_t n_pages = 1;
-  // only when masks are to be stored we check for extra pages!
-  if(export_masks && pipe)
-  {
-    for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
-      n_pages += g_hash_table_size(((dt_dev_pixelpipe_iop_t *)iter->data)->raster_masks);
-  }
-
-  // Create little endian tiff image
-#ifdef _WIN32
-  tif = TIFFOpenW(wfilename, "wl");
-#else
-  tif = TIFFOpen(filename, "wl");
-#endif
-
-  if(!tif)
-  {
-    rc = 1;
-    goto exit;
-  }
-
-  if(n_pages > 1)
-  {
-    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-    TIFFSetField(tif, TIFFTAG_PAGENAME, _("image"));
-    TIFFSetField(tif, TIFFTAG_PAGENUMBER, 0, n_pages);
-  }
-  else
-    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
-
-  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
-
-  // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
-  // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
-  // "software vendors. This code should be considered obsolete. We recommend"
-  // "that TIFF implementations recognize and read the obsolete code but only"
-  // "write the official compression code (0x0008)."
-  // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
-  // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
-  if(d->compress == 1)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
-  else if(d->compress == 2)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    if(d->bpp == 32 || (d->bpp == 16 && d->pixelformat))
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
-
-  if(profile != NULL)
-  {
-    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
-  }
+  *profile_len = 0;
+  cmsSaveProfileToMem(out_profile, NULL, profile_len);
+  uint8_t *profile = *profile_len > 0 ? malloc(*profile_len) : NULL;
+  if(profile) cmsSaveProfileToMem(out_profile, profile, profile_len);
+  return profile;
+}
 
 /* Howto check for a grayscale image?
    We test every pixel for differences between the rgb channels using specific thresholds
@@ -165,6 +84,10 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
    As there might be pipeline errors at the border we leave them alone.
    After these checks layers can be used later on.
 */
+static uint16_t _tiff_layers(const dt_imageio_tiff_t *d,
+                             const void *in_void,
+                             const char *filename)
+{
   volatile uint16_t layers = 3;  // default are rgb images
 
   if(d->shortfile && (d->global.height > 4) && (d->global.width > 4))
@@ -227,6 +150,67 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   if(d->shortfile && layers == 3)
     dt_print(DT_DEBUG_IMAGEIO, "[tiff export] '%s' is not a B&W image, not exporting as grayscale\n", filename);
 
+  return layers;
+}
+
+// create the file and set up the tags of the image page
+static TIFF *_tiff_open(const dt_imageio_tiff_t *d,
+                        const char *filename,
+                        const uint8_t *profile,
+                        const uint32_t profile_len,
+                        const uint16_t n_pages,
+                        const uint16_t layers)
+{
+  // Create little endian tiff image
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tif = TIFFOpenW(wfilename, "wl");
+  g_free(wfilename);
+#else
+  TIFF *tif = TIFFOpen(filename, "wl");
+#endif
+
+  if(!tif) return NULL;
+
+  if(n_pages > 1)
+  {
+    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+    TIFFSetField(tif, TIFFTAG_PAGENAME, _("image"));
+    TIFFSetField(tif, TIFFTAG_PAGENUMBER, 0, n_pages);
+  }
+  else
+    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
+
+  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
+
+  // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
+  // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
+  // "software vendors. This code should be considered obsolete. We recommend"
+  // "that TIFF implementations recognize and read the obsolete code but only"
+  // "write the official compression code (0x0008)."
+  // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
+  // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
+  if(d->compress == 1)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+  else if(d->compress == 2)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    if(d->bpp == 32 || (d->bpp == 16 && d->pixelformat))
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+    else
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+
+  if(profile != NULL)
+  {
+    TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+  }
+
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
   TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT,
@@ -247,16 +231,21 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
   TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
 
-  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
-  {
-    rc = 1;
-    goto exit;
-  }
+  return tif;
+}
 
+// write rows of the image starting at row y0, in_void points to the first of them
+static int _tiff_write_rows(const dt_imageio_tiff_t *d,
+                            TIFF *tif,
+                            void *rowdata,
+                            const void *in_void,
+                            const int y0,
+                            const int rows,
+                            const uint16_t layers)
+{
   if(d->bpp == 32)
   {
-    for(int y = 0; y < d->global.height; y++)
+    for(int y = 0; y < rows; y++)
     {
       float *in = (float *)in_void + (size_t)4 * y * d->global.width;
       float *out = (float *)rowdata;
@@ -266,17 +255,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, sizeof(float) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(TIFFWriteScanline(tif, rowdata, y0 + y, 0) == -1)
+        return 1;
     }
   }
 #ifdef HAVE_IMATH
   else if(d->bpp == 16 && d->pixelformat)
   {
-    for(int y = 0; y < d->global.height; y++)
+    for(int y = 0; y < rows; y++)
     {
       float *in = (float *)in_void + (size_t)4 * y * d->global.width;
       uint16_t *out = (uint16_t *)rowdata;
@@ -286,17 +272,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         for(int l = 0; l < layers; ++l) out[l] = imath_float_to_half(in[l]);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(TIFFWriteScanline(tif, rowdata, y0 + y, 0) == -1)
+        return 1;
     }
   }
 #endif
   else if(d->bpp == 16 && !d->pixelformat)
   {
-    for(int y = 0; y < d->global.height; y++)
+    for(int y = 0; y < rows; y++)
     {
       uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
       uint16_t *out = (uint16_t *)rowdata;
@@ -306,16 +289,13 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, sizeof(uint16_t) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(TIFFWriteScanline(tif, rowdata, y0 + y, 0) == -1)
+        return 1;
     }
   }
   else // 8bpp
   {
-    for(int y = 0; y < d->global.height; y++)
+    for(int y = 0; y < rows; y++)
     {
       uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
       uint8_t *out = (uint8_t *)rowdata;
@@ -325,13 +305,72 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         memcpy(out, in, sizeof(uint8_t) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
+      if(TIFFWriteScanline(tif, rowdata, y0 + y, 0) == -1)
+        return 1;
     }
   }
+  return 0;
+}
+
+int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, dt_imgid_t imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
+                const gboolean export_masks)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  uint8_t *profile = NULL;
+  uint32_t profile_len = 0;
+
+  TIFF *tif = NULL;
+
+  void *rowdata = NULL;
+
+  gboolean free_mask = FALSE;
+  float *raster_mask = NULL;
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+#endif
+  int rc = 1; // default to error
+
+  profile = _tiff_profile(imgid, over_type, over_filename, &profile_len);
+  if(profile_len > 0 && !profile)
+  {
+    rc = 1;
+    goto exit;
+  }
+
+  uint16_t n_pages = 1;
+  // only when masks are to be stored we check for extra pages!
+  if(export_masks && pipe)
+  {
+    for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
+      n_pages += g_hash_table_size(((dt_dev_pixelpipe_iop_t *)iter->data)->raster_masks);
+  }
+
+  const uint16_t layers = _tiff_layers(d, in_void, filename);
+
+  tif = _tiff_open(d, filename, profile, profile_len, n_pages, layers);
+  if(!tif)
+  {
+    rc = 1;
+    goto exit;
+  }
+
+  const int resolution = dt_conf_get_int("metadata/resolution");
+
+  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
+  if((rowdata = malloc(rowsize)) == NULL)
+  {
+    rc = 1;
+    goto exit;
+  }
+
+  if(_tiff_write_rows(d, tif, rowdata, in_void, 0, d->global.height, layers))
+  {
+    rc = 1;
+    goto exit;
+  }
 
   rc = 0;
 
@@ -585,6 +624,86 @@ exit:
   return rc;
 }
 
+typedef struct _tiff_stream_t
+{
+  TIFF *tif;
+  void *rowdata;
+  uint8_t *profile;
+  int row;
+  char *filename;
+  void *exif;
+  int exif_len;
+} _tiff_stream_t;
+
+void *write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, dt_imgid_t imgid)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  // telling grayscale images needs all of the pixels
+  if(d->shortfile) return NULL;
+
+  _tiff_stream_t *st = calloc(1, sizeof(_tiff_stream_t));
+  uint32_t profile_len = 0;
+  st->profile = _tiff_profile(imgid, over_type, over_filename, &profile_len);
+  st->rowdata = malloc((size_t)d->global.width * 3 * d->bpp / 8);
+  if(st->rowdata && (profile_len == 0 || st->profile))
+    st->tif = _tiff_open(d, filename, st->profile, profile_len, 1, 3);
+  if(!st->tif)
+  {
+    free(st->rowdata);
+    free(st->profile);
+    free(st);
+    return NULL;
+  }
+
+  st->filename = g_strdup(filename);
+  if(exif && exif_len > 0)
+  {
+    st->exif = malloc(exif_len);
+    if(st->exif)
+    {
+      memcpy(st->exif, exif, exif_len);
+      st->exif_len = exif_len;
+    }
+  }
+  return st;
+}
+
+int write_image_rows(dt_imageio_module_data_t *d_tmp, void *handle, const void *in, const int rows)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  _tiff_stream_t *st = handle;
+
+  const int n = MIN(rows, d->global.height - st->row);
+  if(_tiff_write_rows(d, st->tif, st->rowdata, in, st->row, n, 3)) return 1;
+  st->row += n;
+  return 0;
+}
+
+int write_image_end(dt_imageio_module_data_t *d_tmp, void *handle, const gboolean failed)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+  _tiff_stream_t *st = handle;
+
+  TIFFClose(st->tif);
+  int rc = failed || st->row != d->global.height;
+  if(!rc && st->exif)
+  {
+    rc = dt_exif_write_blob(st->exif, st->exif_len, st->filename, d->compress > 0);
+    // Until we get symbolic error status codes, if rc is 1, return 0
+    rc = (rc == 1) ? 0 : 1;
+  }
+
+  free(st->rowdata);
+  free(st->profile);
+  free(st->exif);
+  g_free(st->filename);
+  free(st);
+  return rc;
+}
+
 size_t params_size(dt_imageio_module_format_t *self)
 {
   return sizeof(dt_imageio_tiff_t) - sizeof(TIFF *);
@@ -21,6 +21,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_timing.h"
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
 #include "common/styles.h"
@@ -1039,6 +1040,308 @@ static double _get_pipescale(dt_dev_pixelpipe_t *pipe,
   return fmin(scalex, scaley);
 }
 
+// huge exports are processed in strips of about this many pixels
+#define DT_EXPORT_STRIP_PIXELS (16 << 20)
+#define DT_EXPORT_STRIP_MIN_ROWS 16
+
+// run the export pipe for the rows y to y + height of the output
+static void _export_process(dt_dev_pixelpipe_t *pipe,
+                            dt_develop_t *dev,
+                            const int y,
+                            const int width,
+                            const int height,
+                            const double scale,
+                            const gboolean hq_process,
+                            const int bpp)
+{
+  if(hq_process)
+  {
+    /*
+     * if high quality processing was requested, downsampling will be done
+     * at the very end of the pipe (just before border and watermark)
+     */
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+  }
+  else
+  {
+    // else, downsampling will be right after demosaic
+
+    // so we need to turn temporarily disable in-pipe late downsampling iop.
+
+    // find the finalscale module
+    dt_dev_pixelpipe_iop_t *finalscale = NULL;
+    {
+      for(const GList *nodes = g_list_last(pipe->nodes);
+          nodes;
+          nodes = g_list_previous(nodes))
+      {
+        dt_dev_pixelpipe_iop_t *node = nodes->data;
+        if(dt_iop_module_is_finalscale(node->module))
+        {
+          finalscale = node;
+          break;
+        }
+      }
+    }
+
+    if(finalscale) finalscale->enabled = FALSE;
+
+    // do the processing (8-bit with special treatment, to make sure
+    // we can use openmp further down):
+    if(bpp == 8)
+      dt_dev_pixelpipe_process(pipe, dev, 0, y, width, height, scale, DT_DEVICE_NONE);
+    else
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, y, width, height, scale);
+
+    if(finalscale) finalscale->enabled = TRUE;
+  }
+}
+
+// convert the pipe output in place to what the format wants
+static void _export_convert(uint8_t *outbuf,
+                            const size_t npixels,
+                            const int bpp,
+                            const gboolean display_byteorder,
+                            const gboolean hq_process)
+{
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(hq_process)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(hq_process)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < npixels; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+        DT_OMP_FOR()
+        // just flip byte order
+        for(size_t k = 0; k < npixels; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(size_t k = 0; k < npixels; k++)
+    {
+      // convert in place
+      for(int i = 0; i < 3; i++)
+        buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
+    }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// the exif blob to embed into the exported file, NULL if none should be
+static uint8_t *_export_exif_blob(const dt_imgid_t imgid,
+                                  dt_imageio_module_format_t *format,
+                                  const dt_export_metadata_t *metadata,
+                                  const gboolean ignore_exif,
+                                  const gboolean sRGB,
+                                  const int width,
+                                  const int height,
+                                  int *length)
+{
+  *length = 0;
+
+  // Check if all the metadata export flags are set for AVIF/EXR/HEIF/JPEG XL/XCF (opt-in)
+  //
+  // TODO: this is a workaround as these formats do not support fine
+  // grained metadata control through dt_exif_xmp_attach_export()
+  // below due to lack of exiv2 write support
+  //
+  // Note: that this is done only when we do not ignore_exif, so we have a proper filename
+  //       otherwise the export is done in a memory buffer.
+  gboolean md_flags_set = TRUE;
+  if(!ignore_exif
+     && (!strcmp(format->mime(NULL), "image/avif")
+         || !strcmp(format->mime(NULL), "image/heif")
+         || !strcmp(format->mime(NULL), "image/x-exr")
+         || !strcmp(format->mime(NULL), "image/jxl")
+         || !strcmp(format->mime(NULL), "image/x-xcf")))
+  {
+    const int32_t meta_all =
+      DT_META_EXIF | DT_META_METADATA | DT_META_GEOTAG | DT_META_TAG
+      | DT_META_HIERARCHICAL_TAG | DT_META_DT_HISTORY | DT_META_PRIVATE_TAG
+      | DT_META_SYNONYMS_TAG | DT_META_OMIT_HIERARCHY;
+    md_flags_set = metadata ? (metadata->flags & meta_all) == meta_all : FALSE;
+  }
+
+  if(ignore_exif || !md_flags_set) return NULL;
+
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes
+                                // max, but if original size is
+                                // close to that, adding new tags
+                                // could make it go over that... so
+                                // let it be and see what happens
+                                // when we write the image
+  char pathname[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
+
+  // last param is dng mode, it's false here
+  *length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, width, height, FALSE);
+  return exif_profile;
+}
+
+// strips are processed like a darkroom region of interest, which every
+// module handles, except those deriving statistics from their whole input.
+// modules looking at neighbouring pixels get their context from the padding.
+static gboolean _export_pipe_streamable(const dt_dev_pixelpipe_t *pipe)
+{
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    if(!piece->enabled) continue;
+    if(piece->module->flags() & IOP_FLAGS_WHOLE_IMAGE)
+    {
+      dt_print(DT_DEBUG_IMAGEIO,
+               "[dt_imageio_export_with_flags] no streaming, module `%s' needs the whole image",
+               piece->module->op);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// rows processed above and below each strip and cropped again, so that the
+// modules see the same neighbourhood as for the whole image. That is the
+// sum of the tiling overlaps of all modules in output pixels.
+static int _export_strip_padding(dt_dev_pixelpipe_t *pipe,
+                                 const double scale,
+                                 const gboolean hq_process)
+{
+  float padding = 0.0f;
+  gboolean scaled = !hq_process;
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = nodes->data;
+    // high quality processing runs at full resolution up to finalscale
+    if(dt_iop_module_is_finalscale(piece->module)) scaled = TRUE;
+    if(!piece->enabled) continue;
+
+    const float s = scaled ? scale : 1.0f;
+    const dt_iop_roi_t roi = { 0, 0, piece->buf_in.width * s, piece->buf_in.height * s, s };
+    dt_develop_tiling_t tiling = { 0 };
+    tiling.factor_cl = tiling.maxbuf_cl = -1.0f;
+    piece->module->tiling_callback(piece->module, piece, &roi, &roi, &tiling);
+    padding += tiling.overlap * scale / s;
+  }
+  return (int)ceilf(padding) + 2;
+}
+
+// rows per strip of a streaming export and their padding, 0 if the image
+// is exported as a whole
+static int _export_strip_rows(dt_dev_pixelpipe_t *pipe,
+                              const int width,
+                              const int height,
+                              const double scale,
+                              const gboolean hq_process,
+                              int *padding)
+{
+  *padding = 0;
+  const int megapixels = dt_conf_get_int("export_streaming_megapixels");
+  if(megapixels <= 0 || (double)width * height < megapixels * 1e6) return 0;
+  if(!_export_pipe_streamable(pipe)) return 0;
+
+  *padding = _export_strip_padding(pipe, scale, hq_process);
+
+  // don't let the padding cost more than half of the processing
+  const int rows = MAX(MAX(DT_EXPORT_STRIP_MIN_ROWS, 4 * *padding),
+                       DT_EXPORT_STRIP_PIXELS / MAX(width, 1));
+  return rows < height ? rows : 0;
+}
+
+// process the output in strips of rows and hand them to the format as they
+// are done, returns TRUE on error
+static gboolean _export_strips(dt_dev_pixelpipe_t *pipe,
+                               dt_develop_t *dev,
+                               dt_imageio_module_format_t *format,
+                               dt_imageio_module_data_t *format_params,
+                               void *stream,
+                               const int width,
+                               const int height,
+                               const int strip_rows,
+                               const int padding,
+                               const double scale,
+                               const gboolean hq_process,
+                               const int bpp,
+                               const gboolean display_byteorder,
+                               double *pipe_time,
+                               double *write_time)
+{
+  gboolean failed = FALSE;
+  for(int y = 0; y < height && !failed; y += strip_rows)
+  {
+    const int rows = MIN(strip_rows, height - y);
+    const int y0 = MAX(0, y - padding);
+    const int y1 = MIN(height, y + rows + padding);
+    double lap = dt_get_wtime();
+    _export_process(pipe, dev, y0, width, y1 - y0, scale, hq_process, bpp);
+    *pipe_time += dt_get_wtime() - lap;
+
+    if(!pipe->backbuf || pipe->backbuf_width != width || pipe->backbuf_height != y1 - y0)
+    {
+      dt_print(DT_DEBUG_IMAGEIO,
+               "[dt_imageio_export_with_flags] no valid output buffer for rows %d-%d",
+               y0, y1);
+      failed = TRUE;
+      break;
+    }
+    // only the rows of the strip are converted and written, the padding is dropped
+    const size_t pixel_size = (bpp == 8 && !hq_process) ? 4 : 4 * sizeof(float);
+    uint8_t *outbuf = pipe->backbuf + (size_t)(y - y0) * width * pixel_size;
+    _export_convert(outbuf, (size_t)width * rows, bpp, display_byteorder, hq_process);
+
+    lap = dt_get_wtime();
+    failed = format->write_image_rows(format_params, stream, outbuf, rows) != 0;
+    *write_time += dt_get_wtime() - lap;
+  }
+
+  const double lap = dt_get_wtime();
+  failed = format->write_image_end(format_params, stream, failed) != 0 || failed;
+  *write_time += dt_get_wtime() - lap;
+  return failed;
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder
 // flag + high-quality override
 gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
@@ -1065,6 +1368,10 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
                                       dt_export_metadata_t *metadata,
                                       const int history_end)
 {
+  // machine readable timings, if the caller asked for them
+  dt_export_timing_t *timing = thumbnail_export ? NULL : dt_export_timing_current();
+  double lap = dt_get_wtime();
+
   dt_develop_t dev;
   dt_dev_init(&dev, FALSE);
   dt_dev_load_image(&dev, imgid);
@@ -1077,6 +1384,12 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
   dt_mipmap_buffer_t buf;
   dt_mipmap_cache_get(&buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
 
+  if(timing)
+  {
+    timing->load = dt_get_wtime() - lap;
+    g_strlcpy(timing->filename, filename, sizeof(timing->filename));
+  }
+
   const dt_image_t *img = &dev.image_storage;
 
   if(!buf.buf || !buf.width || !buf.height)
@@ -1333,187 +1646,76 @@ gboolean dt_imageio_export_with_flags(const dt_imgid_t imgid,
 
   const int bpp = format->bpp(format_params);
 
-  dt_get_perf_times(&start);
   const gboolean hq_process = high_quality_processing || scale > 1.0f;
-  if(hq_process)
-  {
-    /*
-     * if high quality processing was requested, downsampling will be done
-     * at the very end of the pipe (just before border and watermark)
-     */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0,
-                                      processed_width, processed_height, scale);
-  }
-  else
-  {
-    // else, downsampling will be right after demosaic
-
-    // so we need to turn temporarily disable in-pipe late downsampling iop.
-
-    // find the finalscale module
-    dt_dev_pixelpipe_iop_t *finalscale = NULL;
-    {
-      for(const GList *nodes = g_list_last(pipe.nodes);
-          nodes;
-          nodes = g_list_previous(nodes))
-      {
-        dt_dev_pixelpipe_iop_t *node = nodes->data;
-        if(dt_iop_module_is_finalscale(node->module))
-        {
-          finalscale = node;
-          break;
-        }
-      }
-    }
 
-    if(finalscale) finalscale->enabled = FALSE;
-
-    // do the processing (8-bit with special treatment, to make sure
-    // we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0,
-                               processed_width, processed_height, scale, DT_DEVICE_NONE);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0,
-                                        processed_width, processed_height, scale);
+  format_params->width = processed_width;
+  format_params->height = processed_height;
 
-    if(finalscale) finalscale->enabled = TRUE;
-  }
-  dt_show_times(&start,
-                thumbnail_export
-                  ? "[dev_process_thumbnail] pixel pipeline processing"
-                  : "[dev_process_export] pixel pipeline processing");
+  lap = dt_get_wtime();
+  int exif_len = 0;
+  uint8_t *exif = _export_exif_blob(imgid, format, metadata, ignore_exif, sRGB,
+                                    processed_width, processed_height, &exif_len);
+  double write_time = dt_get_wtime() - lap;
+
+  /* huge images are processed and written in strips of rows if the format
+     takes them that way, so the output is never in memory as a whole */
+  int strip_padding = 0;
+  const int strip_rows = _export_strip_rows(&pipe, processed_width, processed_height,
+                                            scale, hq_process, &strip_padding);
+  void *stream = strip_rows && !thumbnail_export && !export_masks
+                 && format->write_image_begin && format->write_image_rows && format->write_image_end
+    ? format->write_image_begin(format_params, filename, icc_type, icc_filename,
+                                exif, exif_len, imgid)
+    : NULL;
 
-  uint8_t *outbuf = pipe.backbuf;
-  if(outbuf == NULL)
+  dt_get_perf_times(&start);
+  lap = dt_get_wtime();
+  if(stream)
   {
     dt_print(DT_DEBUG_IMAGEIO,
-             "[dt_imageio_export_with_flags] no valid output buffer");
-    goto error;
-  }
-
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
+             "[dt_imageio_export_with_flags] streaming %dx%d in strips of %d rows,"
+             " padded by %d rows",
+             processed_width, processed_height, strip_rows, strip_padding);
+    double pipe_time = 0.0;
+    res = _export_strips(&pipe, &dev, format, format_params, stream,
+                         processed_width, processed_height, strip_rows, strip_padding, scale,
+                         hq_process, bpp, display_byteorder, &pipe_time, &write_time);
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing in strips");
+    if(timing)
     {
-      if(hq_process)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(hq_process)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-        DT_OMP_FOR()
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
+      timing->pipe = pipe_time;
+      timing->write = write_time;
     }
   }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++)
-          buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
-      }
-  }
-  // else output float, no further harm done to the pixels :)
-
-  format_params->width = processed_width;
-  format_params->height = processed_height;
-
-  // Check if all the metadata export flags are set for AVIF/EXR/HEIF/JPEG XL/XCF (opt-in)
-  //
-  // TODO: this is a workaround as these formats do not support fine
-  // grained metadata control through dt_exif_xmp_attach_export()
-  // below due to lack of exiv2 write support
-  //
-  // Note: that this is done only when we do not ignore_exif, so we have a proper filename
-  //       otherwise the export is done in a memory buffer.
-  gboolean md_flags_set = TRUE;
-  if(!ignore_exif
-     && (!strcmp(format->mime(NULL), "image/avif")
-         || !strcmp(format->mime(NULL), "image/heif")
-         || !strcmp(format->mime(NULL), "image/x-exr")
-         || !strcmp(format->mime(NULL), "image/jxl")
-         || !strcmp(format->mime(NULL), "image/x-xcf")))
-  {
-    const int32_t meta_all =
-      DT_META_EXIF | DT_META_METADATA | DT_META_GEOTAG | DT_META_TAG
-      | DT_META_HIERARCHICAL_TAG | DT_META_DT_HISTORY | DT_META_PRIVATE_TAG
-      | DT_META_SYNONYMS_TAG | DT_META_OMIT_HIERARCHY;
-    md_flags_set = metadata ? (metadata->flags & meta_all) == meta_all : FALSE;
-  }
-
-  if(!ignore_exif && md_flags_set)
+  else
   {
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes
-                                  // max, but if original size is
-                                  // close to that, adding new tags
-                                  // could make it go over that... so
-                                  // let it be and see what happens
-                                  // when we write the image
-    char pathname[PATH_MAX] = { 0 };
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid, pathname, sizeof(pathname), &from_cache);
-
-    // last param is dng mode, it's false here
-    const int length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB,
-                                         processed_width, processed_height, FALSE);
+    _export_process(&pipe, &dev, 0, processed_width, processed_height, scale, hq_process, bpp);
+    dt_show_times(&start,
+                  thumbnail_export
+                    ? "[dev_process_thumbnail] pixel pipeline processing"
+                    : "[dev_process_export] pixel pipeline processing");
+    if(timing) timing->pipe = dt_get_wtime() - lap;
+
+    uint8_t *outbuf = pipe.backbuf;
+    if(outbuf == NULL)
+    {
+      dt_print(DT_DEBUG_IMAGEIO,
+               "[dt_imageio_export_with_flags] no valid output buffer");
+      free(exif);
+      goto error;
+    }
 
-    res = (format->write_image(format_params, filename, outbuf, icc_type,
-                              icc_filename, exif_profile, length, imgid,
-                              num, total, &pipe, export_masks)) != 0;
+    // downconversion to low-precision formats:
+    _export_convert(outbuf, (size_t)processed_width * processed_height,
+                    bpp, display_byteorder, hq_process);
 
-    free(exif_profile);
-  }
-  else
-  {
+    lap = dt_get_wtime();
     res = (format->write_image(format_params, filename, outbuf, icc_type,
-                              icc_filename, NULL, 0, imgid, num, total,
-                              &pipe, export_masks)) != 0;
+                               icc_filename, exif, exif_len, imgid,
+                               num, total, &pipe, export_masks)) != 0;
+    if(timing) timing->write = write_time + dt_get_wtime() - lap;
   }
+  free(exif);
 
   if(res)
     goto error;
@@ -131,7 +131,7 @@ const char **description(dt_iop_module_t *self)
 int flags()
 {
   return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE
-    | IOP_FLAGS_ALLOW_FAST_PIPE
+    | IOP_FLAGS_ALLOW_FAST_PIPE | IOP_FLAGS_FUSED_WARP
     | IOP_FLAGS_GUIDES_SPECIAL_DRAW | IOP_FLAGS_GUIDES_WIDGET;
 }
 
@@ -20,6 +20,7 @@
 
 #include "bauhaus/bauhaus.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "develop/imageop_gui.h"
 #include "gui/color_picker_proxy.h"
 #include "gui/gtk.h"
@@ -656,6 +657,22 @@ static void reduce_chromatic_aberrations(const float* const restrict in,
   reduce_artifacts(in, width, height, sigma, guide, safety, out);
 }
 
+void tiling_callback(dt_iop_module_t *self,
+                     dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in,
+                     const dt_iop_roi_t *roi_out,
+                     dt_develop_tiling_t *tiling)
+{
+  default_tiling_callback(self, piece, roi_in, roi_out, tiling);
+  // the module doesn't tile, the footprint is for streamed exports and
+  // patches of the darkroom output
+  const dt_iop_cacorrectrgb_params_t *d = piece->data;
+  // the wider of the two blurs of process()
+  const float scale = fmaxf(piece->iscale / roi_in->scale, 1.f);
+  const float sigma2 = fmaxf(d->radius * d->radius / scale, 1.0f);
+  tiling->overlap = (int)ceilf(3.0f * sigma2);
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *const ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
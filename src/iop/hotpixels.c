@@ -20,6 +20,7 @@
 #include "common/imagebuf.h"
 #include "control/control.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
 #include "dtgtk/resetlabel.h"
@@ -324,6 +325,18 @@ static int _process_xtrans(const dt_iop_hotpixels_data_t *data,
   return fixed;
 }
 
+void tiling_callback(dt_iop_module_t *self,
+                     dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in,
+                     const dt_iop_roi_t *roi_out,
+                     dt_develop_tiling_t *tiling)
+{
+  default_tiling_callback(self, piece, roi_in, roi_out, tiling);
+  // the module doesn't tile, the footprint is for streamed exports and
+  // patches of the darkroom output
+  tiling->overlap = 2;
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -23,6 +23,7 @@
 #include "common/dwt.h"
 #include "control/control.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
 #include "develop/openmp_maths.h"
@@ -517,6 +518,19 @@ void reload_defaults(dt_iop_module_t *self)
   self->default_enabled = FALSE;
 }
 
+void tiling_callback(dt_iop_module_t *self,
+                     dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in,
+                     const dt_iop_roi_t *roi_out,
+                     dt_develop_tiling_t *tiling)
+{
+  default_tiling_callback(self, piece, roi_in, roi_out, tiling);
+  // the module doesn't tile, the footprint is for streamed exports and
+  // patches of the darkroom output
+  // the wavelet bands of every half resolution sensel channel
+  tiling->overlap = 2 << DT_IOP_RAWDENOISE_BANDS;
+}
+
 void commit_params(dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -2269,7 +2269,9 @@ void tiling_callback(dt_iop_module_t *self,
   tiling->maxbuf = 1.0f;
   tiling->maxbuf_cl = 1.0f;
   tiling->overhead = 0;
-  tiling->overlap = 0;
+  // the wavelet scales reach 2^scale pixels of the processed roi, the
+  // module doesn't tile but the darkroom patches its output by this
+  tiling->overlap = (p->num_scales > 0) ? 1 << p->num_scales : 0;
   tiling->align = 1;
 }
 
@@ -0,0 +1,343 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * darktable-bench-iop: time the process() function of single modules
+ *
+ * Every module given on the command line is loaded with its default
+ * parameters and run on a synthetic image of each requested size and
+ * with each requested number of threads. The input is made by tiling
+ * the rgb test image of the unit tests, so results are reproducible.
+ * The best of the repetitions is reported as Mpix/s of output.
+ *
+ * The modules work outside of a real pixelpipe: they see a linear
+ * Rec2020 work profile and a non-raw float image. Modules working on
+ * raw data are skipped.
+ */
+
+#include "common/darktable.h"
+#include "common/iop_profile.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include "../unittests/util/testimg.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define BENCH_MAX_VALUES 16
+
+typedef struct bench_options_t
+{
+  int sizes[BENCH_MAX_VALUES];
+  int num_sizes;
+  int threads[BENCH_MAX_VALUES];
+  int num_threads;
+  int reps;
+  double min_mpix;
+} bench_options_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr,
+          "usage: %s [options] <op> [<op> ...] [--core <darktable options>]\n"
+          "\n"
+          "   <op>                 module to benchmark, like `exposure', or `all'\n"
+          "   --sizes <w,...>      square image sizes in pixels, default: 1024,4096\n"
+          "   --threads <n,...>    numbers of threads, default: 1 and all\n"
+          "   --reps <n>           repetitions per measurement, default: 5\n"
+          "   --min-mpix <x>       exit with an error if any module is slower\n"
+          "                        than x Mpix/s, for use in regression tests\n",
+          progname);
+}
+
+static int _parse_list(const char *arg, int *values)
+{
+  int n = 0;
+  gchar **tokens = g_strsplit(arg, ",", BENCH_MAX_VALUES);
+  for(gchar **t = tokens; *t && n < BENCH_MAX_VALUES; t++)
+  {
+    const int v = atoi(*t);
+    if(v > 0) values[n++] = v;
+  }
+  g_strfreev(tokens);
+  return n;
+}
+
+// fill the buffer with copies of the rgb space test image
+static void _fill_input(float *buf, const int width, const int height)
+{
+  Testimg *ti = testimg_gen_rgb_space(TESTIMG_STD_WIDTH);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      const float *p = get_pixel(ti, x % ti->width, y % ti->height);
+      float *out = buf + 4 * ((size_t)y * width + x);
+      for(int c = 0; c < 3; c++) out[c] = p[c];
+      out[3] = 0.0f;
+    }
+  testimg_free(ti);
+}
+
+static void _set_threads(const int threads)
+{
+  darktable.num_openmp_threads = threads;
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
+/* runs process() of the piece on a size x size output, returns the
+   best time of all repetitions in seconds or a negative value if
+   the buffers could not be allocated.
+*/
+static double _bench_process(dt_iop_module_t *module,
+                             dt_dev_pixelpipe_iop_t *piece,
+                             const int size,
+                             const int reps)
+{
+  const dt_iop_roi_t roi_out = { 0, 0, size, size, 1.0f };
+  dt_iop_roi_t roi_in = roi_out;
+  if(module->modify_roi_in)
+    module->modify_roi_in(module, piece, &roi_out, &roi_in);
+
+  float *in = dt_alloc_align_float((size_t)4 * roi_in.width * roi_in.height);
+  float *out = dt_alloc_align_float((size_t)4 * roi_out.width * roi_out.height);
+  if(!in || !out)
+  {
+    dt_free_align(in);
+    dt_free_align(out);
+    return -1.0;
+  }
+  _fill_input(in, roi_in.width, roi_in.height);
+
+  piece->buf_in = piece->processed_roi_in = roi_in;
+  piece->buf_out = piece->processed_roi_out = roi_out;
+
+  // the first run warms up caches and lets the module allocate its luts
+  module->process(module, piece, in, out, &roi_in, &roi_out);
+
+  double best = DBL_MAX;
+  for(int r = 0; r < reps; r++)
+  {
+    const double start = dt_get_wtime();
+    module->process(module, piece, in, out, &roi_in, &roi_out);
+    best = MIN(best, dt_get_wtime() - start);
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  return best;
+}
+
+// returns the lowest throughput measured in Mpix/s, negative if nothing was measured
+static double _bench_piece(dt_iop_module_t *module,
+                           dt_dev_pixelpipe_t *pipe,
+                           const bench_options_t *opt)
+{
+  dt_dev_pixelpipe_iop_t *piece = calloc(1, sizeof(dt_dev_pixelpipe_iop_t));
+  if(!piece) return -1.0;
+
+  piece->module = module;
+  piece->pipe = pipe;
+  piece->enabled = TRUE;
+  piece->colors = 4;
+  piece->iscale = 1.0f;
+  piece->dsc_in = piece->dsc_out = pipe->dsc;
+  piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                              NULL, dt_free_align_ptr);
+  dt_iop_init_pipe(module, pipe, piece);
+  dt_iop_commit_params(module, module->default_params, module->default_blendop_params,
+                       pipe, piece);
+
+  double slowest = -1.0;
+  for(int s = 0; s < opt->num_sizes; s++)
+  {
+    const int size = opt->sizes[s];
+    piece->iwidth = piece->iheight = size;
+    pipe->iwidth = pipe->iheight = size;
+    for(int t = 0; t < opt->num_threads; t++)
+    {
+      _set_threads(opt->threads[t]);
+      const double secs = _bench_process(module, piece, size, opt->reps);
+      if(secs < 0.0)
+      {
+        printf("%-20s %6d %4d  out of memory\n", module->op, size, opt->threads[t]);
+        continue;
+      }
+      const double mpix = (double)size * size / 1e6 / MAX(secs, 1e-9);
+      printf("%-20s %6d %4d %10.4f %10.2f\n", module->op, size, opt->threads[t], secs, mpix);
+      slowest = slowest < 0.0 ? mpix : MIN(slowest, mpix);
+    }
+  }
+
+  module->cleanup_pipe(module, pipe, piece);
+  g_hash_table_destroy(piece->raster_masks);
+  free(piece);
+  return slowest;
+}
+
+static double _bench_module(dt_develop_t *dev,
+                            dt_dev_pixelpipe_t *pipe,
+                            dt_iop_module_so_t *so,
+                            const bench_options_t *opt)
+{
+  dt_iop_module_t *module = calloc(1, sizeof(dt_iop_module_t));
+  // dt_iop_load_module() frees the module on failure
+  if(!module || dt_iop_load_module(module, so, dev))
+  {
+    fprintf(stderr, "%s: can't load module\n", so->op);
+    return -1.0;
+  }
+
+  double slowest = -1.0;
+  if(module->default_colorspace(module, pipe, NULL) == IOP_CS_RAW)
+    printf("%-20s skipped, works on raw data\n", so->op);
+  else
+  {
+    module->enabled = TRUE;
+    slowest = _bench_piece(module, pipe, opt);
+  }
+
+  dt_iop_cleanup_module(module);
+  free(module);
+  return slowest;
+}
+
+int main(int argc, char *arg[])
+{
+  bench_options_t opt = { .sizes = { 1024, 4096 }, .num_sizes = 2, .reps = 5, .min_mpix = 0.0 };
+  GList *ops = NULL;
+  gboolean all = FALSE;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--sizes") && argc > k + 1)
+      opt.num_sizes = _parse_list(arg[++k], opt.sizes);
+    else if(!strcmp(arg[k], "--threads") && argc > k + 1)
+      opt.num_threads = _parse_list(arg[++k], opt.threads);
+    else if(!strcmp(arg[k], "--reps") && argc > k + 1)
+      opt.reps = MAX(1, atoi(arg[++k]));
+    else if(!strcmp(arg[k], "--min-mpix") && argc > k + 1)
+      opt.min_mpix = g_ascii_strtod(arg[++k], NULL);
+    else if(!strcmp(arg[k], "--core"))
+    {
+      k++;
+      break;
+    }
+    else if(arg[k][0] == '-')
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "all"))
+      all = TRUE;
+    else
+      ops = g_list_append(ops, arg[k]);
+  }
+
+  if(!ops && !all)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  int m_argc = 0;
+  char **m_arg = malloc(sizeof(char *) * (5 + argc - k + 1));
+  m_arg[m_argc++] = "darktable-bench-iop";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=never";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL)) exit(1);
+
+  if(opt.num_threads == 0)
+  {
+    opt.threads[opt.num_threads++] = 1;
+    if(darktable.num_openmp_threads > 1)
+      opt.threads[opt.num_threads++] = darktable.num_openmp_threads;
+  }
+  const int max_threads = darktable.num_openmp_threads;
+
+  // a develop with a fake non-raw float image in a linear rec2020 work profile
+  dt_develop_t dev;
+  dt_dev_init(&dev, FALSE);
+  dt_image_init(&dev.image_storage);
+  dev.image_storage.buf_dsc.channels = 4;
+  dev.image_storage.buf_dsc.datatype = TYPE_FLOAT;
+
+  dt_dev_pixelpipe_t pipe;
+  dt_dev_pixelpipe_init_dummy(&pipe, 0, 0);
+  pipe.type = DT_DEV_PIXELPIPE_EXPORT;
+  pipe.image = dev.image_storage;
+  pipe.dsc = dev.image_storage.buf_dsc;
+  for_four_channels(c) pipe.dsc.processed_maximum[c] = 1.0f;
+  // there is no image in the cache to attach the input profile to, so
+  // all profiles are the work profile
+  dt_ioppr_set_pipe_work_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "",
+                                      DT_INTENT_PERCEPTUAL);
+  pipe.input_profile_info = pipe.output_profile_info = pipe.work_profile_info;
+
+  printf("%-20s %6s %4s %10s %10s\n", "module", "size", "thr", "secs", "Mpix/s");
+
+  int res = 0;
+  for(GList *l = darktable.iop; l; l = g_list_next(l))
+  {
+    dt_iop_module_so_t *so = l->data;
+    if(!all && !g_list_find_custom(ops, so->op, (GCompareFunc)g_strcmp0)) continue;
+    const double slowest = _bench_module(&dev, &pipe, so, &opt);
+    if(slowest >= 0.0 && slowest < opt.min_mpix)
+    {
+      fprintf(stderr, "%s: %.2f Mpix/s is below the required %.2f Mpix/s\n",
+              so->op, slowest, opt.min_mpix);
+      res = 1;
+    }
+  }
+
+  for(GList *l = ops; l; l = g_list_next(l))
+    if(!dt_iop_get_module_so(l->data))
+    {
+      fprintf(stderr, "unknown module `%s'\n", (char *)l->data);
+      res = 1;
+    }
+
+  _set_threads(max_threads);
+  g_list_free(ops);
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_cleanup();
+  free(m_arg);
+  exit(res);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
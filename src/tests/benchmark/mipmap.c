@@ -0,0 +1,241 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2025 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * darktable-bench-mipmap: compare the codecs of the thumbnail disk cache
+ *
+ * Thumbnails of the first images of a library are generated for each
+ * requested mip level, then compressed and decompressed with every
+ * codec the disk backend supports. Reported per level and codec are the
+ * mean size on disk, the mean encode and decode times (the best of the
+ * repetitions) and the PSNR of the decoded thumbnail.
+ *
+ * The disk backend is turned off while running so that the thumbnails
+ * come from the images and the cache on disk is left alone.
+ */
+
+#include "common/darktable.h"
+#include "common/debug.h"
+#include "common/mipmap_cache.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+typedef struct bench_result_t
+{
+  int count;
+  double size;
+  double encode;
+  double decode;
+  double mse;
+  double pixels;
+} bench_result_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr,
+          "usage: %s [options] [--core <darktable options>]\n"
+          "\n"
+          "   --images <n>         number of images of the library to use, default: 50\n"
+          "   --min-mip <0-%d>     smallest level to measure, default: 0\n"
+          "   --max-mip <0-%d>     largest level to measure, default: 4\n"
+          "   --reps <n>           repetitions per measurement, default: 3\n",
+          progname, (int)DT_MIPMAP_LDR_MAX, (int)DT_MIPMAP_LDR_MAX);
+}
+
+static void _bench_thumbnail(const uint8_t *in,
+                             const int width,
+                             const int height,
+                             const dt_colorspaces_color_profile_type_t color_space,
+                             const dt_mipmap_cache_codec_t codec,
+                             const int reps,
+                             uint8_t *out,
+                             bench_result_t *res)
+{
+  double encode = DBL_MAX, decode = DBL_MAX;
+  size_t length = 0;
+  uint8_t *blob = NULL;
+  for(int r = 0; r < reps; r++)
+  {
+    free(blob);
+    const double start = dt_get_wtime();
+    blob = dt_mipmap_cache_encode(in, width, height, color_space, codec, &length);
+    encode = MIN(encode, dt_get_wtime() - start);
+  }
+  if(!blob) return;
+
+  int w = 0, h = 0;
+  for(int r = 0; r < reps; r++)
+  {
+    dt_colorspaces_color_profile_type_t cs = DT_COLORSPACE_NONE;
+    const double start = dt_get_wtime();
+    const gboolean error = dt_mipmap_cache_decode(blob, length, out, width, height, &w, &h, &cs);
+    decode = MIN(decode, dt_get_wtime() - start);
+    if(error || w != width || h != height)
+    {
+      free(blob);
+      return;
+    }
+  }
+  free(blob);
+
+  double sq = 0.0;
+  const size_t npixels = (size_t)width * height;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++)
+    {
+      const double d = (double)in[4 * k + c] - out[4 * k + c];
+      sq += d * d;
+    }
+
+  res->count++;
+  res->size += length;
+  res->encode += encode;
+  res->decode += decode;
+  res->mse += sq;
+  res->pixels += 3.0 * npixels;
+}
+
+int main(int argc, char *arg[])
+{
+  int images = 50, reps = 3;
+  dt_mipmap_size_t min_mip = DT_MIPMAP_0, max_mip = DT_MIPMAP_4;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--images") && argc > k + 1)
+      images = MAX(1, atoi(arg[++k]));
+    else if(!strcmp(arg[k], "--min-mip") && argc > k + 1)
+      min_mip = (dt_mipmap_size_t)CLAMP(atoi(arg[++k]), DT_MIPMAP_0, DT_MIPMAP_LDR_MAX);
+    else if(!strcmp(arg[k], "--max-mip") && argc > k + 1)
+      max_mip = (dt_mipmap_size_t)CLAMP(atoi(arg[++k]), DT_MIPMAP_0, DT_MIPMAP_LDR_MAX);
+    else if(!strcmp(arg[k], "--reps") && argc > k + 1)
+      reps = MAX(1, atoi(arg[++k]));
+    else if(!strcmp(arg[k], "--core"))
+    {
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  if(min_mip > max_mip)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  int m_argc = 0;
+  char **m_arg = malloc(sizeof(char *) * (7 + argc - k + 1));
+  m_arg[m_argc++] = "darktable-bench-mipmap";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=never";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "cache_disk_backend=false";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "cache_disk_backend_full=false";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL)) exit(1);
+
+  GList *imgids = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id FROM main.images ORDER BY id LIMIT ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, images);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgids = g_list_prepend(imgids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  imgids = g_list_reverse(imgids);
+
+  if(!imgids)
+  {
+    fprintf(stderr, "no images in the library, pass one with --core --library <file>\n");
+    dt_cleanup();
+    free(m_arg);
+    exit(1);
+  }
+
+  printf("%-4s %-6s %6s %10s %10s %10s %10s %8s\n",
+         "mip", "codec", "images", "kB/image", "enc ms", "dec ms", "dec Mpix/s", "psnr");
+
+  for(dt_mipmap_size_t mip = min_mip; mip <= max_mip; mip++)
+  {
+    bench_result_t res[DT_MIPMAP_CODEC_COUNT] = { { 0 } };
+    for(GList *l = imgids; l; l = g_list_next(l))
+    {
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(&buf, GPOINTER_TO_INT(l->data), mip, DT_MIPMAP_BLOCKING, 'r');
+      if(buf.buf && buf.width > 0 && buf.height > 0)
+      {
+        const size_t size = (size_t)4 * buf.width * buf.height;
+        uint8_t *out = dt_alloc_align_uint8(size);
+        for(int c = 0; out && c < DT_MIPMAP_CODEC_COUNT; c++)
+          _bench_thumbnail(buf.buf, buf.width, buf.height, buf.color_space,
+                           c, reps, out, &res[c]);
+        dt_free_align(out);
+      }
+      dt_mipmap_cache_release(&buf);
+      // the next level must be made from the image, not from this one
+      dt_mipmap_cache_evict_at_size(GPOINTER_TO_INT(l->data), mip);
+    }
+
+    for(int c = 0; c < DT_MIPMAP_CODEC_COUNT; c++)
+    {
+      const bench_result_t *r = &res[c];
+      if(!r->count)
+      {
+        printf("%-4d %-6s %6d\n", (int)mip, dt_mipmap_cache_codec_name(c), 0);
+        continue;
+      }
+      const double mse = r->mse / r->pixels;
+      const double psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+      printf("%-4d %-6s %6d %10.1f %10.3f %10.3f %10.1f %8.2f\n",
+             (int)mip, dt_mipmap_cache_codec_name(c), r->count,
+             r->size / r->count / 1024.0,
+             1000.0 * r->encode / r->count,
+             1000.0 * r->decode / r->count,
+             r->pixels / 3.0 / r->decode * 1e-6,
+             psnr);
+    }
+  }
+
+  g_list_free(imgids);
+  dt_cleanup();
+  free(m_arg);
+  exit(0);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
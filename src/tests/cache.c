@@ -18,111 +18,214 @@
 
 
 #define DT_UNIT_TEST
-// define dt alloc_aligned, so we don't need to include the rest of dt:
-#define dt_alloc_aligned(A, B) malloc(B)
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-// unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it.
+// unit test and contention benchmark for the sharded LRU cache.
 #include "common/cache.h"
 #include "common/cache.c"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-#ifdef _OPENMP
 #include <omp.h>
-#endif
 
-int32_t alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
+static void alloc_dummy(void *data, dt_cache_entry_t *entry)
 {
-  *cost = 1; // also the default
-  *buf = (void *)(long int)key;
-  // request write lock for our buffer?
-  return 0;
+  entry->cost = 1; // also the default
+  entry->data = (void *)(long int)entry->key;
+  entry->data_size = sizeof(void *);
 }
 
-int main(int argc, char *arg[])
+static void cleanup_dummy(void *data, dt_cache_entry_t *entry)
+{
+  entry->data = NULL;
+}
+
+// walk all lru lists forwards and backwards, check links and segment costs
+static int lru_count(dt_cache_t *cache)
+{
+  int cnt = 0;
+  for(uint32_t s = 0; s < cache->num_shards; s++)
+    for(int seg = 0; seg < DT_CACHE_SEGMENT_LAST; seg++)
+    {
+      const dt_cache_lru_t *lru = &cache->shards[s].lru[seg];
+      int fwd = 0, bwd = 0;
+      size_t cost = 0;
+      for(dt_cache_entry_t *e = lru->head; e; e = e->lru_next, fwd++)
+      {
+        assert(e->segment == seg);
+        assert(e->lru_next || e == lru->tail);
+        cost += e->cost;
+      }
+      for(dt_cache_entry_t *e = lru->tail; e; e = e->lru_prev) bwd++;
+      assert(fwd == bwd);
+      assert(cost == lru->cost);
+      (void)bwd;
+      (void)cost;
+      cnt += fwd;
+    }
+  return cnt;
+}
+
+static int hash_count(dt_cache_t *cache)
+{
+  int cnt = 0;
+  for(uint32_t s = 0; s < cache->num_shards; s++)
+    cnt += g_hash_table_size(cache->shards[s].hashtable);
+  return cnt;
+}
+
+static void test_insert(const uint32_t num_shards, const size_t quota)
 {
   dt_cache_t cache;
-  // dt_cache_init(&cache, 110000, 16, 64, 100000);
-  // really hammer it, make quota insanely low:
-  dt_cache_init(&cache, 110000, 16, 64, 100);
+  dt_cache_init(&cache, 0, quota, num_shards);
   dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(guided) shared(cache, stderr) num_threads(16)
+#pragma omp parallel for default(none) schedule(guided) shared(cache) num_threads(16)
 #endif
   for(int k = 0; k < 100000; k++)
   {
-    void *data = (void *)(long int)k;
-    const int size = 0; // dt_cache_size(&cache);
-    const int con1 = dt_cache_contains(&cache, k);
-    const int val1 = (int)(long int)dt_cache_read_get(&cache, k);
-    const int val2 = (int)(long int)dt_cache_read_get(&cache, k);
-    // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1, val2,
-    // con1, con2);
-    const int con2 = dt_cache_contains(&cache, k);
-    assert(con1 == 0);
-    assert(con2 == 1);
-    assert(val2 == k);
-    dt_cache_read_release(&cache, k);
-    dt_cache_read_release(&cache, k);
+    dt_cache_entry_t *e1 = dt_cache_get(&cache, k, 'w');
+    const int val = (int)(long int)e1->data;
+    const int con = dt_cache_contains(&cache, k);
+    assert(con == 1);
+    assert(val == k);
+    (void)val;
+    (void)con;
+    dt_cache_release(&cache, e1);
   }
-  dt_cache_print_locked(&cache);
-  // fprintf(stderr, "\n");
-  fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
-
-  const int size = dt_cache_size(&cache);
-  const int lru_cnt = lru_check_consistency(&cache);
-  const int lru_cnt_r = lru_check_consistency_reverse(&cache);
-  // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
+
+  const int size = hash_count(&cache);
+  const int lru_cnt = lru_count(&cache);
   assert(size == lru_cnt);
-  assert(lru_cnt_r == lru_cnt);
-  fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
+  assert(dt_cache_get_cost(&cache) == (size_t)size);
+  fprintf(stderr, "[passed] %u shard(s), quota %zu: inserting 100000 entries concurrently, "
+          "have %d entries left.\n", cache.num_shards, quota, size);
 
   dt_cache_cleanup(&cache);
+}
 
+// contention benchmark: a read mostly workload on a hot working set,
+// with some misses to exercise allocation and garbage collection.
+static double bench(const uint32_t num_shards, const int threads, const int ops)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 0, 20000, num_shards);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
 
+  const double start = omp_get_wtime();
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) shared(cache) firstprivate(ops) num_threads(threads)
+#endif
+  for(int k = 0; k < ops; k++)
+  {
+    // cheap lcg, 90% of the requests go to a hot set of 4096 keys
+    const uint32_t r = (uint32_t)k * 1664525u + 1013904223u;
+    const uint32_t key = (r % 10) ? (r >> 8) % 4096 : 4096 + (r >> 8) % 100000;
+    dt_cache_entry_t *e = dt_cache_get(&cache, key, 'r');
+    dt_cache_release(&cache, e);
+  }
+  const double end = omp_get_wtime();
+
+  dt_cache_cleanup(&cache);
+  return ops / (end - start);
+}
 
+// a hot set accessed repeatedly must survive a single scan over many
+// other keys when the cache uses the segmented lru policy.
+static void test_scan_resistance(const dt_cache_policy_t policy)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 0, 1000, 1);
+  dt_cache_set_policy(&cache, policy);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+
+  // inserted, read back once and hit again
+  for(int pass = 0; pass < 3; pass++)
+    for(int k = 0; k < 100; k++)
+      dt_cache_release(&cache, dt_cache_get(&cache, k, 'r'));
+
+  // one pass over a film roll
+  for(int k = 1000; k < 20000; k++)
+    dt_cache_release(&cache, dt_cache_get(&cache, k, 'r'));
+
+  int survivors = 0;
+  for(int k = 0; k < 100; k++)
+    survivors += dt_cache_contains(&cache, k);
+  assert(lru_count(&cache) == hash_count(&cache));
+  if(policy == DT_CACHE_POLICY_SLRU) assert(survivors == 100);
+
+  fprintf(stderr, "[passed] %s: %d of 100 hot entries survived a scan, hit rate %.2f%%\n",
+          policy == DT_CACHE_POLICY_SLRU ? "slru" : "lru ", survivors,
+          100.0 * cache.stats_hits / (double)(cache.stats_hits + cache.stats_misses));
+  dt_cache_cleanup(&cache);
+}
+
+// inserting an entry and reading it back once, like filling a thumbnail and
+// drawing it, must not protect it: that is exactly what a scan does.
+static void test_single_hit(void)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 0, 1000, 1);
+  dt_cache_set_policy(&cache, DT_CACHE_POLICY_SLRU);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_cleanup_callback(&cache, cleanup_dummy, NULL);
+
+  dt_cache_release(&cache, dt_cache_get(&cache, 1, 'w'));
+  dt_cache_release(&cache, dt_cache_get(&cache, 1, 'r'));
+  assert(cache.stats_promotions == 0);
+  assert(cache.shards[0].lru[DT_CACHE_SEGMENT_PROTECTED].head == NULL);
+
+  dt_cache_release(&cache, dt_cache_get(&cache, 1, 'r'));
+  assert(cache.stats_promotions == 1);
+  assert(cache.shards[0].lru[DT_CACHE_SEGMENT_PROTECTED].head != NULL);
+  assert(lru_count(&cache) == 1);
+
+  fprintf(stderr, "[passed] slru: an entry is only protected by its second hit after insertion\n");
+  dt_cache_cleanup(&cache);
+}
+
+// every shard's share of the quota must hold a few of the largest entries,
+// otherwise they are evicted right after being inserted.
+static void test_auto_shards(void)
+{
+  const size_t quota = 1024lu << 20;
+  for(size_t max_cost = 1; max_cost <= quota; max_cost <<= 4)
   {
-    // now a harder case: a cache with only one entry and a lot of threads fighting over it:
-    dt_cache_t cache2;
-    // really hammer it, make quota insanely low:
-    // capacity 1 num threads 1 cache line size 64 ignored, quota 2 (80% => 1)
-    dt_cache_init(&cache2, 1, 1, 64, 2);
-    dt_cache_set_allocate_callback(&cache2, alloc_dummy, NULL);
+    const uint32_t shards = dt_cache_auto_shards(quota, max_cost);
+    assert(shards >= 1 && shards <= DT_CACHE_MAX_SHARDS);
+    assert((shards & (shards - 1)) == 0);
+    assert(shards == 1 || quota / shards >= DT_CACHE_MIN_ENTRIES_PER_SHARD * max_cost);
+    (void)shards;
+  }
+  fprintf(stderr, "[passed] auto shard count keeps %d of the largest entries per shard\n",
+          DT_CACHE_MIN_ENTRIES_PER_SHARD);
+}
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(guided) shared(cache2, stderr) num_threads(16)
-#endif
-    for(int k = 0; k < 100000; k++)
-    {
-      void *data = (void *)(long int)k;
-      const int size = 0; // dt_cache_size(&cache);
-      const int con1 = dt_cache_contains(&cache2, k);
-      const int val1 = (int)(long int)dt_cache_read_get(&cache2, k);
-      const int val2 = (int)(long int)dt_cache_read_get(&cache2, k);
-      // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1,
-      // val2, con1, con2);
-      const int con2 = dt_cache_contains(&cache2, k);
-      assert(con1 == 0);
-      assert(con2 == 1);
-      assert(val2 == k);
-      dt_cache_read_release(&cache2, k);
-      dt_cache_read_release(&cache2, k);
-    }
-    dt_cache_print_locked(&cache2);
-    // fprintf(stderr, "\n");
-    fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
-
-    const int size = dt_cache_size(&cache2);
-    const int lru_cnt = lru_check_consistency(&cache2);
-    const int lru_cnt_r = lru_check_consistency_reverse(&cache2);
-    // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-    assert(size == lru_cnt);
-    assert(lru_cnt_r == lru_cnt);
-    fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
-    dt_cache_cleanup(&cache2);
+int main(int argc, char *arg[])
+{
+  // really hammer it, make quota insanely low:
+  test_insert(1, 100);
+  test_insert(DT_CACHE_SHARDS_AUTO, 100);
+  // capacity 1 and a lot of threads fighting over it:
+  test_insert(1, 2);
+  test_insert(DT_CACHE_SHARDS_AUTO, 2);
+  test_scan_resistance(DT_CACHE_POLICY_LRU);
+  test_scan_resistance(DT_CACHE_POLICY_SLRU);
+  test_single_hit();
+  test_auto_shards();
+
+  const int ops = argc > 1 ? atoi(arg[1]) : 2000000;
+  const int max_threads = omp_get_max_threads();
+  fprintf(stderr, "threads    1 shard [Mops/s]   %2d shards [Mops/s]\n", DT_CACHE_MAX_SHARDS);
+  for(int threads = 1; threads <= max_threads; threads *= 2)
+  {
+    const double single = bench(1, threads, ops);
+    const double sharded = bench(DT_CACHE_MAX_SHARDS, threads, ops);
+    fprintf(stderr, "%7d %18.2f %20.2f\n", threads, single * 1e-6, sharded * 1e-6);
   }
 
   exit(0);